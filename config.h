@@ -15,11 +15,17 @@
 #define ADAPTIVE_FACE_SEARCH    1
 #define ADAPTIVE_RECURSIVE      1
 #define ADAPTIVE_NUM_STEPS      21      /* 21 default */
+#define ADAPTIVE_SIZE_NUM_STEPS 21      /* 21 default */
 #define HAAR_SCALE_FACTOR       1.1    /* 1.1 default */
+/* HARDWIRE_HAAR_SETTINGS, ADAPTIVE_* and HAAR_SCALE_FACTOR are only the 
+   defaults for SearchStrategy. They can be changed at run time. See search_strategy.h */
 #define DRAW_FACES              1
 #define DRAW_WAIT               1000
 #define SHOW_ALL_RECTANGLES     1
 #define VERBOSE                 1
+#ifndef STAGE_TIMING
+ #define STAGE_TIMING           0       /* Per stage timers. See stage_timer.h */
+#endif
 
 #if defined(NOT_MAC_APP) || 0
  #undef MAC_APP
@@ -153,7 +153,7 @@ IplImage* cropImage(const IplImage* image, PwRect rect) {
 }
 #endif
 
-IplImage* scaleImageWH(IplImage* image, int max_width, int max_height) {
+IplImage* scaleImageWH(const IplImage* image, int max_width, int max_height) {
     double scale_x = (double)max_width/(double)image->width;
     double scale_y = (double)max_height/(double)image->height;
     IplImage* dest_image;
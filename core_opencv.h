@@ -15,7 +15,7 @@ CvPoint PwPointToCvPoint(PwPoint point);
 IplImage*  rotateImage(const IplImage* image, double angle, PwPoint centerIn);
 IplImage*  resizeImage(const IplImage* image, int x_pels, int y_pels);
 IplImage*  cropImage(const IplImage* image, PwRect rect);
-IplImage*  scaleImageWH(IplImage* image, int max_width, int max_height);
+IplImage*  scaleImageWH(const IplImage* image, int max_width, int max_height);
 
 /*
  * Return point that a rotation of 'angle' around 'centerIn' would move to 'pt'
@@ -5,76 +5,135 @@
  *  Created by peter on 11/03/10.
  */
  
+#include <charconv>
 #include <iostream>
 #include <fstream>
+#include <thread>
 #include <vector>
 #include <stdlib.h>
+#include <string.h>
 #include "face_csv.h"
+#include "file_mapping.h"
+#include "work_pool.h"
 
 using namespace std;
 
-static string trim(const string& in) {
-    string out = "";
-    string whitespace = " \t\r\n";
-    string::size_type p2 = in.find_last_not_of(whitespace);
-    if (p2 != string::npos) {
-         string::size_type p1 = in.find_first_not_of(whitespace);
-        if (p1 == string::npos) p1 = 0;
-        out = in.substr(p1, (p2-p1)+1);
+// Files at least this big are split into rows on several threads
+static const size_t PARALLEL_CSV_BYTES = 4*1024*1024;
+static const size_t MIN_CSV_CHUNK_BYTES = 1024*1024;
+
+static bool isCsvSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static string_view trimView(string_view v) {
+    size_t b = 0, e = v.size();
+    while (b < e && isCsvSpace(v[b]))
+        b++;
+    while (e > b && isCsvSpace(v[e - 1]))
+        e--;
+    return v.substr(b, e - b);
+}
+
+/*
+ *  Same splitting as readCsvRow() without copying the fields
+ */
+static void splitCsvLine(string_view line, vector<string_view>& fields) {
+    line = trimView(line);
+    if (line.size() == 0)
+        return;
+    size_t last_pos = 0;
+    while (last_pos != string_view::npos) {
+        size_t pos = line.find(',', last_pos);
+        string_view val = trimView(line.substr(last_pos, pos == string_view::npos ? string_view::npos : pos - last_pos));
+        if (pos != string_view::npos || val.size() > 0)  // Not last in line or not empty
+            fields.push_back(val);
+        if (pos == string_view::npos)
+            break;
+        last_pos = line.find_first_not_of(',', pos);
     }
-    return out;
-}
-
-static vector<string> readCsvRow(string line) {
-    const string delimiters = ",";
-    vector<string> row;
-    line = trim(line);
-    if (line.size() > 0) {
-       string::size_type last_pos = 0;
-        while (last_pos != string::npos) {
-            string val;
-            string::size_type pos = line.find_first_of(delimiters, last_pos);
-            val = trim(line.substr(last_pos, pos - last_pos));
-            if (pos != string::npos || val.size() > 0) {  // Not last in line or not empty
-                const string cval(val);
-                row.push_back(cval);
-            }
-            if (pos == string::npos)
-                break;
-            last_pos = line.find_first_not_of(delimiters, pos);
-        }
+}
+
+static void splitCsvChunk(const char* begin, const char* end, vector<string_view>& fields, vector<size_t>& row_starts) {
+    const char* p = begin;
+    while (p < end) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        size_t num_fields = fields.size();
+        splitCsvLine(string_view(p, eol - p), fields);
+        if (fields.size() > num_fields)
+            row_starts.push_back(num_fields);
+        p = eol + 1;
     }
-    return row;
 }
 
+/*
+ *  Start of the line after p, or end
+ */
+static const char* nextLine(const char* p, const char* end) {
+    const char* eol = (const char*)memchr(p, '\n', end - p);
+    return eol ? eol + 1 : end;
+}
+
+void splitCsvRows(const char* data, size_t size, vector<string_view>& fields, vector<size_t>& row_starts) {
+    fields.clear();
+    row_starts.clear();
+    const char* end = data + size;
+    int num_chunks = 1;
+    if (size >= PARALLEL_CSV_BYTES)
+        num_chunks = (int)min((size_t)getNumCores(), size/MIN_CSV_CHUNK_BYTES);
+    if (num_chunks <= 1) {
+        splitCsvChunk(data, end, fields, row_starts);
+    }
+    else {
+        // Chunks start at line starts so no line is split between threads
+        vector<const char*> starts(num_chunks + 1, end);
+        starts[0] = data;
+        for (int i = 1; i < num_chunks; i++)
+            starts[i] = max(starts[i - 1], nextLine(data + (size*i)/num_chunks - 1, end));
+        vector<vector<string_view> > chunk_fields(num_chunks);
+        vector<vector<size_t> >      chunk_row_starts(num_chunks);
+        vector<thread> threads;
+        for (int i = 1; i < num_chunks; i++)
+            threads.push_back(thread(splitCsvChunk, starts[i], starts[i + 1], ref(chunk_fields[i]), ref(chunk_row_starts[i])));
+        splitCsvChunk(starts[0], starts[1], chunk_fields[0], chunk_row_starts[0]);
+        for (int i = 0; i < (int)threads.size(); i++)
+            threads[i].join();
+        for (int i = 0; i < num_chunks; i++) {
+            size_t offset = fields.size();
+            for (int j = 0; j < (int)chunk_row_starts[i].size(); j++)
+                row_starts.push_back(chunk_row_starts[i][j] + offset);
+            fields.insert(fields.end(), chunk_fields[i].begin(), chunk_fields[i].end());
+        }
+    }
+    row_starts.push_back(fields.size());
+}
 
 /*
  *  Read a CSV file. Comma separated. One file per line
  */
 bool readCsvFile(vector<vector<string> >& rows, const string files_path, bool has_header_row) {
     rows.resize(0);
-    bool ok = true;
-    ifstream input_file;
-    input_file.open(files_path.c_str(), fstream::in);
-    if (!input_file.is_open()) {
-        cerr << "Could not open " << files_path << endl;
-        ok = false;
-    }
-    else {
-        string line;
-        while (getline(input_file, line)) {
-            vector<string> row = readCsvRow(line);
-            if (row.size() > 0)
-                rows.push_back(row);
+    CSV csv;
+    if (!csv.read(files_path, false))
+        return false;
+    int num_rows = csv.getNumRows();
+    rows.resize(num_rows);
+    for (int i = 0; i < num_rows; i++) {
+        for (int j = 0; ; j++) {
+            string_view v = csv.getView(i, j);
+            if (v.data() == 0)
+                break;
+            rows[i].push_back(string(v));
         }
-        input_file.close();
-        if (has_header_row && rows.size() >= 1) {
-            int num_cols = rows[0].size();
-            for (int i = 1; i < (int)rows.size(); i++)
-                rows[i].resize(num_cols);
-        }       
     }
-    return ok;
+    if (has_header_row && rows.size() >= 1) {
+        int num_cols = rows[0].size();
+        for (int i = 1; i < (int)rows.size(); i++)
+            rows[i].resize(num_cols);
+    }       
+    return true;
 }
 
 /*
@@ -119,31 +178,41 @@ static bool writeCsvFile(const vector<vector<string> >& rows, const string file_
 
 bool CSV::read(string file_path, bool has_header_row) {
     _has_header_row = has_header_row;
-    _rows.resize(0);
+    _fields.clear();
+    _row_starts.assign(1, 0);
+    _index.clear();
   
-    bool ok = readCsvFile(_rows,  file_path, _has_header_row);
-    if (ok && _has_header_row && _rows.size() >= 1) {
-        vector<string> header_row = _rows[0];
-        for (int i = 0; i < (int)header_row.size(); i++) {
-            _index.insert(make_pair<const string, int>(header_row[i], i));
-        }
+    shared_ptr<FileMapping> mapping(new FileMapping());
+    if (!mapping->open(file_path)) {
+        cerr << "Could not open " << file_path << endl;
+        _mapping.reset();
+        return false;
     }
-    return ok;
+    _mapping = mapping;
+    splitCsvRows(mapping->_data, mapping->_size, _fields, _row_starts);
+    vector<string> header_row = getHeader();
+    for (int i = 0; i < (int)header_row.size(); i++) 
+        _index.insert(make_pair(header_row[i], i));
+    return true;
 }
 
 void CSV::writeRowsToStream(ostream& out) const  {
-    if (_has_header_row && _rows.size() >= 1) {
-        vector<string> header_row = _rows[0];
+    if (_has_header_row && _row_starts.size() >= 2) {
+        vector<string> header_row = getHeader();
         vector<string>::const_iterator it;
-        for (it = header_row.begin(); it != header_row.end(); it++)
+        vector<int> cols;
+        for (it = header_row.begin(); it != header_row.end(); it++) {
             out << *it << ", ";
+            cols.push_back(_index[*it]);
+        }
         out << endl;
         cerr << "getNumRows() = " << getNumRows() << endl;
         for (int row_num = 0; row_num < getNumRows(); row_num++) {
-            for (it = header_row.begin(); it != header_row.end(); it++)
-                out << get(row_num, *it) << ", ";
-            out << endl;
+            for (int i = 0; i < (int)cols.size(); i++)
+                out << getView(row_num, cols[i]) << ", ";
+            out << '\n';
         }
+        out.flush();
     }
 }
 
@@ -153,7 +222,7 @@ bool CSV::write(string file_path) const {
     ofstream output_file;
        
     if (file_path.size() > 0) {
-        output_file.open(file_path.c_str(), fstream::in);
+        output_file.open(file_path.c_str(), fstream::out | fstream::trunc);
         if (!output_file.is_open()) {
             cerr << "Could not open " << file_path << endl;
             ok = false;
@@ -166,19 +235,35 @@ bool CSV::write(string file_path) const {
 }
 
 int  CSV::getNumRows() const { 
-    return (_has_header_row && _rows.size() > 0) ? _rows.size() -1 : _rows.size();
+    int num_rows = _row_starts.size() > 0 ? (int)_row_starts.size() - 1 : 0;
+    return (_has_header_row && num_rows > 0) ? num_rows - 1 : num_rows;
 }
 
 vector<string> CSV::getHeader() const {
     vector<string> header_row(0);
-    if (_has_header_row && _rows.size() >= 1)
-        header_row = _rows[0];
+    if (_has_header_row && _row_starts.size() >= 2)
+        for (size_t i = _row_starts[0]; i < _row_starts[1]; i++)
+            header_row.push_back(string(_fields[i]));
     return header_row;
 }
 
+/*
+ *  A null view if the row has no field col_num. With a header row every 
+ *  row reads as having the header's number of columns
+ */
+string_view CSV::getView(int row_num, int col_num) const {
+    size_t n = _has_header_row ? row_num + 1 : row_num;
+    size_t num_cols = _row_starts[n + 1] - _row_starts[n];
+    if (col_num < 0 || (size_t)col_num >= num_cols) {
+        if (_has_header_row && (size_t)col_num < _row_starts[1] - _row_starts[0])
+            return string_view("", 0);
+        return string_view();
+    }
+    return _fields[_row_starts[n] + col_num];
+}
+
 const string CSV::get(int row_num, int col_num) const  {
-    int n = _has_header_row ? row_num + 1 : row_num;
-    return _rows[n][col_num];
+    return string(getView(row_num, col_num));
 }
 
 const string CSV::get(int row_num,  const string col_name) const  {
@@ -199,3 +284,67 @@ const string CSV::get(int row_num,  const string col_name) const  {
     return val;
 }
 
+bool CsvTable::read(string file_path) {
+    bool ok = _csv.read(file_path, true);
+    _names = _csv.getHeader();
+    int num_cols = _names.size();
+    _ints.assign(num_cols, vector<int>());
+    _doubles.assign(num_cols, vector<double>());
+    _ints_parsed.assign(num_cols, false);
+    _doubles_parsed.assign(num_cols, false);
+    return ok;
+}
+
+int CsvTable::getColumn(const string name) const {
+    for (int i = 0; i < (int)_names.size(); i++)
+        if (_names[i] == name)
+            return i;
+    return -1;
+}
+
+/*
+ *  from_chars() does not take a leading '+'. atoi() and strtod() do
+ */
+static string_view numberText(string_view v) {
+    if (v.size() > 1 && v[0] == '+')
+        v.remove_prefix(1);
+    return v;
+}
+
+int csvToInt(string_view v) {
+    int n = 0;
+    v = numberText(v);
+    from_chars(v.data(), v.data() + v.size(), n);
+    return n;
+}
+
+double csvToDouble(string_view v) {
+    double x = 0.0;
+    v = numberText(v);
+    from_chars(v.data(), v.data() + v.size(), x);
+    return x;
+}
+
+const vector<int>& CsvTable::getInts(int col) {
+    if (!_ints_parsed[col]) {
+        int num_rows = getNumRows();
+        vector<int>& values = _ints[col];
+        values.assign(num_rows, 0);
+        for (int i = 0; i < num_rows; i++)
+            values[i] = csvToInt(getText(i, col));
+        _ints_parsed[col] = true;
+    }
+    return _ints[col];
+}
+
+const vector<double>& CsvTable::getDoubles(int col) {
+    if (!_doubles_parsed[col]) {
+        int num_rows = getNumRows();
+        vector<double>& values = _doubles[col];
+        values.assign(num_rows, 0.0);
+        for (int i = 0; i < num_rows; i++)
+            values[i] = csvToDouble(getText(i, col));
+        _doubles_parsed[col] = true;
+    }
+    return _doubles[col];
+}
@@ -0,0 +1,87 @@
+/*
+ *  detect_trace.cpp
+ *  FaceTracker
+ *
+ *  Per image trace of detect calls
+ */
+
+#include <iomanip>
+#include "detect_trace.h"
+
+using namespace std;
+
+static const char* phase_names[NUM_SEARCH_PHASES] = {
+    "none", "histogram", "smallest_rect", "center", "size", "track"
+};
+
+const char* getSearchPhaseName(int phase) {
+    return phase >= 0 && phase < NUM_SEARCH_PHASES ? phase_names[phase] : "?";
+}
+
+DetectTraceSummary::DetectTraceSummary(): _num_images(0) {
+    for (int i = 0; i < NUM_SEARCH_PHASES; i++) {
+        _calls[i] = 0;
+        _accepted[i] = 0;
+        _duplicates[i] = 0;
+        _ms[i] = 0.0;
+    }
+}
+
+void DetectTraceSummary::add(const DetectTrace& trace) {
+    set<vector<int> > seen;
+    for (int i = 0; i < (int)trace._calls.size(); i++) {
+        const DetectCall& c = trace._calls[i];
+        _calls[c._phase]++;
+        _accepted[c._phase] += c._accepted ? 1 : 0;
+        _ms[c._phase] += c._ms;
+        vector<int> key(4);
+        key[0] = c._rect.x;
+        key[1] = c._rect.y;
+        key[2] = c._rect.width;
+        key[3] = c._rect.height;
+        if (!seen.insert(key).second)
+            _duplicates[c._phase]++;
+    }
+    _num_images++;
+}
+
+void writeDetectTrace(const string image_name, const DetectTrace& trace, ostream& out) {
+    ios_base::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << "# " << image_name << " " << trace._calls.size() << endl;
+    for (int i = 0; i < (int)trace._calls.size(); i++) {
+        const DetectCall& c = trace._calls[i];
+        out << phase_names[c._phase] << " "
+            << c._rect.x << " " << c._rect.y << " " << c._rect.width << " " << c._rect.height << " "
+            << c._num_faces << " " << (c._accepted ? 1 : 0) << " "
+            << fixed << setprecision(3) << c._ms << endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void showDetectTraceSummary(const DetectTraceSummary& summary, ostream& out) {
+    ios_base::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    long total_calls = 0, total_duplicates = 0;
+    for (int i = 0; i < NUM_SEARCH_PHASES; i++) {
+        total_calls += summary._calls[i];
+        total_duplicates += summary._duplicates[i];
+    }
+    out << "PHASE, CALLS, CALLS_PER_IMAGE, ACCEPTED, DUPLICATES, DUPLICATE_SHARE, MS" << endl;
+    for (int i = 0; i < NUM_SEARCH_PHASES; i++) {
+        if (summary._calls[i] == 0)
+            continue;
+        out << setw(13) << phase_names[i] << ", "
+            << setw(8) << summary._calls[i] << ", "
+            << setw(8) << fixed << setprecision(2) << (summary._num_images > 0 ? (double)summary._calls[i]/(double)summary._num_images : 0.0) << ", "
+            << setw(8) << summary._accepted[i] << ", "
+            << setw(8) << summary._duplicates[i] << ", "
+            << setw(6) << setprecision(3) << (double)summary._duplicates[i]/(double)summary._calls[i] << ", "
+            << setw(10) << setprecision(1) << summary._ms[i] << endl;
+    }
+    out << "images = " << summary._num_images << ", detect calls = " << total_calls
+        << ", duplicate rect share = " << setprecision(3) << (total_calls > 0 ? (double)total_duplicates/(double)total_calls : 0.0) << endl;
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,68 @@
+#ifndef DETECT_TRACE_H
+#define DETECT_TRACE_H
+/*
+ *  detect_trace.h
+ *  FaceTracker
+ *
+ *  Record of every detectFacesCrop() call made while framing one image:
+ *  the search phase that made it, the rect searched, the number of faces
+ *  found, whether the search accepted the result and how long it took.
+ *
+ *  Tracing is on for a DetectorState when its _trace is set.
+ */
+
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "face_common.h"
+
+enum SearchPhase {
+    PHASE_NONE,
+    PHASE_HISTOGRAM,
+    PHASE_SMALLEST_RECT,
+    PHASE_CENTER,
+    PHASE_SIZE,
+    PHASE_TRACK,
+    NUM_SEARCH_PHASES
+};
+
+const char* getSearchPhaseName(int phase);
+
+struct DetectCall {
+    SearchPhase _phase;
+    PwRect      _rect;          // In dp._current_frame coordinates. Whole frame if no rect was given
+    int         _num_faces;
+    bool        _accepted;      // hasValidFace*() accepted it. Always false for PHASE_HISTOGRAM
+    double      _ms;
+    DetectCall(): _phase(PHASE_NONE), _num_faces(0), _accepted(false), _ms(0.0) {}
+};
+
+struct DetectTrace {
+    std::vector<DetectCall> _calls;
+    void clear() { _calls.clear(); }
+};
+
+/*
+ *  Totals over many images. A duplicate is a call on a rect already searched
+ *  for the same image
+ */
+struct DetectTraceSummary {
+    long    _num_images;
+    long    _calls[NUM_SEARCH_PHASES];
+    long    _accepted[NUM_SEARCH_PHASES];
+    long    _duplicates[NUM_SEARCH_PHASES];
+    double  _ms[NUM_SEARCH_PHASES];
+    DetectTraceSummary();
+    void add(const DetectTrace& trace);
+};
+
+/*
+ *  Compact log. One "# <image name> <number of calls>" line, then per call
+ *      <phase> <x> <y> <width> <height> <faces> <accepted> <ms>
+ */
+void writeDetectTrace(const std::string image_name, const DetectTrace& trace, std::ostream& out);
+void showDetectTraceSummary(const DetectTraceSummary& summary, std::ostream& out);
+
+#endif // #ifndef DETECT_TRACE_H
@@ -0,0 +1,292 @@
+/*
+ *  detection_cache.cpp
+ *  FaceTracker
+ *
+ *  Persistent cache of detection results keyed by image contents
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <unordered_map>
+#include <sys/stat.h>
+#include "detection_cache.h"
+#include "file_mapping.h"
+
+using namespace std;
+
+static const char     CACHE_MAGIC[8] = { 'F', 'T', 'D', 'C', 'A', 'C', 'H', 'E' };
+static const uint32_t CACHE_FORMAT_VERSION = 1;
+static const size_t   CACHE_HEADER_BYTES = 8 + 4 + 4 + 8 + 8;
+static const size_t   RECORD_HEADER_BYTES = 8 + 8 + 4*4;
+static const size_t   SETTING_BYTES = 4 + 4 + 8 + 4*4;
+
+/*
+ *  _lock guards everything below it.
+ *  _stored points at records in _mapping. _inserted holds records added
+ *  this run, which replace any stored record with the same key.
+ */
+struct DetectionCache {
+    string                  _path;
+    long                    _max_bytes;
+    FileMapping             _mapping;
+    uint64_t                _run;           // Number of this run
+    
+    mutable mutex           _lock;
+    unordered_map<uint64_t, const char*>        _stored;
+    unordered_map<uint64_t, uint64_t>           _used;      // Stored records used this run
+    unordered_map<uint64_t, CachedDetection>    _inserted;
+    DetectionCacheStats     _stats;
+};
+
+template <class T> static T readValue(const char* p) {
+    T value;
+    memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+template <class T> static void writeValue(ostream& out, T value) {
+    out.write((const char*)&value, sizeof(T));
+}
+
+static size_t getRecordBytes(size_t num_settings) {
+    return RECORD_HEADER_BYTES + num_settings*SETTING_BYTES;
+}
+
+static CachedDetection parseRecord(const char* p) {
+    CachedDetection d;
+    d._face_center.x = readValue<int32_t>(p + 16);
+    d._face_center.y = readValue<int32_t>(p + 20);
+    d._face_radius = readValue<int32_t>(p + 24);
+    uint32_t n = readValue<uint32_t>(p + 28);
+    p += RECORD_HEADER_BYTES;
+    for (uint32_t i = 0; i < n; i++, p += SETTING_BYTES) {
+        CachedSetting s;
+        s._min_neighbors = readValue<int32_t>(p);
+        s._scale_factor = readValue<double>(p + 8);
+        s._face = PwRect(readValue<int32_t>(p + 16), readValue<int32_t>(p + 20), readValue<int32_t>(p + 24), readValue<int32_t>(p + 28));
+        d._settings.push_back(s);
+    }
+    return d;
+}
+
+static void writeRecord(ostream& out, uint64_t key, uint64_t last_used, const CachedDetection& d) {
+    writeValue<uint64_t>(out, key);
+    writeValue<uint64_t>(out, last_used);
+    writeValue<int32_t>(out, d._face_center.x);
+    writeValue<int32_t>(out, d._face_center.y);
+    writeValue<int32_t>(out, d._face_radius);
+    writeValue<uint32_t>(out, d._settings.size());
+    for (int i = 0; i < (int)d._settings.size(); i++) {
+        const CachedSetting& s = d._settings[i];
+        writeValue<int32_t>(out, s._min_neighbors);
+        writeValue<int32_t>(out, 0);
+        writeValue<double>(out, s._scale_factor);
+        writeValue<int32_t>(out, s._face.x);
+        writeValue<int32_t>(out, s._face.y);
+        writeValue<int32_t>(out, s._face.width);
+        writeValue<int32_t>(out, s._face.height);
+    }
+}
+
+/*
+ *  Index the records in cache->_mapping. Returns false if it is not a cache file
+ */
+static bool indexRecords(DetectionCache* cache) {
+    const char* data = cache->_mapping._data;
+    size_t size = cache->_mapping._size;
+    if (size < CACHE_HEADER_BYTES || memcmp(data, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 
+        || readValue<uint32_t>(data + 8) != CACHE_FORMAT_VERSION)
+        return false;
+    cache->_run = readValue<uint64_t>(data + 16) + 1;
+    uint64_t num_records = readValue<uint64_t>(data + 24);
+    size_t pos = CACHE_HEADER_BYTES;
+    for (uint64_t i = 0; i < num_records; i++) {
+        if (size - pos < RECORD_HEADER_BYTES)
+            return false;
+        size_t n = readValue<uint32_t>(data + pos + 28);
+        if ((size - pos - RECORD_HEADER_BYTES)/SETTING_BYTES < n)
+            return false;
+        cache->_stored[readValue<uint64_t>(data + pos)] = data + pos;
+        pos += getRecordBytes(n);
+    }
+    return true;
+}
+
+DetectionCache* openDetectionCache(const string path, long max_bytes, string* error) {
+    DetectionCache* cache = new DetectionCache;
+    cache->_path = path;
+    cache->_max_bytes = max_bytes;
+    cache->_run = 1;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        if (!cache->_mapping.open(path) || !indexRecords(cache)) {
+            if (error)
+                *error = "'" + path + "' is not a detection cache file";
+            delete cache;
+            return 0;
+        }
+        cache->_stats._file_bytes = cache->_mapping._size;
+    }
+    cache->_stats._num_records = cache->_stored.size();
+    return cache;
+}
+
+bool lookupDetection(DetectionCache* cache, uint64_t key, CachedDetection* detection) {
+    lock_guard<mutex> guard(cache->_lock);
+    cache->_stats._num_lookups++;
+    unordered_map<uint64_t, CachedDetection>::const_iterator it = cache->_inserted.find(key);
+    if (it != cache->_inserted.end()) {
+        *detection = it->second;
+    }
+    else {
+        unordered_map<uint64_t, const char*>::const_iterator is = cache->_stored.find(key);
+        if (is == cache->_stored.end())
+            return false;
+        *detection = parseRecord(is->second);
+        cache->_used[key] = cache->_run;
+    }
+    cache->_stats._num_hits++;
+    return true;
+}
+
+void insertDetection(DetectionCache* cache, uint64_t key, const CachedDetection& detection) {
+    lock_guard<mutex> guard(cache->_lock);
+    cache->_inserted[key] = detection;
+    cache->_stats._num_inserted++;
+}
+
+DetectionCacheStats getDetectionCacheStats(const DetectionCache* cache) {
+    lock_guard<mutex> guard(cache->_lock);
+    return cache->_stats;
+}
+
+/*
+ *  A record to keep when the cache is written
+ */
+struct CacheRecordRef {
+    uint64_t                _key;
+    uint64_t                _last_used;
+    size_t                  _bytes;
+    const char*             _stored;        // 0 => in _inserted
+};
+
+static bool isMoreRecent(const CacheRecordRef& a, const CacheRecordRef& b) {
+    return a._last_used > b._last_used;
+}
+
+/*
+ *  Write the records that fit in _max_bytes, most recently used first, to
+ *  a temporary file and move it over the cache file
+ */
+static bool writeCacheFile(DetectionCache* cache, string* error) {
+    vector<CacheRecordRef> records;
+    for (unordered_map<uint64_t, const char*>::const_iterator it = cache->_stored.begin(); it != cache->_stored.end(); it++) {
+        if (cache->_inserted.count(it->first))
+            continue;
+        CacheRecordRef r;
+        r._key = it->first;
+        unordered_map<uint64_t, uint64_t>::const_iterator iu = cache->_used.find(it->first);
+        r._last_used = iu != cache->_used.end() ? iu->second : readValue<uint64_t>(it->second + 8);
+        r._bytes = getRecordBytes(readValue<uint32_t>(it->second + 28));
+        r._stored = it->second;
+        records.push_back(r);
+    }
+    for (unordered_map<uint64_t, CachedDetection>::const_iterator it = cache->_inserted.begin(); it != cache->_inserted.end(); it++) {
+        CacheRecordRef r;
+        r._key = it->first;
+        r._last_used = cache->_run;
+        r._bytes = getRecordBytes(it->second._settings.size());
+        r._stored = 0;
+        records.push_back(r);
+    }
+    stable_sort(records.begin(), records.end(), isMoreRecent);
+    size_t num_kept = 0;
+    long bytes = CACHE_HEADER_BYTES;
+    while (num_kept < records.size() && bytes + (long)records[num_kept]._bytes <= cache->_max_bytes)
+        bytes += records[num_kept++]._bytes;
+    cache->_stats._num_evicted = records.size() - num_kept;
+    cache->_stats._num_records = num_kept;
+    cache->_stats._file_bytes = bytes;
+    
+    string temp_path = cache->_path + ".tmp";
+    ofstream out(temp_path.c_str(), ios::out | ios::trunc | ios::binary);
+    out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    writeValue<uint32_t>(out, CACHE_FORMAT_VERSION);
+    writeValue<uint32_t>(out, 0);
+    writeValue<uint64_t>(out, cache->_run);
+    writeValue<uint64_t>(out, num_kept);
+    for (size_t i = 0; i < num_kept; i++) {
+        const CacheRecordRef& r = records[i];
+        if (r._stored) {
+            out.write(r._stored, 8);
+            writeValue<uint64_t>(out, r._last_used);
+            out.write(r._stored + 16, r._bytes - 16);
+        }
+        else
+            writeRecord(out, r._key, r._last_used, cache->_inserted[r._key]);
+    }
+    out.close();
+    if (out.fail() || rename(temp_path.c_str(), cache->_path.c_str()) != 0) {
+        remove(temp_path.c_str());
+        if (error)
+            *error = "Could not write detection cache '" + cache->_path + "'";
+        return false;
+    }
+    return true;
+}
+
+bool closeDetectionCache(DetectionCache** cache, DetectionCacheStats* stats, string* error) {
+    bool ok = true;
+    if (*cache) {
+        {
+            lock_guard<mutex> guard((*cache)->_lock);
+            // Nothing to write if nothing was added or used
+            if ((*cache)->_inserted.size() > 0 || (*cache)->_used.size() > 0)
+                ok = writeCacheFile(*cache, error);
+            if (stats)
+                *stats = (*cache)->_stats;
+        }
+        delete *cache;
+        *cache = 0;
+    }
+    return ok;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool hashFileContents(const string path, uint64_t* hash) {
+    FileMapping mapping;
+    if (!mapping.open(path))
+        return false;
+    *hash = hashBytes(mapping._data, mapping._size);
+    return true;
+}
+
+uint64_t makeDetectionKey(uint64_t content_hash, const FileEntry& entry, const string settings) {
+    uint64_t hash = hashBytes(&content_hash, sizeof(content_hash));
+    hash = hashBytes(&entry._face_center.x, sizeof(entry._face_center.x), hash);
+    hash = hashBytes(&entry._face_center.y, sizeof(entry._face_center.y), hash);
+    hash = hashBytes(&entry._face_radius, sizeof(entry._face_radius), hash);
+    hash = hashBytes(&entry._face_angle, sizeof(entry._face_angle), hash);
+    hash = hashBytes(settings.data(), settings.size(), hash);
+    return hashBytes(&DETECTION_CACHE_CODE_VERSION, sizeof(DETECTION_CACHE_CODE_VERSION), hash);
+}
+
+void showDetectionCacheStats(const DetectionCacheStats& stats, ostream& out) {
+    double hit_rate = stats._num_lookups > 0 ? (double)stats._num_hits/(double)stats._num_lookups : 0.0;
+    out << "Detection cache: " << stats._num_hits << " hits in " << stats._num_lookups << " lookups (" 
+        << fixed << setprecision(1) << 100.0*hit_rate << "%), " << stats._num_inserted << " added, " 
+        << stats._num_evicted << " evicted, " << stats._num_records << " records, " 
+        << setprecision(2) << stats._file_bytes/(1024.0*1024.0) << " MB" << defaultfloat << setprecision(6) << endl;
+}
@@ -0,0 +1,100 @@
+#ifndef DETECTION_CACHE_H
+#define DETECTION_CACHE_H
+/*
+ *  detection_cache.h
+ *  FaceTracker
+ *
+ *  Persistent cache of detection results, so that a batch run can skip
+ *  decoding and searching images it has already searched the same way.
+ *
+ *  The key is a hash of the image file's contents, the file list's face
+ *  center, radius and angle for it (they choose the region searched), the
+ *  cascade, the search settings and DETECTION_CACHE_CODE_VERSION. Bump the version when a code
+ *  change alters results. The value holds the best face for each
+ *  (min_neighbors, scale_factor) setting of a TEST_MANY_SETTINGS run.
+ *
+ *  The cache file is memory mapped when opened and records are parsed from
+ *  the mapping only when looked up. New records are kept in memory and the
+ *  file is rewritten on close, least recently used records first to go if
+ *  it would be over its size limit.
+ *
+ *  Layout. Numbers are in the byte order of the machine that wrote them
+ *      "FTDCACHE", uint32 format version, uint32 unused, uint64 run number, 
+ *      uint64 number of records
+ *      records:  uint64 key, uint64 run last used, int32 face_center_x, 
+ *                face_center_y, face_radius, uint32 number of settings
+ *                settings: int32 min_neighbors, int32 unused, double scale_factor,
+ *                          int32 face x, y, width, height
+ */
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "face_common.h"
+#include "face_io.h"
+
+static const int DETECTION_CACHE_CODE_VERSION = 2;
+
+struct CachedSetting {
+    int     _min_neighbors;
+    double  _scale_factor;
+    PwRect  _face;
+    CachedSetting(): _min_neighbors(0), _scale_factor(0.0) {}
+};
+
+struct CachedDetection {
+    PwPoint _face_center;       // DetectorState::_entry after setCurrentFrame()
+    int     _face_radius;
+    std::vector<CachedSetting> _settings;
+    CachedDetection(): _face_radius(0) {}
+};
+
+struct DetectionCacheStats {
+    long    _num_lookups;
+    long    _num_hits;
+    long    _num_inserted;
+    long    _num_evicted;       // When the cache was closed
+    long    _num_records;       // In the file when it was opened, then when it was closed
+    long    _file_bytes;
+    DetectionCacheStats(): _num_lookups(0), _num_hits(0), _num_inserted(0), _num_evicted(0), _num_records(0), _file_bytes(0) {}
+};
+
+struct DetectionCache;
+
+/*
+ *  A missing cache file opens as an empty cache. Returns 0 and sets *error
+ *  if path exists and is not a cache file
+ */
+DetectionCache* openDetectionCache(const std::string path, long max_bytes, std::string* error);
+
+/*
+ *  Write the cache file, evicting records to fit max_bytes, and free cache.
+ *  *stats, if not 0, gets the final stats. Returns false and sets *error if
+ *  the file could not be written
+ */
+bool closeDetectionCache(DetectionCache** cache, DetectionCacheStats* stats, std::string* error);
+
+/*
+ *  Thread safe
+ */
+bool lookupDetection(DetectionCache* cache, uint64_t key, CachedDetection* detection);
+void insertDetection(DetectionCache* cache, uint64_t key, const CachedDetection& detection);
+DetectionCacheStats getDetectionCacheStats(const DetectionCache* cache);
+
+/*
+ *  FNV-1a. Returns false if path cannot be read
+ */
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL);
+bool     hashFileContents(const std::string path, uint64_t* hash);
+
+/*
+ *  entry is the image's file list entry. settings must describe everything 
+ *  else that affects results
+ */
+uint64_t makeDetectionKey(uint64_t content_hash, const FileEntry& entry, const std::string settings);
+
+void showDetectionCacheStats(const DetectionCacheStats& stats, std::ostream& out);
+
+#endif // #ifndef DETECTION_CACHE_H
@@ -0,0 +1,205 @@
+/*
+ *  detection_log.cpp
+ *  FaceTracker
+ *
+ *  Record and replay detector answers
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "detection_log.h"
+#include "face_calc.h"
+
+using namespace std;
+
+/*
+ *  Positions from 0 to max_pos inclusive, step apart
+ */
+static vector<int> makePositions(int max_pos, int step) {
+    vector<int> positions;
+    for (int p = 0; p < max_pos; p += step)
+        positions.push_back(p);
+    positions.push_back(max_pos);
+    return positions;
+}
+
+vector<PwRect> makeDetectGrid(PwRect frame, const DetectGridParams& params) {
+    vector<PwRect> grid;
+    for (double scale = 1.0; ; scale *= params._scale_step) {
+        int w = (int)floor((double)frame.width*scale + 0.5);
+        int h = (int)floor((double)frame.height*scale + 0.5);
+        if (min(w, h) < params._min_size || w <= 0 || h <= 0)
+            break;
+        vector<int> xs = makePositions(frame.width - w,  max(1, (int)floor((double)w*params._position_step + 0.5)));
+        vector<int> ys = makePositions(frame.height - h, max(1, (int)floor((double)h*params._position_step + 0.5)));
+        for (int j = 0; j < (int)ys.size(); j++)
+            for (int i = 0; i < (int)xs.size(); i++)
+                grid.push_back(PwRect(frame.x + xs[i], frame.y + ys[j], w, h));
+        if (params._scale_step <= 0.0 || params._scale_step >= 1.0)
+            break;
+    }
+    return grid;
+}
+
+void recordDetectGrid(const DetectorState& dp, const FileEntry& entry, const DetectGridParams& params, ImageDetectLog* log) {
+    log->_image_name = entry._image_name;
+    log->_original_size = dp._original_size;
+    log->_scaled_size = dp._scaled_size;
+    log->_cropped_size = dp._cropped_size;
+    log->_frame_width = dp._current_frame->width;
+    log->_frame_height = dp._current_frame->height;
+    log->_face_crop_ratio = dp._face_crop_ratio;
+    log->_face_center = entry._face_center;
+    log->_face_radius = entry._face_radius;
+    vector<PwRect> grid = makeDetectGrid(PwRect(0, 0, dp._current_frame->width, dp._current_frame->height), params);
+    log->_detects.resize(grid.size());
+    for (int i = 0; i < (int)grid.size(); i++) {
+        log->_detects[i]._rect = grid[i];
+        log->_detects[i]._faces = detectFacesCrop(dp, &grid[i]);
+    }
+}
+
+static int rectDistance(PwRect a, PwRect b) {
+    return abs(a.x - b.x) + abs(a.y - b.y) + abs(a.width - b.width) + abs(a.height - b.height);
+}
+
+vector<PwRect> replayDetect(const ImageDetectLog& log, PwRect rect) {
+    const RecordedDetect* nearest = 0;
+    int nearest_distance = 0;
+    for (int i = 0; i < (int)log._detects.size(); i++) {
+        int d = rectDistance(log._detects[i]._rect, rect);
+        if (!nearest || d < nearest_distance) {
+            nearest = &log._detects[i];
+            nearest_distance = d;
+            if (d == 0)
+                break;
+        }
+    }
+    vector<PwRect> faces;
+    if (nearest) {
+        for (int i = 0; i < (int)nearest->_faces.size(); i++)
+            if (containsRect(rect, nearest->_faces[i]))
+                faces.push_back(nearest->_faces[i]);
+    }
+    return faces;
+}
+
+void setReplayFrame(DetectorState& dp, const ImageDetectLog& log) {
+    startSearchBudget(dp);
+    dp._replay = &log;
+    dp._original_size = log._original_size;
+    dp._scaled_size = log._scaled_size;
+    dp._cropped_size = log._cropped_size;
+    dp._face_crop_ratio = log._face_crop_ratio;
+    dp._current_frame = cvCreateImageHeader(cvSize(log._frame_width, log._frame_height), IPL_DEPTH_8U, 3);
+}
+
+void releaseReplayFrame(DetectorState& dp) {
+    cvReleaseImageHeader(&dp._current_frame);
+    dp._replay = 0;
+}
+
+static void writeRect(PwRect r, ostream& out) {
+    out << r.x << " " << r.y << " " << r.width << " " << r.height;
+}
+
+static bool readRect(istream& in, PwRect* r) {
+    return (bool)(in >> r->x >> r->y >> r->width >> r->height);
+}
+
+void writeDetectLogHeader(const SearchStrategy& strategy, const DetectGridParams& params, ostream& out) {
+    out << "# detect log " << strategyAsString(strategy) << " " << params._scale_step << " " << params._position_step << " " << params._min_size << endl;
+    out << "# detector " << setprecision(9) << strategy._scale_factor << " " << strategy._min_neighbors << " " 
+        << (strategy._hardwire_haar_settings ? 1 : 0) << endl;
+}
+
+void writeImageDetectLog(const ImageDetectLog& log, ostream& out) {
+    out << "image " << log._image_name << endl;
+    out << "sizes ";
+    writeRect(log._original_size, out);
+    out << " ";
+    writeRect(log._scaled_size, out);
+    out << " ";
+    writeRect(log._cropped_size, out);
+    out << " " << log._frame_width << " " << log._frame_height;
+    out << " " << setprecision(9) << log._face_crop_ratio << " "
+        << log._face_center.x << " " << log._face_center.y << " " << log._face_radius << endl;
+    for (int i = 0; i < (int)log._detects.size(); i++) {
+        const RecordedDetect& d = log._detects[i];
+        writeRect(d._rect, out);
+        out << " " << d._faces.size();
+        for (int j = 0; j < (int)d._faces.size(); j++) {
+            out << " ";
+            writeRect(d._faces[j], out);
+        }
+        out << "\n";
+    }
+    out << "end" << endl;
+}
+
+bool readDetectLog(const string path, DetectLogSettings* settings, vector<ImageDetectLog>* logs, string* error) {
+    ifstream in(path.c_str());
+    if (!in) {
+        if (error)
+            *error = "Could not read detect log '" + path + "'";
+        return false;
+    }
+    string line;
+    int line_num = 0;
+    ImageDetectLog* log = 0;
+    while (getline(in, line)) {
+        line_num++;
+        bool ok = true;
+        if (line.compare(0, 13, "# detect log ") == 0) {
+            istringstream s(line.substr(13));
+            ok = (bool)(s >> settings->_strategy);
+        }
+        else if (line.compare(0, 11, "# detector ") == 0) {
+            istringstream s(line.substr(11));
+            int hardwire = 0;
+            ok = (bool)(s >> settings->_scale_factor >> settings->_min_neighbors >> hardwire);
+            settings->_hardwire_haar_settings = hardwire != 0;
+            settings->_has_detector = ok;
+        }
+        else if (line.compare(0, 6, "image ") == 0) {
+            logs->push_back(ImageDetectLog());
+            log = &logs->back();
+            log->_image_name = line.substr(6);
+        }
+        else if (line.compare(0, 6, "sizes ") == 0 && log) {
+            istringstream s(line.substr(6));
+            ok = readRect(s, &log->_original_size) && readRect(s, &log->_scaled_size) && readRect(s, &log->_cropped_size)
+              && (s >> log->_frame_width >> log->_frame_height >> log->_face_crop_ratio >> log->_face_center.x >> log->_face_center.y >> log->_face_radius);
+        }
+        else if (line == "end") {
+            log = 0;
+        }
+        else if (log) {
+            istringstream s(line);
+            RecordedDetect d;
+            int num_faces = 0;
+            ok = readRect(s, &d._rect) && (s >> num_faces) && num_faces >= 0;
+            for (int j = 0; ok && j < num_faces; j++) {
+                PwRect face;
+                ok = readRect(s, &face);
+                d._faces.push_back(face);
+            }
+            if (ok)
+                log->_detects.push_back(d);
+        }
+        else
+            ok = false;
+        if (!ok) {
+            if (error) {
+                ostringstream s;
+                s << path << ":" << line_num << ": Bad detect log line";
+                *error = s.str();
+            }
+            return false;
+        }
+    }
+    return true;
+}
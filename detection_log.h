@@ -0,0 +1,109 @@
+#ifndef DETECTION_LOG_H
+#define DETECTION_LOG_H
+/*
+ *  detection_log.h
+ *  FaceTracker
+ *
+ *  Recorded detector answers for offline search strategy experiments.
+ *
+ *  Recording runs the detector on a dense grid of rects (positions and
+ *  sizes) in each image's search frame and saves the faces found in each.
+ *  Replaying sets DetectorState::_replay so that detectFacesCrop() answers
+ *  from the recording instead of running the detector: the rect asked for
+ *  is matched to the nearest recorded rect and the faces recorded there
+ *  that lie inside the rect asked for are returned. Any search strategy can
+ *  then be run on the recordings in a fraction of the time it takes to run
+ *  the detector.
+ *
+ *  Settings that change the detector itself (scale_factor, min_neighbors,
+ *  hardwire) are fixed by the recording and saved in its header.
+ */
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "face_common.h"
+#include "face_detect.h"
+
+struct DetectGridParams {
+    double  _scale_step;        // Ratio of the sizes of successive rects
+    double  _position_step;     // Step between positions as a fraction of rect size
+    int     _min_size;          // Smallest rect side. The detector finds nothing smaller than 60 pixels
+    DetectGridParams(): _scale_step(0.9), _position_step(0.1), _min_size(60) {}
+};
+
+struct RecordedDetect {
+    PwRect              _rect;      // In search frame coordinates
+    std::vector<PwRect> _faces;     // In search frame coordinates, sorted by size
+};
+
+/*
+ *  Everything needed to replay the search of one image
+ */
+struct ImageDetectLog {
+    std::string _image_name;
+    PwRect      _original_size;
+    PwRect      _scaled_size;
+    PwRect      _cropped_size;      // Search frame in scaled image coordinates
+    int         _frame_width;       // dp._current_frame
+    int         _frame_height;
+    double      _face_crop_ratio;
+    PwPoint     _face_center;       // Ground truth in scaled image coordinates
+    int         _face_radius;       // 0 if there is no ground truth
+    std::vector<RecordedDetect> _detects;
+    ImageDetectLog(): _frame_width(0), _frame_height(0), _face_crop_ratio(0.0), _face_radius(0) {}
+};
+
+/*
+ *  The strategy a log was recorded with. Only the detector settings matter
+ *  to a replay
+ */
+struct DetectLogSettings {
+    std::string _strategy;              // strategyAsString() of the recording strategy
+    bool        _has_detector;          // Detector settings below were in the log. Older logs lack them
+    double      _scale_factor;
+    int         _min_neighbors;
+    bool        _hardwire_haar_settings;
+    DetectLogSettings(): _has_detector(false), _scale_factor(0.0), _min_neighbors(0), _hardwire_haar_settings(false) {}
+};
+
+/*
+ *  All rects in frame from the whole frame down to params._min_size. Each
+ *  size has the aspect ratio of frame
+ */
+std::vector<PwRect> makeDetectGrid(PwRect frame, const DetectGridParams& params);
+
+/*
+ *  Run the detector on every grid rect of dp._current_frame. dp must have
+ *  had setCurrentFrame() called for entry and have no search budget
+ */
+void recordDetectGrid(const DetectorState& dp, const FileEntry& entry, const DetectGridParams& params, ImageDetectLog* log);
+
+/*
+ *  The recorded answer for a detectFacesCrop() call on rect
+ */
+std::vector<PwRect> replayDetect(const ImageDetectLog& log, PwRect rect);
+
+/*
+ *  Set up dp to search log's image from the recording. The current frame
+ *  has the size of the recorded search frame but no pixels.
+ *  Caller must releaseReplayFrame(dp)
+ */
+void setReplayFrame(DetectorState& dp, const ImageDetectLog& log);
+void releaseReplayFrame(DetectorState& dp);
+
+/*
+ *  Text format
+ *      # detect log <recording strategy> <scale step> <position step> <min size>
+ *      # detector <scale factor> <min neighbors> <hardwire 0 or 1>
+ *      image <image name>
+ *      sizes <original x y w h> <scaled x y w h> <cropped x y w h> <frame w h> <crop ratio> <face x> <face y> <face radius>
+ *      <x> <y> <w> <h> <number of faces> [<face x> <face y> <face w> <face h>] ...
+ *      end
+ */
+void writeDetectLogHeader(const SearchStrategy& strategy, const DetectGridParams& params, std::ostream& out);
+void writeImageDetectLog(const ImageDetectLog& log, std::ostream& out);
+bool readDetectLog(const std::string path, DetectLogSettings* settings, std::vector<ImageDetectLog>* logs, std::string* error);
+
+#endif // #ifndef DETECTION_LOG_H
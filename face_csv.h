@@ -1,3 +1,5 @@
+#ifndef FACE_CSV_H
+#define FACE_CSV_H
 /*
  *  csv.h
  *  FaceTracker
@@ -5,9 +7,11 @@
  *  Created by peter on 11/03/10.
  */
 #include <string>
+#include <string_view>
 #include <vector>
 #include <ostream>
 #include <map>
+#include <memory>
 #include "config.h"
 
 const std::string KEY_IMAGE_NAME    = "IMAGE_NAME";
@@ -16,17 +20,69 @@ const std::string KEY_FACE_CENTER_Y = "FACE_CENTER_Y";
 const std::string KEY_FACE_RADIUS   = "FACE_RADIUS";
 const std::string KEY_FACE_ANGLE    = "FACE_ANGLE";
 
+struct FileMapping;
+
+/*
+ *  The file is memory mapped and fields are views into the mapping, so
+ *  reading allocates per row, not per field. Large files are split into
+ *  rows on several threads. Copies of a CSV share the mapping.
+ */
 class CSV {
-    std::vector<std::vector<std::string> >      _rows;
+    std::shared_ptr<const FileMapping>          _mapping;
+    std::vector<std::string_view>               _fields;    // All fields of all rows in file order
+    std::vector<size_t>                         _row_starts; // Row i is _fields[_row_starts[i].._row_starts[i+1])
     mutable std::map<const std::string, int>    _index;
     bool                    _has_header_row;
     void   writeRowsToStream(std::ostream& out) const;
 public:
+    CSV(): _has_header_row(false) {}
     bool   read(std::string file_path, bool has_header_row);
     bool   write(std::string file_path) const;
     int    getNumRows() const; 
     std::vector<std::string> getHeader() const;
     const std::string get(int row_num, int col_num) const;
     const std::string get(int row_num, const std::string col_name) const;
+    /*
+     *  No copy. Valid while this CSV or a copy of it exists
+     */
+    std::string_view getView(int row_num, int col_num) const;
+};
+
+/*
+ *  A CSV file with a header row stored by column. Look columns up by name
+ *  once with getColumn(), then index rows. Numeric columns are parsed into
+ *  contiguous arrays on the first getInts() or getDoubles() for the column.
+ *  Missing and unparsable numbers read as 0.
+ */
+class CsvTable {
+    CSV                                 _csv;
+    std::vector<std::string>            _names;
+    std::vector<std::vector<int> >      _ints;      // Empty until parsed
+    std::vector<std::vector<double> >   _doubles;
+    std::vector<bool>                   _ints_parsed;
+    std::vector<bool>                   _doubles_parsed;
+public:
+    bool   read(std::string file_path);
+    int    getNumRows() const { return _csv.getNumRows(); }
+    int    getNumCols() const { return (int)_names.size(); }
+    int    getColumn(const std::string name) const;     // -1 if there is no such column
+    std::string_view getText(int row_num, int col) const { return _csv.getView(row_num, col); }
+    const std::vector<int>&    getInts(int col);
+    const std::vector<double>& getDoubles(int col);
 };
 
+/*
+ *  Split the CSV text in data into fields. Whitespace around fields is
+ *  dropped, as are blank lines and empty fields at the ends of lines. A
+ *  run of commas separates like a single comma.
+ *  Row i is fields[row_starts[i]..row_starts[i+1])
+ */
+void splitCsvRows(const char* data, size_t size, std::vector<std::string_view>& fields, std::vector<size_t>& row_starts);
+
+/*
+ *  Numeric field values. As atoi() and strtod() but 0 for anything unparsable
+ */
+int    csvToInt(std::string_view v);
+double csvToDouble(std::string_view v);
+
+#endif // #ifndef FACE_CSV_H
@@ -0,0 +1,618 @@
+/*
+ *  face_detect.cpp
+ *  FaceTracker
+ *
+ *  Haar face detection and face searches. Split out of 
+ *  face_tracker_adjustable_frame.cpp so they can be linked into other programs
+ */
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include "face_detect.h"
+#include "face_calc.h"
+#include "face_util.h"
+#include "core_opencv.h"
+#include "pipeline_trace.h"
+#include "detection_log.h"
+
+using namespace std;
+
+static bool SortFacesByArea(PwRect r1, PwRect r2) {
+    return r1.width*r1.height > r2.width*r2.height;
+}
+
+
+/*
+ *  Run the Haar detector on dp._current_frame cropped to rect, or on the 
+ *  whole image if rect == 0
+ */
+static vector<PwRect> runHaarDetector(const DetectorState& dp, const PwRect* rect)    {
+    CvSeq* faces = 0;
+    IplImage* cropped_image = dp._current_frame;
+    if (rect) {
+       STAGE_TIMER(dp._stage_times, STAGE_CROP);
+       cropped_image = cropImage(dp._current_frame, *rect);
+       dp._memory.add(IMAGE_DETECT_CROP, cropped_image);
+       assert(containsRect(PwRect(0, 0, dp._current_frame->width, dp._current_frame->height), *rect));
+    }
+    IplImage* gray_image  = cvCreateImage(cvSize(cropped_image->width, cropped_image->height), IPL_DEPTH_8U, 1);
+    IplImage* small_image = cvCreateImage(cvSize(cropped_image->width/SMALL_IMAGE_SCALE, cropped_image->height/SMALL_IMAGE_SCALE), IPL_DEPTH_8U, 1);
+    dp._memory.add(IMAGE_DETECT_GRAY, gray_image);
+    dp._memory.add(IMAGE_DETECT_SMALL, small_image);
+
+    // convert to gray and downsize
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_GRAY);
+        cvCvtColor (cropped_image, gray_image, CV_BGR2GRAY);
+    }
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_RESIZE);
+        cvResize (gray_image, small_image, CV_INTER_LINEAR);
+    }
+        
+        // detect faces
+    const SearchStrategy& strategy = dp._strategy;
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_HAAR);
+        TRACE_SPAN("haar", "detect");
+        faces = cvHaarDetectObjects (small_image, dp._cascade, dp._storage,
+                                    strategy._hardwire_haar_settings ? HAAR_SCALE_FACTOR : strategy._scale_factor, 
+                                    strategy._hardwire_haar_settings ? 2 : strategy._min_neighbors, 
+                                        CV_HAAR_DO_CANNY_PRUNING, cvSize (30, 30));
+    }
+    dp._memory.sampleStorage(dp._storage);
+         
+    vector <PwRect> face_list(faces != 0 ? faces->total : 0);
+    for (int j = 0; j < (int)face_list.size(); j++) {
+        face_list[j] = CvRectToPwRect(*((CvRect*) cvGetSeqElem (faces, j)));
+        assert(containsRect(PwRect(0, 0, small_image->width, small_image->height), face_list[j]));
+       // Scale up to original image size
+        face_list[j].x = cvRound((double)face_list[j].x*(double)cropped_image->width /(double)small_image->width);
+        face_list[j].y = cvRound((double)face_list[j].y*(double)cropped_image->height/(double)small_image->height);
+        face_list[j].width  = cvRound((double)face_list[j].width* (double)cropped_image->width /(double)small_image->width);
+        face_list[j].height = cvRound((double)face_list[j].height*(double)cropped_image->height/(double)small_image->height);
+        PwRect r = face_list[j];
+        assert(containsRect(PwRect(0, 0, cropped_image->width, cropped_image->height), face_list[j]));
+       
+        // Correct for offset of cropped image in original
+        if (rect) {
+            face_list[j].x += rect->x;
+            face_list[j].y += rect->y;
+            assert(containsRect(*rect, face_list[j]));
+        }
+        assert(containsRect(PwRect(0, 0, dp._current_frame->width, dp._current_frame->height), face_list[j]));
+    }
+
+    if (face_list.size() > 1) 
+        sort(face_list.begin(), face_list.end(), SortFacesByArea);
+ 
+    // Free images afer last call to cvGetSeqElem() !
+    if (rect) {
+        dp._memory.remove(IMAGE_DETECT_CROP, cropped_image);
+        cvReleaseImage(&cropped_image); 
+    }
+    dp._memory.remove(IMAGE_DETECT_GRAY, gray_image);
+    dp._memory.remove(IMAGE_DETECT_SMALL, small_image);
+    cvReleaseImage(&gray_image);
+    cvReleaseImage(&small_image);   
+    return face_list;
+}
+
+/*
+ *  Detects faces in dp._current_frame cropped to rect
+ *  Detects faces in whole image if rect == 0
+ *  Returns list of face rectangles sorted by size
+ *  Answers come from dp._replay instead of the detector if it is set
+ */
+vector<PwRect> detectFacesCrop(const DetectorState& dp, const PwRect* rect)    {
+    if (isSearchBudgetExhausted(dp))
+        return vector<PwRect>();
+    dp._num_detect_calls++;
+    chrono::steady_clock::time_point trace_start;
+    if (dp._trace)
+        trace_start = chrono::steady_clock::now();
+#if TEST_NO_CROP
+    *((PwRect*) rect) = EMPTY_RECT;
+#endif
+    PwRect frame_rect(0, 0, dp._current_frame->width, dp._current_frame->height);
+    vector<PwRect> face_list = dp._replay ? replayDetect(*dp._replay, rect ? *rect : frame_rect) 
+                                          : runHaarDetector(dp, rect);
+    
+    if (dp._trace) {
+        DetectCall call;
+        call._phase = dp._phase;
+        call._rect = rect ? *rect : frame_rect;
+        call._num_faces = (int)face_list.size();
+        call._ms = chrono::duration<double, milli>(chrono::steady_clock::now() - trace_start).count();
+        dp._trace->_calls.push_back(call);
+    }
+    return face_list;
+}
+
+/*
+ *  Record in the trace whether the search accepted the faces from the last
+ *  detectFacesCrop() call. Returns accepted
+ */
+static bool traceAccepted(const DetectorState& dp, bool accepted) {
+    if (dp._trace && dp._trace->_calls.size() > 0)
+        dp._trace->_calls.back()._accepted = accepted;
+    return accepted;
+}
+
+vector<PwRect> detectFaces(const DetectorState& dp)    {
+    return detectFacesCrop(dp, 0);
+}
+
+/*
+ * Detect faces within a set of frames (ROI rectangles)
+ *   croppedFrameList contains the frames at input and recieves the lists of faces for
+ *   each rect at output
+ */
+void detectFacesMultiFrame(const DetectorState& dp, CroppedFrameList* croppedFrameList) {	
+    for (int i = 0; i < (int)croppedFrameList->_frames.size(); i++) {
+        PwRect rect =  croppedFrameList->_frames[i]._rect;
+        vector<PwRect> faces = detectFacesCrop(dp, &rect);
+        croppedFrameList->_frames[i]._faces = faces;
+    }
+}
+
+
+CroppedFrameList_Histogram createMultiFrameList_ConcentricImage(const DetectorState& dp) {
+    int    num_frames = 40;
+    CroppedFrameList_Histogram cropped_frame_list;
+    cropped_frame_list._frames.resize(num_frames);
+    int image_width  = dp._current_frame->width;
+    int image_height = dp._current_frame->height;
+    PwRect rect;
+    for (int i = 0; i < num_frames; i++) { 
+        rect.x = i/2;
+        rect.y = i/2; 
+        rect.width  = image_width  - i; 
+        rect.height = image_height - i; 
+        cropped_frame_list._frames[i]._rect = rect;
+    }
+    cropped_frame_list._primary = cropped_frame_list._frames[0]._rect;
+    return cropped_frame_list;
+}
+
+
+ 
+/*  
+ *   Detect faces in an image and a set of frames (ROI rects) within that image
+ */ 
+CroppedFrameList_Histogram detectFaces_Histogram(const DetectorState& dp)    {
+    //CroppedFrameList frame_list = createMultiFrameList_Cross(mp, face);
+    CroppedFrameList_Histogram frame_list = createMultiFrameList_ConcentricImage(dp);
+    {
+        TRACE_SPAN("histogram", "phase");
+        dp._phase = PHASE_HISTOGRAM;
+        detectFacesMultiFrame(dp, &frame_list);
+    }
+    dp._phase = PHASE_NONE;
+    return frame_list;
+}
+
+
+/*****************************************************************************************
+ * Mehran's adaptive method
+ *****************************************************************************************/
+
+static bool hasValidFace(const vector<PwRect> faces, int min_allowed_width, int min_allowed_height) {
+    return (faces.size() > 0 && faces[0].width >= min_allowed_width && faces[0].height >= min_allowed_height);
+}
+
+static bool hasValidFaceTolerance(const vector<PwRect> faces, PwPoint face_center, int tolerance) {
+    bool within_tolerance = false;
+    if (faces.size() > 0) {
+        PwPoint center = getCenter(faces[0]);
+        double distance = hypot((double)(center.x - face_center.x), (double)(center.y - face_center.y));
+        within_tolerance = (distance <= tolerance);
+    }
+    return within_tolerance;
+}
+
+static bool hasValidFaceBoth(const vector<PwRect> faces, int min_allowed_width, int min_allowed_height, PwPoint face_center, int tolerance) {
+    return hasValidFace(faces, min_allowed_width, min_allowed_height) && hasValidFaceTolerance(faces, face_center, tolerance);
+}
+
+/*
+ *  Returns the smallest rectangle concentric with outer_rect that holds a 
+ *  valid face. The face found in it is returned in good_face
+ */
+static PwRect findSmallestFaceRectangle(const DetectorState& dp, PwRect outer_rect, int min_allowed_width, int min_allowed_height, PwRect* good_face) {
+    double min_delta = 0.01;
+    double delta = 0.1;
+    double good_scale_factor =  1.0 + delta;
+    PwRect good_rect = outer_rect;
+    *good_face = EMPTY_RECT;
+    
+    while (delta >=  min_delta) {
+        double scale_factor = good_scale_factor;
+        while (true) {
+            scale_factor /= 1.0 + delta;
+            PwRect rect = scaleRectConcentric(outer_rect, scale_factor); 
+            vector<PwRect> faces = detectFacesCrop(dp, &rect);
+            if (!traceAccepted(dp, hasValidFace(faces, min_allowed_width, min_allowed_height))) 
+                break;
+            good_rect = rect;
+            *good_face = faces[0];
+            good_scale_factor = scale_factor;
+        }
+        delta /= 2.0;
+    }
+    return good_rect;
+}
+
+/*
+enlarge the frame and detect face
+- repeat while face center falls within some tolerance of the original face center till failure
+- then reduce the frame from *-
+- use the mid point of these as the stable face radius
+
+    Test in range 0.5x to 2.0x original face size = facter of 4;
+*/
+static PwRect findFaceSize(const DetectorState& dp, /* PwRect outer_frame, */ PwRect start_frame, PwRect start_face,
+                                        int min_allowed_width, int min_allowed_height, double tolerance_ratio) {
+    double min_ratio = 0.5;     // Min frame size / start_frame_size
+    double max_ratio = 2.0;     // Max frame size / start_frame_size 
+    int num_steps = dp._strategy._size_num_steps;  // Number of frame sizes to check
+    
+    double ratio_range = max_ratio/min_ratio;
+    double ratio_step = log(ratio_range)/(double)num_steps;
+    int tolerance = cvRound(hypot(start_face.width, start_face.height)*tolerance_ratio);
+    
+    int min_i = -1, max_i = -1;
+    vector<CroppedFrame> frameSpan(num_steps);
+    PwPoint face_center = getCenter(start_face);
+    for (int i = num_steps/2; i >= 0; i--) {
+        PwRect rect = scaleRectConcentric(start_frame, exp(ratio_step*(double)(i- num_steps/2))) ;
+        vector<PwRect> faces = detectFacesCrop(dp, &rect);
+        if (!traceAccepted(dp, hasValidFaceBoth(faces, min_allowed_width, min_allowed_height, face_center, tolerance)))
+            break;
+        CroppedFrame frame(rect, faces);
+        frameSpan[i] = frame;
+         min_i = i;
+        if (max_i < 0)
+            max_i = i;
+    }
+    for (int i = num_steps/2+1; i < num_steps; i++) {
+        assert(ratio_step*(double)(i- num_steps/2) <= 1.0);
+        PwRect rect = scaleRectConcentric(start_frame, exp(ratio_step*(double)(i- num_steps/2)));
+   //     assert(containsRect(outer_frame, rect));
+  //      assert(containsRect(cvRect(0, 0, dp._current_frame->width, dp._current_frame->height), outer_frame));
+        // Faces near the edge of the image run out of room before the sweep 
+        // ends. Stop at the largest frame that fits
+        if (!(containsRect(PwRect(0, 0, dp._current_frame->width, dp._current_frame->height), rect)))
+            break;
+        vector<PwRect> faces = detectFacesCrop(dp, &rect);
+        if (!traceAccepted(dp, hasValidFaceBoth(faces, min_allowed_width, min_allowed_height, face_center, tolerance)))
+            break;
+        CroppedFrame frame(rect, faces);
+        frameSpan[i] = frame;
+        max_i = i;
+        if (max_i < 0)
+            min_i = i;
+    }
+    
+    PwRect best_face;
+    if (min_i >= 0 && max_i >= 0) {
+        int mid_i = (min_i + max_i)/2; 
+        best_face = frameSpan[mid_i]._faces[0];
+    }
+    else {
+        // No frame in the sweep found a suitable face
+        best_face = start_face;
+    }
+    return best_face;
+}
+
+/*
+ *  If the budget ran out before the search finished, return the best face
+ *  found so far
+ */
+static void useBestFaceSoFar(const DetectorState& dp, CroppedFrameList_Adaptive& frame_list, PwRect smallest_face) {
+    if (!dp._degraded || !isEmptyRect(frame_list._final_face))
+        return;
+    if (!isEmptyRect(frame_list._position_face))
+        frame_list._final_face = frame_list._position_face;
+    else
+        frame_list._final_face = smallest_face;
+}
+
+static CroppedFrameList_Adaptive findFaceCenter(const DetectorState& dp, PwRect base_rect, int min_allowed_width, int min_allowed_height) {
+    int    num_steps = dp._strategy._adaptive_num_steps;    // Max number of steps to search in x and y direction
+    int    image_width  = dp._current_frame->width;
+    int    image_height = dp._current_frame->height;
+    PwRect rect = base_rect;
+    
+    int dx = (image_width - rect.width)/num_steps;
+    int dy = (image_height - rect.height)/num_steps;
+    
+    CroppedFrameList_Adaptive frame_list;
+    int mid_ix = -1, mid_iy = -1;
+    int min_i = -1, max_i = -1;
+    vector<CroppedFrame> frameSpanX(num_steps);
+    for (int i = num_steps/2; i >= 0; i--) {
+        PwRect rect(base_rect.x + (i- num_steps/2)*dx, base_rect.y, base_rect.width, base_rect.height);
+        vector<PwRect> faces = detectFacesCrop(dp, &rect);
+        if (!traceAccepted(dp, hasValidFace(faces, min_allowed_width, min_allowed_height)))
+            break;
+        CroppedFrame frame(rect, faces);
+        frameSpanX[i] = frame;
+        frame_list._frames.push_back(frame);
+        min_i = i;
+        if (max_i < 0)
+            max_i = i;
+    }
+    for (int i = num_steps/2 + 1; i < num_steps; i++) {
+       PwRect rect(base_rect.x + (i- num_steps/2)*dx, base_rect.y, base_rect.width, base_rect.height);
+        vector<PwRect> faces = detectFacesCrop(dp, &rect);
+        if (!traceAccepted(dp, hasValidFace(faces, min_allowed_width, min_allowed_height)))
+            break;
+        CroppedFrame frame(rect, faces);
+        frameSpanX[i] = frame;
+        frame_list._frames.push_back(frame);
+        max_i = i;
+        if (min_i < 0)
+            min_i = i;
+    }
+    if (min_i >= 0 && max_i >= 0)
+        mid_ix = (min_i + max_i)/2; 
+    
+    min_i = -1, max_i = -1;
+    vector<CroppedFrame> frameSpanY(num_steps);
+    for (int i = num_steps/2; i >= 0; i--) {
+        PwRect rect(base_rect.x, base_rect.y + (i- num_steps/2)*dy, base_rect.width, base_rect.height);
+        vector<PwRect> faces = detectFacesCrop(dp, &rect);
+        if (!traceAccepted(dp, hasValidFace(faces, min_allowed_width, min_allowed_height)))
+            break;
+        CroppedFrame frame(rect, faces);
+        frameSpanY[i] = frame;
+        frame_list._frames.push_back(frame);
+        min_i = i;
+        if (max_i < 0)
+            max_i = i;
+    }
+    for (int i = num_steps/2 + 1; i < num_steps; i++) {
+        PwRect rect(base_rect.x, base_rect.y + (i- num_steps/2)*dy, base_rect.width, base_rect.height);
+        vector<PwRect> faces = detectFacesCrop(dp, &rect);
+        if (!traceAccepted(dp, hasValidFace(faces, min_allowed_width, min_allowed_height)))
+            break;
+        CroppedFrame frame(rect, faces);
+        frameSpanY[i] = frame;
+        frame_list._frames.push_back(frame);
+        max_i = i;
+        if (min_i < 0)
+            min_i = i;
+    }
+    if (min_i >= 0 && max_i >= 0)
+        mid_iy = (min_i + max_i)/2; 
+   
+    if (mid_ix > 0 && mid_iy > 0) {
+        PwPoint center;
+        center.x = getCenter(frameSpanX[mid_ix]._rect).x;
+        center.y = getCenter(frameSpanY[mid_iy]._rect).y;
+        frame_list._position_face  = averageRects(frameSpanX[mid_ix]._faces[0], frameSpanY[mid_iy]._faces[0]);
+        frame_list._position_frame = PwRect(center.x - base_rect.width/2, center.y - base_rect.height/2, base_rect.width, base_rect.height);
+        assert(containsRect(frame_list._position_frame, frame_list._position_face));
+    }
+    return frame_list;
+}
+
+CroppedFrameList_Adaptive detectFacesCenter_Adaptive(const DetectorState& dp)    {
+   
+   
+  //  double frame_to_original = 1.1; // 1.3 kind of works; // 1.6 works;
+  //  double frame_growth = 1.1;
+      int    image_width  = dp._current_frame->width;
+    int    image_height = dp._current_frame->height;
+    
+    // False positive detection. 
+    //      tolerance_ratio = (max dist between face centers)/(frame diameter) = 0.1
+    //      min_scale = (min face diameter)/(frame diameter) = 0.8 
+    double  tolerance_ratio = cvRound(0.1/dp._face_crop_ratio);
+    double  min_face_factor = cvRound(0.8/dp._face_crop_ratio);
+    // Min face sizes - used to eliminate false positive face detections. min_face_factor * original detected face size
+    int min_allowed_width  = cvRound((double)image_width*min_face_factor);
+    int min_allowed_height = cvRound((double)image_height*min_face_factor);
+
+
+      
+    // Guess at right size for rectangle
+   // PwRect base_rect = scaleRectConcentric(cvRect(0,0,image_width,image_height), frame_to_original/dp._face_crop_ratio); 
+    // Find smallest rectangle that contains a face
+    PwRect base_rect = scaleRectConcentric(PwRect(0,0,image_width,image_height), 1.0/1.2);
+    PwRect smallest_face;
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_SMALLEST_RECT);
+        TRACE_SPAN("smallest_rect", "phase");
+        dp._phase = PHASE_SMALLEST_RECT;
+        base_rect = findSmallestFaceRectangle(dp, base_rect, min_allowed_width, min_allowed_height, &smallest_face);
+    }
+    base_rect = scaleRectConcentric(base_rect, 1.1);
+    
+    CroppedFrameList_Adaptive frame_list;
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_CENTER);
+        TRACE_SPAN("center", "phase");
+        dp._phase = PHASE_CENTER;
+        frame_list = findFaceCenter(dp, base_rect, min_allowed_width, min_allowed_height);
+    }
+    if (!isEmptyRect(frame_list._position_face)) {
+        STAGE_TIMER(dp._stage_times, STAGE_SIZE);
+        TRACE_SPAN("size", "phase");
+        dp._phase = PHASE_SIZE;
+        // Recursive search sizes the face starting from the whole frame, the
+        // other starting from the frame the center was found in
+        PwRect start_frame = dp._strategy._recursive ? PwRect(0, 0, image_width, image_height) : frame_list._position_frame;
+        frame_list._final_face = findFaceSize(dp, start_frame, frame_list._position_face,
+                                        min_allowed_width, min_allowed_height, tolerance_ratio); 
+    }
+    dp._phase = PHASE_NONE;
+    useBestFaceSoFar(dp, frame_list, smallest_face);
+    return frame_list;
+}
+
+PwRect findBestFace(const DetectorState& dp) {
+    if (dp._strategy._algorithm == SEARCH_HISTOGRAM)
+        return detectFaces_Histogram(dp).getBestFace();
+    return detectFacesCenter_Adaptive(dp).getBestFace();
+}
+
+IplImage* scaleImage640x480(const IplImage* image) {
+    if (image->width > image->height)
+        return scaleImageWH(image, 640, 480);
+    else
+        return scaleImageWH(image, 480, 640);
+}
+
+/*
+ * Calculate a good crop ratio
+ */
+double calcCropRatio(const IplImage* image, PwRect face_rect, int min_width, double init_ratio) {
+    PwPoint center = getCenter(face_rect);
+    
+    int furthest_edge = max(center.x, center.y);
+    furthest_edge = max(furthest_edge, image->width - center.x);
+    furthest_edge = max(furthest_edge, image->height - center.y);  
+    
+    int radius0 = getRadius(face_rect);
+   
+    int target_radius = min(min_width/2, furthest_edge);
+    double target_ratio = (double)target_radius/(double)radius0;
+    double ratio = max(init_ratio, target_ratio);
+    return ratio;
+}
+
+void initDetectorState(DetectorState& dp, const SharedCascade& shared) {
+    dp._cascade_name = shared._cascade_name;
+    dp._cascade = createCascadeContext(shared);
+    dp._storage = cvCreateMemStorage(0);
+    assert (dp._storage);
+    dp._face_crop_ratio = FACE_CROP_RATIO;
+}
+
+void releaseDetectorState(DetectorState& dp) {
+    cvReleaseMemStorage(&dp._storage);
+    releaseCascadeContext(&dp._cascade);
+}
+
+void startSearchBudget(const DetectorState& dp) {
+    dp._budget_start_calls = dp._num_detect_calls;
+    if (dp._strategy._budget._max_ms > 0.0)
+        dp._budget_start = chrono::steady_clock::now();
+    dp._degraded = false;
+}
+
+bool isSearchBudgetExhausted(const DetectorState& dp) {
+    if (dp._degraded)
+        return true;
+    if (dp._strategy._budget._max_detect_calls > 0 && dp._num_detect_calls - dp._budget_start_calls >= dp._strategy._budget._max_detect_calls)
+        dp._degraded = true;
+    else if (dp._strategy._budget._max_ms > 0.0 && 
+             chrono::duration<double, milli>(chrono::steady_clock::now() - dp._budget_start).count() >= dp._strategy._budget._max_ms)
+        dp._degraded = true;
+    return dp._degraded;
+}
+
+bool setCurrentFrame(DetectorState& dp, const IplImage* image, const FileEntry& entry_in, string* error) {
+    TRACE_SPAN("prepare", "image");
+    startSearchBudget(dp);
+    // Faces from the last image are no longer needed. Without this the
+    // storage grows with every image
+    cvClearMemStorage(dp._storage);
+    dp._original_size = PwRect(0, 0, image->width, image->height);
+    IplImage* scaled_image;
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_SCALE);
+        scaled_image = scaleImage640x480(image);
+    }
+    dp._memory.add(IMAGE_SCALED, scaled_image);
+    dp._scaled_size = PwRect(0, 0, scaled_image->width, scaled_image->height);
+    FileEntry entry = entry_in;
+    if (entry._face_radius == 0) {
+        // No face given so search the whole image
+        entry._face_radius = getRadius(dp._scaled_size);
+        entry._face_center = getCenter(dp._scaled_size);
+    }
+    if (entry._face_center.x < 0 || entry._face_center.x >= scaled_image->width ||
+        entry._face_center.y < 0 || entry._face_center.y >= scaled_image->height) {
+        *error = "Face center (" + intToStr(entry._face_center.x) + ", " + intToStr(entry._face_center.y) + 
+                 ") is outside the " + intToStr(scaled_image->width) + " x " + intToStr(scaled_image->height) + " scaled image";
+        dp._memory.remove(IMAGE_SCALED, scaled_image);
+        cvReleaseImage(&scaled_image);
+        dp._current_frame = 0;
+        return false;
+    }
+    dp._entry = entry;
+    IplImage* image2;
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_ROTATE);
+        image2 = rotateImage(scaled_image, entry.getStraighteningAngle(), entry._face_center); 
+    }
+    dp._memory.add(IMAGE_ROTATED, image2);
+    PwRect    face_rect =  entry.getFaceRect(1.0);
+    dp._face_crop_ratio = calcCropRatio(scaled_image, face_rect, MIN_CROP_WIDTH, FACE_CROP_RATIO);
+    PwRect crop_rect =  entry.getFaceRect(dp._face_crop_ratio);
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_CROP);
+        dp._current_frame = cropImage(image2,  crop_rect);  
+    }
+    dp._cropped_size = crop_rect;
+    dp._memory.add(IMAGE_FRAME, dp._current_frame);
+
+    dp._memory.remove(IMAGE_SCALED, scaled_image);
+    dp._memory.remove(IMAGE_ROTATED, image2);
+    cvReleaseImage(&scaled_image);
+    cvReleaseImage(&image2);    
+    return true;
+}
+
+void releaseCurrentFrame(DetectorState& dp) {
+    dp._memory.remove(IMAGE_FRAME, dp._current_frame);
+    cvReleaseImage(&dp._current_frame);
+}
+
+/*
+ *  Map rect in the 640x480 scaled image back to the input image
+ */
+PwRect unscaleRect(PwRect rect, PwRect scaled_size, PwRect original_size) {
+    double scale_x = (double)original_size.width/(double)scaled_size.width;
+    double scale_y = (double)original_size.height/(double)scaled_size.height;
+    PwRect r(cvRound(rect.x*scale_x), cvRound(rect.y*scale_y), cvRound(rect.width*scale_x), cvRound(rect.height*scale_y));
+    r.x = max(0, min(r.x, original_size.width - 1));
+    r.y = max(0, min(r.y, original_size.height - 1));
+    r.width  = min(r.width,  original_size.width  - r.x);
+    r.height = min(r.height, original_size.height - r.y);
+    return r;
+}
+
+PwRect clipRect(PwRect rect, PwRect bounds) {
+    int x0 = max(rect.x, bounds.x);
+    int y0 = max(rect.y, bounds.y);
+    int x1 = min(rect.x + rect.width,  bounds.x + bounds.width);
+    int y1 = min(rect.y + rect.height, bounds.y + bounds.height);
+    return (x1 > x0 && y1 > y0) ? PwRect(x0, y0, x1 - x0, y1 - y0) : EMPTY_RECT;
+}
+
+PwRect trackFace(const DetectorState& dp, PwRect last_face) {
+    PwRect image_rect(0, 0, dp._current_frame->width, dp._current_frame->height);
+    PwRect start_frame = clipRect(scaleRectConcentric(last_face, TRACK_FRAME_RATIO), image_rect);
+    if (isEmptyRect(start_frame))
+        return EMPTY_RECT;
+    int min_allowed_width  = cvRound((double)last_face.width *TRACK_MIN_FACE_RATIO);
+    int min_allowed_height = cvRound((double)last_face.height*TRACK_MIN_FACE_RATIO);
+    int tolerance = cvRound(hypot(last_face.width, last_face.height)*TRACK_TOLERANCE_RATIO);
+   
+    // One detection to check the face is still roughly where it was
+    TRACE_SPAN("track", "phase");
+    dp._phase = PHASE_TRACK;
+    vector<PwRect> faces = detectFacesCrop(dp, &start_frame);
+    PwRect face = EMPTY_RECT;
+    if (traceAccepted(dp, hasValidFaceBoth(faces, min_allowed_width, min_allowed_height, getCenter(last_face), tolerance)))
+        face = findFaceSize(dp, start_frame, faces[0], min_allowed_width, min_allowed_height, TRACK_TOLERANCE_RATIO);
+    dp._phase = PHASE_NONE;
+    return face;
+}
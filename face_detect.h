@@ -0,0 +1,123 @@
+#ifndef FACE_DETECT_H
+#define FACE_DETECT_H
+/*
+ *  face_detect.h
+ *  FaceTracker
+ *
+ *  Haar face detection and the histogram and adaptive face searches that
+ *  run on a DetectorState
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "face_common.h"
+#include "face_io.h"
+#include "cropped_frames.h"
+#include "shared_cascade.h"
+#include "search_strategy.h"
+#include "stage_timer.h"
+#include "detect_trace.h"
+#include "memory_stats.h"
+
+struct ImageDetectLog;
+
+// (Diameter of area seached)/(face diameter detected by AgeRage)
+static const double FACE_CROP_RATIO = 2.5; //  1.7; // 3.0; // = 1.5;
+
+// Target minimum crop rectangle width
+static const int MIN_CROP_WIDTH = 70;
+
+// detectFacesCrop() runs the Haar detector on a gray copy shrunk by this factor
+static const int SMALL_IMAGE_SCALE = 2;
+
+// Face tracking between video frames. All relative to the face found in the previous frame
+static const double TRACK_FRAME_RATIO     = 2.0;    // (Diameter of area searched)/(face diameter)
+static const double TRACK_MIN_FACE_RATIO  = 0.5;    // Smallest face accepted
+static const double TRACK_TOLERANCE_RATIO = 0.25;   // (Max movement of face center)/(face diagonal)
+
+/* 
+ *  All the members of DetectorState are needed for a cvHaarDetectObjects() call
+ */
+struct DetectorState {
+    IplImage*       _current_frame; 
+    CvHaarClassifierCascade* _cascade;  
+    CvMemStorage*   _storage;
+    PwRect          _original_size;
+    PwRect          _scaled_size;
+    PwRect          _cropped_size;
+  // Params  
+    double          _face_crop_ratio; // // (Diameter of area seached)/(face diameter detected by AgeRage)
+    SearchStrategy  _strategy;
+    FileEntry       _entry;
+    std::string     _cascade_name;
+    const ImageDetectLog* _replay;  // If set detectFacesCrop() answers from this recording instead of the detector
+  // Stats
+    mutable int     _num_detect_calls; // detectFacesCrop() calls on this state
+    mutable StageTimes _stage_times;   // Only filled in if STAGE_TIMING
+    DetectTrace*    _trace;         // Every detectFacesCrop() call is added here if set
+    mutable SearchPhase _phase;     // Search phase making detectFacesCrop() calls
+    mutable MemoryStats _memory;    // Image buffers and detector storage in use
+  // Budget for the current image. Set by startSearchBudget()
+    mutable int     _budget_start_calls;
+    mutable std::chrono::steady_clock::time_point _budget_start;
+    mutable bool    _degraded;      // Budget ran out. Results are the best found before that
+    DetectorState(): _current_frame(0), _cascade(0), _storage(0), 
+        _face_crop_ratio(FACE_CROP_RATIO), _replay(0),
+        _num_detect_calls(0), _trace(0), _phase(PHASE_NONE), _budget_start_calls(0), _degraded(false) {}
+};
+
+/*
+ * Set up a DetectorState to run on one thread. 
+ *  The classifier data in shared is not copied. dp gets its own evaluation 
+ *  context and storage.
+ */
+void initDetectorState(DetectorState& dp, const SharedCascade& shared);
+void releaseDetectorState(DetectorState& dp);
+
+/*
+ *  Start dp._strategy._budget for a new image. setCurrentFrame() calls this
+ */
+void startSearchBudget(const DetectorState& dp);
+bool isSearchBudgetExhausted(const DetectorState& dp);
+
+/*
+ *  Set dp._current_frame to the region of image that is searched for a face.
+ *  image is scaled to fit 640x480, straightened by entry's face angle and
+ *  cropped to a generous rect around entry's face. entry is in scaled image
+ *  coordinates. If entry has no face then the whole image is searched.
+ *  Returns false with *error set if entry's face center is outside the 
+ *  scaled image; there is then no current frame. Otherwise caller must 
+ *  releaseCurrentFrame(dp)
+ */
+bool setCurrentFrame(DetectorState& dp, const IplImage* image, const FileEntry& entry, std::string* error);
+void releaseCurrentFrame(DetectorState& dp);
+
+IplImage* scaleImage640x480(const IplImage* image);
+PwRect    unscaleRect(PwRect rect, PwRect scaled_size, PwRect original_size);
+PwRect    clipRect(PwRect rect, PwRect bounds);
+// The center of face_rect must be inside image
+double calcCropRatio(const IplImage* image, PwRect face_rect, int min_width, double init_ratio);
+
+std::vector<PwRect> detectFacesCrop(const DetectorState& dp, const PwRect* rect);
+std::vector<PwRect> detectFaces(const DetectorState& dp);
+void detectFacesMultiFrame(const DetectorState& dp, CroppedFrameList* croppedFrameList);
+CroppedFrameList_Histogram createMultiFrameList_ConcentricImage(const DetectorState& dp);
+CroppedFrameList_Histogram detectFaces_Histogram(const DetectorState& dp);
+CroppedFrameList_Adaptive  detectFacesCenter_Adaptive(const DetectorState& dp);
+
+/*
+ *  Run the search dp._strategy selects on dp._current_frame. 
+ *  Returns the best face in dp._current_frame coordinates, EMPTY_RECT if none
+ */
+PwRect findBestFace(const DetectorState& dp);
+
+/*
+ *  Re-find a face that was at last_face in the previous video frame by
+ *  running only the findFaceSize() sweep around it. 
+ *  Returns EMPTY_RECT if the face is no longer there
+ */
+PwRect trackFace(const DetectorState& dp, PwRect last_face);
+
+#endif // #ifndef FACE_DETECT_H
@@ -4,14 +4,25 @@
 #include <iomanip>
 #include <algorithm>
 #include <list>
+#include <stdlib.h>
 #include "face_common.h"
 #include "face_util.h"
 #include "face_io.h"
+#include "file_list.h"
+#include "results_writer.h"
+#include "sweep_results.h"
+#include "detection_cache.h"
 #include "face_draw.h"
 #include "face_calc.h"
 #include "face_results.h"
 #include "cropped_frames.h"
 #include "core_opencv.h"
+#include "param_search.h"
+#include "work_pool.h"
+#include "shared_cascade.h"
+#include "face_detect.h"
+#include "face_video.h"
+#include "pipeline_trace.h"
 
 #ifdef NOT_MAC_APP
 #include "cdef/OD3FaceFinder.h"
@@ -50,489 +61,8 @@ using namespace std;
  static const char * WINDOW_NAME  = "Face Tracker with Sub-Frames";
 #endif
 
-#if ADAPTIVE_FACE_SEARCH
-const string test_type_name = "adaptive";
-#else
-const string test_type_name = "histogram";
-#endif
-
-
-static const int small_image_scale = 2;
-
-// This is where data files are read from and written to
-//static string  test_file_dir;
-
-// (Diameter of area seached)/(face diameter detected by AgeRage)
-static const double FACE_CROP_RATIO = 2.5; //  1.7; // 3.0; // = 1.5;
-
-// Target minimum crop rectangle width
-static const int MIN_CROP_WIDTH = 70;
-
-/* 
- *  All the members of DetectorState are needed for a cvHaarDetectObjects() call
- */
-struct DetectorState {
-    IplImage*       _current_frame; 
-    CvHaarClassifierCascade* _cascade;  
-    CvMemStorage*   _storage;
-    PwRect          _original_size;
-    PwRect          _scaled_size;
-    PwRect          _cropped_size;
-  // Params  
-    double          _face_crop_ratio; // // (Diameter of area seached)/(face diameter detected by AgeRage)
-    double          _scale_factor;  // =1.1, 
-    int             _min_neighbors; // =3, 
-    FileEntry       _entry;
-    string          _cascade_name;
-};
-
-    
-
-static bool SortFacesByArea(PwRect r1, PwRect r2) {
-    return r1.width*r1.height > r2.width*r2.height;
-}
-
-
-/*
- *  Detects faces in dp._current_frame cropped to rect
- *  Detects faces in whole image if rect == 0
- *  Returns list of face rectangles sorted by size
- */
-vector<PwRect> detectFacesCrop(const DetectorState& dp, const PwRect* rect)    {
-    CvSeq* faces = 0;
-#if TEST_NO_CROP
-    *((PwRect*) rect) = EMPTY_RECT;
-#endif
-    IplImage* cropped_image = dp._current_frame;
-    if (rect) {
-       cropped_image = cropImage(dp._current_frame, *rect);
-       assert(containsRect(PwRect(0, 0, dp._current_frame->width, dp._current_frame->height), *rect));
-    }
-    IplImage* gray_image  = cvCreateImage(cvSize(cropped_image->width, cropped_image->height), IPL_DEPTH_8U, 1);
-    IplImage* small_image = cvCreateImage(cvSize(cropped_image->width/small_image_scale, cropped_image->height/small_image_scale), IPL_DEPTH_8U, 1);
-
-    // convert to gray and downsize
-    cvCvtColor (cropped_image, gray_image, CV_BGR2GRAY);
-    cvResize (gray_image, small_image, CV_INTER_LINEAR);
-        
-        // detect faces
-    faces = cvHaarDetectObjects (small_image, dp._cascade, dp._storage,
-#if !HARDWIRE_HAAR_SETTINGS
-                                    dp._scale_factor, dp._min_neighbors, 
-#else                                    
-                                        HAAR_SCALE_FACTOR, 2, 
-#endif                                        
-                                        CV_HAAR_DO_CANNY_PRUNING, cvSize (30, 30));
-         
-    vector <PwRect> face_list(faces != 0 ? faces->total : 0);
-    for (int j = 0; j < (int)face_list.size(); j++) {
-        face_list[j] = CvRectToPwRect(*((CvRect*) cvGetSeqElem (faces, j)));
-        assert(containsRect(PwRect(0, 0, small_image->width, small_image->height), face_list[j]));
-       // Scale up to original image size
-        face_list[j].x = cvRound((double)face_list[j].x*(double)cropped_image->width /(double)small_image->width);
-        face_list[j].y = cvRound((double)face_list[j].y*(double)cropped_image->height/(double)small_image->height);
-        face_list[j].width  = cvRound((double)face_list[j].width* (double)cropped_image->width /(double)small_image->width);
-        face_list[j].height = cvRound((double)face_list[j].height*(double)cropped_image->height/(double)small_image->height);
-        PwRect r = face_list[j];
-        assert(containsRect(PwRect(0, 0, cropped_image->width, cropped_image->height), face_list[j]));
-       
-        // Correct for offset of cropped image in original
-        if (rect) {
-            face_list[j].x += rect->x;
-            face_list[j].y += rect->y;
-            assert(containsRect(*rect, face_list[j]));
-        }
-        assert(containsRect(PwRect(0, 0, dp._current_frame->width, dp._current_frame->height), face_list[j]));
-    }
-
-    if (face_list.size() > 1) 
-        sort(face_list.begin(), face_list.end(), SortFacesByArea);
- 
-    // Free images afer last call to cvGetSeqElem() !
-    if (rect) 
-        cvReleaseImage(&cropped_image); 
-    cvReleaseImage(&gray_image);
-    cvReleaseImage(&small_image);   
-       
-    return face_list;
-}
-
-vector<PwRect> detectFaces(const DetectorState& dp)    {
-    return detectFacesCrop(dp, 0);
-}
-
-/*
- * Detect faces within a set of frames (ROI rectangles)
- *   croppedFrameList contains the frames at input and recieves the lists of faces for
- *   each rect at output
- */
-void detectFacesMultiFrame(const DetectorState& dp, CroppedFrameList* croppedFrameList) {	
-    for (int i = 0; i < (int)croppedFrameList->_frames.size(); i++) {
-        PwRect rect =  croppedFrameList->_frames[i]._rect;
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        croppedFrameList->_frames[i]._faces = faces;
-    }
-}
-
-
-CroppedFrameList_Histogram createMultiFrameList_ConcentricImage(const DetectorState& dp) {
-    int    num_frames = 40;
-    CroppedFrameList_Histogram cropped_frame_list;
-    cropped_frame_list._frames.resize(num_frames);
-    int image_width  = dp._current_frame->width;
-    int image_height = dp._current_frame->height;
-    PwRect rect;
-    for (int i = 0; i < num_frames; i++) { 
-        rect.x = i/2;
-        rect.y = i/2; 
-        rect.width  = image_width  - i; 
-        rect.height = image_height - i; 
-        cropped_frame_list._frames[i]._rect = rect;
-    }
-    cropped_frame_list._primary = cropped_frame_list._frames[0]._rect;
-    return cropped_frame_list;
-}
-
-
- 
-/*  
- *   Detect faces in an image and a set of frames (ROI rects) within that image
- */ 
-CroppedFrameList_Histogram detectFaces_Histogram(const DetectorState& dp)    {
-    //CroppedFrameList frame_list = createMultiFrameList_Cross(mp, face);
-    CroppedFrameList_Histogram frame_list = createMultiFrameList_ConcentricImage(dp);
-    detectFacesMultiFrame(dp, &frame_list);
-    return frame_list;
-}
-
-
-/*****************************************************************************************
- * Mehran's adaptive method
- *****************************************************************************************/
-
-static bool hasValidFace(const vector<PwRect> faces, int min_allowed_width, int min_allowed_height) {
-    return (faces.size() > 0 && faces[0].width >= min_allowed_width && faces[0].height >= min_allowed_height);
-}
-
-static bool hasValidFaceTolerance(const vector<PwRect> faces, PwPoint face_center, int tolerance) {
-    bool within_tolerance = false;
-    if (faces.size() > 0) {
-        PwPoint center = getCenter(faces[0]);
-        double distance = hypot((double)(center.x - face_center.x), (double)(center.y - face_center.y));
-        within_tolerance = (distance <= tolerance);
-    }
-    return within_tolerance;
-}
-
-static bool hasValidFaceBoth(const vector<PwRect> faces, int min_allowed_width, int min_allowed_height, PwPoint face_center, int tolerance) {
-    return hasValidFace(faces, min_allowed_width, min_allowed_height) && hasValidFaceTolerance(faces, face_center, tolerance);
-}
-
-static PwRect findSmallestFaceRectangle(const DetectorState& dp, PwRect outer_rect, int min_allowed_width, int min_allowed_height) {
-    double min_delta = 0.01;
-    double delta = 0.1;
-    double good_scale_factor =  1.0 + delta;
-    PwRect good_rect = outer_rect;
-    
-    while (delta >=  min_delta) {
-        double scale_factor = good_scale_factor;
-        while (true) {
-            scale_factor /= 1.0 + delta;
-            PwRect rect = scaleRectConcentric(outer_rect, scale_factor); 
-            vector<PwRect> faces = detectFacesCrop(dp, &rect);
-            if (!hasValidFace(faces, min_allowed_width, min_allowed_height)) 
-                break;
-            good_rect = rect;
-            good_scale_factor = scale_factor;
-        }
-        delta /= 2.0;
-    }
-    return good_rect;
-}
-
-/*
-enlarge the frame and detect face
-- repeat while face center falls within some tolerance of the original face center till failure
-- then reduce the frame from *-
-- use the mid point of these as the stable face radius
-
-    Test in range 0.5x to 2.0x original face size = facter of 4;
-*/
-static PwRect findFaceSize(const DetectorState& dp, /* PwRect outer_frame, */ PwRect start_frame, PwRect start_face,
-                                        int min_allowed_width, int min_allowed_height, double tolerance_ratio) {
-    double min_ratio = 0.5;     // Min frame size / start_frame_size
-    double max_ratio = 2.0;     // Max frame size / start_frame_size 
-    int num_steps = 21;         // Number of frame sizes to check
-    
-    double ratio_range = max_ratio/min_ratio;
-    double ratio_step = log(ratio_range)/(double)num_steps;
-    int tolerance = cvRound(hypot(start_face.width, start_face.height)*tolerance_ratio);
-    
-    int min_i = -1, max_i = -1;
-    vector<CroppedFrame> frameSpan(num_steps);
-    PwPoint face_center = getCenter(start_face);
-    for (int i = num_steps/2; i >= 0; i--) {
-        PwRect rect = scaleRectConcentric(start_frame, exp(ratio_step*(double)(i- num_steps/2))) ;
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFaceBoth(faces, min_allowed_width, min_allowed_height, face_center, tolerance))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpan[i] = frame;
-         min_i = i;
-        if (max_i < 0)
-            max_i = i;
-    }
-    for (int i = num_steps/2+1; i < num_steps; i++) {
-        assert(ratio_step*(double)(i- num_steps/2) <= 1.0);
-        PwRect rect = scaleRectConcentric(start_frame, exp(ratio_step*(double)(i- num_steps/2)));
-   //     assert(containsRect(outer_frame, rect));
-  //      assert(containsRect(cvRect(0, 0, dp._current_frame->width, dp._current_frame->height), outer_frame));
-        if (!(containsRect(PwRect(0, 0, dp._current_frame->width, dp._current_frame->height), rect))) {
-            cerr << "Frame = " << rectAsString(PwRect(0, 0, dp._current_frame->width, dp._current_frame->height)) << endl;
-            cerr << "rect  = " << rectAsString(rect) << endl;
-            break; // !@#$  Fix this!!!
-            assert(containsRect(PwRect(0, 0, dp._current_frame->width, dp._current_frame->height), rect));
-        }
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFaceBoth(faces, min_allowed_width, min_allowed_height, face_center, tolerance))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpan[i] = frame;
-        max_i = i;
-        if (max_i < 0)
-            min_i = i;
-    }
-    
-    PwRect best_face;
-    if (min_i >= 0 && max_i >= 0) {
-        int mid_i = (min_i + max_i)/2; 
-        best_face = frameSpan[mid_i]._faces[0];
-    }
-    else {
-        cerr << "findFaceSize could not find suitable face" << endl;
-        best_face = start_face;
-    }
-    return best_face;
-}
-
-#if ADAPTIVE_RECURSIVE
-static CroppedFrameList_Adaptive findFaceCenter(const DetectorState& dp, PwRect base_rect, int min_allowed_width, int min_allowed_height) {
-    int    num_steps = ADAPTIVE_NUM_STEPS;    // Max number of steps to search in x and y direction
-    int    image_width  = dp._current_frame->width;
-    int    image_height = dp._current_frame->height;
-    PwRect rect = base_rect;
-    
-    int dx = (image_width - rect.width)/num_steps;
-    int dy = (image_height - rect.height)/num_steps;
-    
-    CroppedFrameList_Adaptive frame_list;
-    int mid_ix = -1, mid_iy = -1;
-    int min_i = -1, max_i = -1;
-    vector<CroppedFrame> frameSpanX(num_steps);
-    for (int i = num_steps/2; i >= 0; i--) {
-        PwRect rect(base_rect.x + (i- num_steps/2)*dx, base_rect.y, base_rect.width, base_rect.height);
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFace(faces, min_allowed_width, min_allowed_height))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpanX[i] = frame;
-        frame_list._frames.push_back(frame);
-        min_i = i;
-        if (max_i < 0)
-            max_i = i;
-    }
-    for (int i = num_steps/2 + 1; i < num_steps; i++) {
-       PwRect rect(base_rect.x + (i- num_steps/2)*dx, base_rect.y, base_rect.width, base_rect.height);
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFace(faces, min_allowed_width, min_allowed_height))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpanX[i] = frame;
-        frame_list._frames.push_back(frame);
-        max_i = i;
-        if (min_i < 0)
-            min_i = i;
-    }
-    if (min_i >= 0 && max_i >= 0)
-        mid_ix = (min_i + max_i)/2; 
-    
-    min_i = -1, max_i = -1;
-    vector<CroppedFrame> frameSpanY(num_steps);
-    for (int i = num_steps/2; i >= 0; i--) {
-        PwRect rect(base_rect.x, base_rect.y + (i- num_steps/2)*dy, base_rect.width, base_rect.height);
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFace(faces, min_allowed_width, min_allowed_height))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpanY[i] = frame;
-        frame_list._frames.push_back(frame);
-        min_i = i;
-        if (max_i < 0)
-            max_i = i;
-    }
-    for (int i = num_steps/2 + 1; i < num_steps; i++) {
-        PwRect rect(base_rect.x, base_rect.y + (i- num_steps/2)*dy, base_rect.width, base_rect.height);
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFace(faces, min_allowed_width, min_allowed_height))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpanY[i] = frame;
-        frame_list._frames.push_back(frame);
-        max_i = i;
-        if (min_i < 0)
-            min_i = i;
-    }
-    if (min_i >= 0 && max_i >= 0)
-        mid_iy = (min_i + max_i)/2; 
-   
-    if (mid_ix > 0 && mid_iy > 0) {
-        PwPoint center;
-        center.x = getCenter(frameSpanX[mid_ix]._rect).x;
-        center.y = getCenter(frameSpanY[mid_iy]._rect).y;
-        frame_list._position_face  = averageRects(frameSpanX[mid_ix]._faces[0], frameSpanY[mid_iy]._faces[0]);
-        frame_list._position_frame = PwRect(center.x - base_rect.width/2, center.y - base_rect.height/2, base_rect.width, base_rect.height);
-        assert(containsRect(frame_list._position_frame, frame_list._position_face));
-    }
-    return frame_list;
-}
-
-CroppedFrameList_Adaptive detectFacesCenter_Adaptive(const DetectorState& dp)    {
-   
-   
-  //  double frame_to_original = 1.1; // 1.3 kind of works; // 1.6 works;
-  //  double frame_growth = 1.1;
-      int    image_width  = dp._current_frame->width;
-    int    image_height = dp._current_frame->height;
-    
-    // False positive detection. 
-    //      tolerance_ratio = (max dist between face centers)/(frame diameter) = 0.1
-    //      min_scale = (min face diameter)/(frame diameter) = 0.8 
-    double  tolerance_ratio = cvRound(0.1/dp._face_crop_ratio);
-    double  min_face_factor = cvRound(0.8/dp._face_crop_ratio);
-    // Min face sizes - used to eliminate false positive face detections. min_face_factor * original detected face size
-    int min_allowed_width  = cvRound((double)image_width*min_face_factor);
-    int min_allowed_height = cvRound((double)image_height*min_face_factor);
-
-
-      
-    // Guess at right size for rectangle
-   // PwRect base_rect = scaleRectConcentric(cvRect(0,0,image_width,image_height), frame_to_original/dp._face_crop_ratio); 
-    // Find smallest rectangle that contains a face
-    PwRect base_rect = scaleRectConcentric(PwRect(0,0,image_width,image_height), 1.0/1.2);
-    base_rect = findSmallestFaceRectangle(dp, base_rect, min_allowed_width, min_allowed_height);
-    base_rect = scaleRectConcentric(base_rect, 1.1);
-    
-   CroppedFrameList_Adaptive frame_list = findFaceCenter(dp, base_rect, min_allowed_width, min_allowed_height);
-    if (!isEmptyRect(frame_list._position_face)) {
-        PwRect outer_frame(0, 0, image_width, image_height);
-        frame_list._final_face = findFaceSize(dp, outer_frame, /* position_frame, */ frame_list._position_face,
-                                        min_allowed_width, min_allowed_height, tolerance_ratio); 
-    }
-    return frame_list;
-}
-#else
-CroppedFrameList_Adaptive detectFacesCenter_Adaptive(const DetectorState& dp)    {
-   
-    CroppedFrameList_Adaptive frame_list;
-  //  double frame_to_original = 1.1; // 1.3 kind of works; // 1.6 works;
-  //  double frame_growth = 1.1;
-    int    num_steps = ADAPTIVE_NUM_STEPS;    // Max number of steps to search in x and y direction
-    int    image_width  = dp._current_frame->width;
-    int    image_height = dp._current_frame->height;
-    
-    // False positive detection. 
-    //      tolerance_ratio = (max dist between face centers)/(frame diameter) = 0.1
-    //      min_scale = (min face diameter)/(frame diameter) = 0.8 
-    double  tolerance_ratio = cvRound(0.1/dp._face_crop_ratio);
-    double  min_face_factor = cvRound(0.8/dp._face_crop_ratio);
-    // Min face sizes - used to eliminate false positive face detections. min_face_factor * original detected face size
-    int min_allowed_width  = cvRound((double)image_width*min_face_factor);
-    int min_allowed_height = cvRound((double)image_height*min_face_factor);
-    
-    // Guess at right size for rectangle
-   // PwRect base_rect = scaleRectConcentric(cvRect(0,0,image_width,image_height), frame_to_original/dp._face_crop_ratio); 
-    // Find smallest rectangle that contains a face
-    PwRect base_rect = scaleRectConcentric(PwRect(0,0,image_width,image_height), 1.0/1.2);
-    base_rect = findSmallestFaceRectangle(dp, base_rect, min_allowed_width, min_allowed_height);
-    base_rect = scaleRectConcentric(base_rect, 1.1);
-    PwRect rect = base_rect;
-
-    int dx = (image_width  - rect.width )/num_steps;
-    int dy = (image_height - rect.height)/num_steps;
-    int mid_ix = -1, mid_iy = -1;
-    int min_i = -1, max_i = -1;
-    vector<CroppedFrame> frameSpanX(num_steps);
-    for (int i = num_steps/2; i >= 0; i--) {
-        PwRect(base_rect.x + (i- num_steps/2)*dx, base_rect.y, base_rect.width, base_rect.height);
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFace(faces, min_allowed_width, min_allowed_height))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpanX[i] = frame;
-        frame_list._frames.push_back(frame);
-        min_i = i;
-        if (max_i < 0)
-            max_i = i;
-    }
-    for (int i = num_steps/2 + 1; i < num_steps; i++) {
-       PwRect rect(base_rect.x + (i- num_steps/2)*dx, base_rect.y, base_rect.width, base_rect.height);
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFace(faces, min_allowed_width, min_allowed_height))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpanX[i] = frame;
-        frame_list._frames.push_back(frame);
-        max_i = i;
-        if (min_i < 0)
-            min_i = i;
-    }
-    if (min_i >= 0 && max_i >= 0)
-        mid_ix = (min_i + max_i)/2; 
-    
-    min_i = -1, max_i = -1;
-    vector<CroppedFrame> frameSpanY(num_steps);
-    for (int i = num_steps/2; i >= 0; i--) {
-        PwRect rect(base_rect.x, base_rect.y + (i- num_steps/2)*dy, base_rect.width, base_rect.height);
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFace(faces, min_allowed_width, min_allowed_height))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpanY[i] = frame;
-        frame_list._frames.push_back(frame);
-        min_i = i;
-        if (max_i < 0)
-            max_i = i;
-    }
-    for (int i = num_steps/2 + 1; i < num_steps; i++) {
-        PwRect rect(base_rect.x, base_rect.y + (i- num_steps/2)*dy, base_rect.width, base_rect.height);
-        vector<PwRect> faces = detectFacesCrop(dp, &rect);
-        if (!hasValidFace(faces, min_allowed_width, min_allowed_height))
-            break;
-        CroppedFrame frame(rect, faces);
-        frameSpanY[i] = frame;
-        frame_list._frames.push_back(frame);
-        max_i = i;
-        if (min_i < 0)
-            min_i = i;
-    }
-    if (min_i >= 0 && max_i >= 0)
-        mid_iy = (min_i + max_i)/2; 
-   
-    if (mid_ix > 0 && mid_iy > 0) {
-        PwPoint center;
-        center.x = getCenter(frameSpanX[mid_ix]._rect).x;
-        center.y = getCenter(frameSpanY[mid_iy]._rect).y;
-        PwRect position_face  = averageRects(frameSpanX[mid_ix]._faces[0], frameSpanY[mid_iy]._faces[0]);
-        PwRect position_frame(center.x - base_rect.width/2, center.y - base_rect.height/2, base_rect.width, base_rect.height);
-        assert(containsRect(position_frame, position_face));
-        frame_list._position_frame = position_frame;
-        PwRect outer_frame(0, 0, image_width, image_height);
-        frame_list._final_face = findFaceSize(dp, /*outer_frame, */position_frame, position_face,
-                                        min_allowed_width, min_allowed_height, tolerance_ratio); 
-    }
-    return frame_list;
-}
-#endif
+// Name of the search algorithm for output file names. Set from the strategy in main()
+static string test_type_name = getSearchAlgorithmName(SearchStrategy()._algorithm);
 
 
 #if DRAW_FACES && SHOW_ALL_RECTANGLES
@@ -638,14 +168,45 @@ CroppedFrameList_Adaptive
     return frame_list;
 }
 
-static IplImage* scaleImage640x480(IplImage* image) {
-    if (image->width > image->height)
-        return scaleImageWH(image, 640, 480);
-    else
-        return scaleImageWH(image, 480, 640);
-}
+/*
+ *  What the results need from the frames one search looked at
+ */
+struct FrameListSummary {
+    PwRect  _best_face;
+#if RESULTS_VERSION == 1
+    int     _num_frames;
+    int     _num_with_faces;
+    int     _max_consecutive_with_faces;
+    int     _num_false_positives;
+#endif
+};
 
+/*
+ *  Summarize frame_list as its own strategy's CroppedFrameList type. Copying
+ *  it to the base class first would lose the strategy's overrides
+ */
+template <class FrameList>
+static FrameListSummary summarizeFrameList(const FrameList& frame_list) {
+    FrameListSummary summary;
+    summary._best_face = frame_list.getBestFace();
+#if RESULTS_VERSION == 1
+    summary._num_frames = (int)frame_list._frames.size();
+    summary._num_with_faces = frame_list.numWithFaces();
+    summary._max_consecutive_with_faces = frame_list.maxConsecutiveWithFaces();
+    summary._num_false_positives = frame_list.numFalsePositives(); // !@#$ This will be true for the test set of images
+#endif
+    return summary;
+}
 
+/*
+ *  Run the search selected by dp._strategy, drawing it if DRAW_FACES. 
+ *  Returns a summary of the frames searched, including their best face
+ */
+static FrameListSummary processOneImage_Strategy(const DetectorState& dp) {
+    if (dp._strategy._algorithm == SEARCH_HISTOGRAM)
+        return summarizeFrameList(processOneImage_Histogram(dp));
+    return summarizeFrameList(processOneImage_Adaptive(dp));
+}
 
 /*
  * Draw results in original image
@@ -689,51 +250,52 @@ static void drawResultImage(const FaceDetectResult& result) {
 struct  ParamRanges {
     int     _min_neighbors_min, _min_neighbors_max, _min_neighbors_delta;
     double  _scale_factor_min,  _scale_factor_max,  _scale_factor_delta;
-    vector<FileEntry>   _file_entries;
+    vector<FileEntry>   _file_entries;      // Only read for --tune. Batch runs stream _list_path
+    string              _list_path;
+    string              _image_dir;
+    int                 _window;            // Most images read from the list but not yet written out
+    int                 _read_ahead;        // Max file list entries read ahead of the batches
     vector<string>      _cascades;
     
     // !@#$ does not belong here
-    mutable ofstream _output_file;
+    ResultsWriter*   _results;              // Results file and, if echoing, the console
+    SweepWriter*     _sweep;                // Binary sweep results. 0 => none
+    DetectionCache*  _cache;                // Results of earlier runs. 0 => none
+    mutable ofstream _timing_file;          // Per image stage times if STAGE_TIMING
+    mutable ofstream _timing_summary_file;  // Stage time percentiles if STAGE_TIMING
+    bool     _trace;                        // Record detect calls of every image
+    mutable ofstream _trace_file;
+    bool     _memory;                       // Report memory used by every image
+    mutable ofstream _memory_file;
+    MemoryBudget _memory_budget;
+    mutable int _num_over_memory_budget;
     mutable long     _last_flush_time;
     long     _flush_dt;
+    int      _num_threads;     // Worker threads for batch runs. 0 => one per core
+    SearchStrategy _strategy;
     
     ParamRanges() {
+        _results = 0;
+        _sweep = 0;
+        _cache = 0;
         _last_flush_time = 0L;
         _flush_dt = 5L;
+        _num_threads = 0;
+        _window = 1024;
+        _read_ahead = 4096;
+        _trace = false;
+        _memory = false;
+        _num_over_memory_budget = 0;
     }
     void flushIfNecessary() const {
         long t = time(0);
         if (t > _last_flush_time + _flush_dt) {
-            _output_file.flush();
+            flushResultsWriter(_results);
             _last_flush_time = t;
         }
     } 
 };
 
-/*
- * Calculate a good crop ratio
- */
-double calcCropRatio(const IplImage* image, PwRect face_rect, int min_width, double init_ratio) {
-    PwPoint center = getCenter(face_rect);
-    cout << "face_rect = " << rectAsString(face_rect) << endl;
-    cout << "image w x h = " << image->width << " x " << image->height << endl;
-    cout << "min_width = " << min_width << ", init_ratio = " << init_ratio <<  endl;
-    assert(0 <= center.x && center.x < image->width);
-    assert(0 <= center.y && center.y < image->height);
-    
-    int furthest_edge = max(center.x, center.y);
-    furthest_edge = max(furthest_edge, image->width - center.x);
-    furthest_edge = max(furthest_edge, image->height - center.y);  
-    
-    int radius0 = getRadius(face_rect);
-   
-    int target_radius = min(min_width/2, furthest_edge);
-    double target_ratio = (double)target_radius/(double)radius0;
-    double ratio = max(init_ratio, target_ratio);
-    cout << "face crop ratio = " << ratio << endl;
-    return ratio;
-}
-
 /*
  * Load cascade, either from the OS X app resouce bundle or from a known location
  */ 
@@ -762,47 +324,55 @@ static const string getCascadePath(const string cascade_name)     {
     return cascade_path;
 }
 
+static void loadCascade(SharedCascade& shared, const string cascade_name) {
+    const string cascade_path = getCascadePath(cascade_name);
+    if (!loadSharedCascade(shared, cascade_path, cascade_name)) {
+        cerr << "Could not load cascade '" << cascade_path << "'" << endl;
+        abort(); 
+    }
+}
+
 #if TEST_MANY_SETTINGS
     
+/*
+ *  If sweep_rows is not 0, also return a row for each setting with the 
+ *  image and cascade left for the caller to fill in
+ */
 vector<FaceDetectResult>  
     processOneImage(DetectorState& dp,
-                    const ParamRanges& pr) {
+                    const ParamRanges& pr,
+                    vector<SweepRow>* sweep_rows) {
     double scale_factor = 1.1;
     int    min_neighbors = 2;
-    dp._scale_factor = scale_factor;
-    dp._min_neighbors = min_neighbors;
+    dp._strategy._scale_factor = scale_factor;
+    dp._strategy._min_neighbors = min_neighbors;
  
-#if ADAPTIVE_FACE_SEARCH
-    CroppedFrameList_Adaptive frame_list;
-#else
-    CroppedFrameList_Histogram frame_list;
-#endif
     vector<FaceDetectResult> results;
   
     for (min_neighbors = pr._min_neighbors_min; min_neighbors <= pr._min_neighbors_max; min_neighbors += pr._min_neighbors_delta) {
         for (scale_factor = pr._scale_factor_min; scale_factor <= pr._scale_factor_max; scale_factor += pr._scale_factor_delta) {
-            dp._scale_factor = scale_factor;
-            dp._min_neighbors = min_neighbors;
-#if ADAPTIVE_FACE_SEARCH
-            frame_list = processOneImage_Adaptive(dp);
-#else            
-            frame_list = processOneImage_Histogram(dp);
-#endif  
-            PwRect best_face_orig_coords = offsetRectByRect(frame_list.getBestFace(), dp._entry.getFaceRect(dp._face_crop_ratio));
+            dp._strategy._scale_factor = scale_factor;
+            dp._strategy._min_neighbors = min_neighbors;
+            FrameListSummary summary = processOneImage_Strategy(dp);
+            PwRect best_face_orig_coords = offsetRectByRect(summary._best_face, dp._entry.getFaceRect(dp._face_crop_ratio));
            
 #if RESULTS_VERSION == 1
-            int num_false_positives = frame_list.numFalsePositives(); // !@#$ This will be true for the test set of images           
-            FaceDetectResult r(frame_list._frames.size(),  frame_list.numWithFaces(), frame_list.maxConsecutiveWithFaces(), frame_list.getBestFace(),
+            FaceDetectResult r(summary._num_frames, summary._num_with_faces, summary._max_consecutive_with_faces, summary._best_face,
                     scale_factor, min_neighbors, 
                     dp._entry, dp._cascade_name, 
-                    best_face_orig_coords, num_false_positives );
+                    best_face_orig_coords, summary._num_false_positives );
 #elif RESULTS_VERSION == 2
             FaceDetectResult r(dp._entry, dp._cascade_name, best_face_orig_coords);
 #endif
             results.push_back(r);
+            if (sweep_rows) {
+                SweepRow row;
+                row._min_neighbors = min_neighbors;
+                row._scale_factor = scale_factor;
+                row._face = best_face_orig_coords;
+                sweep_rows->push_back(row);
+            }
           
-            showOneResultFile(r, cout);
-            showOneResultFile(r, pr._output_file);
 #if DRAW_FACES            
             drawResultImage(r);
 #endif            
@@ -818,40 +388,225 @@ vector<FaceDetectResult>
 
 
 
-vector<FaceDetectResult> 
-    detectInOneImage(DetectorState& dp,
-               const ParamRanges& pr,
-               const FileEntry& entry) {
-    dp._entry = entry;
-   
-    IplImage*  image  = cvLoadImage(dp._entry._image_name.c_str());
+/*
+ *  Load entry's image and set dp._current_frame to the scaled, straightened
+ *  and cropped region that is searched for a face.
+ *  Caller must releaseCurrentFrame(dp)
+ */
+static void loadCurrentFrame(DetectorState& dp, const FileEntry& entry) {
+    dp._stage_times.clear();
+    dp._memory.startImage();
+    IplImage*  image;
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_LOAD);
+        TRACE_SPAN("decode", "image");
+        image = cvLoadImage(entry._image_name.c_str());
+    }
     if (!image) {
-        cerr << "Could not find '" << dp._entry._image_name << "'" << endl;
+        cerr << "Could not find '" << entry._image_name << "'" << endl;
         abort();
     }
-    dp._original_size = PwRect(0, 0, image->width, image->height);
-    IplImage* scaled_image = scaleImage640x480(image);
-    dp._scaled_size = PwRect(0, 0, scaled_image->width, scaled_image->height);
-    IplImage* image2 = rotateImage(scaled_image, entry.getStraighteningAngle(), entry._face_center); 
-    PwRect    face_rect =  entry.getFaceRect(1.0);
-    dp._face_crop_ratio = calcCropRatio(image, face_rect, MIN_CROP_WIDTH, FACE_CROP_RATIO);
-    PwRect crop_rect =  entry.getFaceRect(dp._face_crop_ratio);
-    cout << "crop_rect = " << rectAsString(crop_rect)<< endl;
-    dp._current_frame = cropImage(image2,  crop_rect);  
-    dp._cropped_size = crop_rect;
-    assert (dp._current_frame );
-
-    vector<FaceDetectResult>  results = processOneImage(dp, pr) ;
-  
-    cvReleaseImage(&dp._current_frame); 
-    cvReleaseImage(&scaled_image);
-    cvReleaseImage(&image2);    
+    dp._memory.add(IMAGE_INPUT, image);
+    string frame_error;
+    bool have_frame = setCurrentFrame(dp, image, entry, &frame_error);
+    dp._memory.remove(IMAGE_INPUT, image);
+    cvReleaseImage(&image);
+    if (!have_frame) {
+        cerr << "'" << entry._image_name << "': " << frame_error << endl;
+        abort();
+    }
+#if VERBOSE
+    cout << "face crop ratio = " << dp._face_crop_ratio << ", crop_rect = " << rectAsString(dp._cropped_size) << endl;
+#endif
+}
+
+vector<FaceDetectResult> 
+    detectInOneImage(DetectorState& dp,
+               const ParamRanges& pr,
+               const FileEntry& entry,
+               vector<SweepRow>* sweep_rows) {
+    loadCurrentFrame(dp, entry);
+    vector<FaceDetectResult>  results = processOneImage(dp, pr, sweep_rows) ;
+    releaseCurrentFrame(dp);
+    dp._memory.sampleProcess();
     return results;
 }
 
 
 
-vector<FaceDetectResult>  main_stuff (const ParamRanges& pr, const string cascade_name)     {
+/*
+ *  Batch state shared by the work-stealing workers in main_stuff()
+ *      _workers[i] is only used by worker i
+ *      The per image vectors have one slot per image in the window. Image n
+ *      of the list uses slot n % window, written by the worker that 
+ *      processed it and read by writeOneEntry()
+ *      The summaries are only touched by writeOneEntry()
+ */
+struct BatchContext {
+    const ParamRanges*                  _pr;
+    FileListStream*                     _stream;
+    vector<FileEntry>                   _entries;
+    vector<DetectorState>               _workers;
+    vector<vector<FaceDetectResult> >   _results;
+    vector<StageTimes>                  _stage_times;
+    vector<DetectTrace>                 _traces;        // If _pr->_trace
+    vector<MemoryStats>                 _memory;
+    vector<vector<SweepRow> >           _sweep_rows;    // If _pr->_sweep or _pr->_cache
+    string                              _cache_settings; // Everything but the image in the cache key
+    int                                 _cascade_index; // In _pr->_sweep
+    int                                 _num_images;
+    StageTimeSummary                    _stage_summary;
+    MemorySummary                       _memory_summary;
+    DetectTraceSummary                  _trace_summary;
+    vector<FaceDetectResult>*           _all_results;   // 0 => don't keep them
+    
+    int getSlot(int item) const { return item % (int)_entries.size(); }
+};
+
+#if RESULTS_VERSION == 2
+/*
+ *  Fill in image item's results from the cache if it has them
+ */
+static bool useCachedDetection(BatchContext* bc, int slot, const string cascade_name, uint64_t key) {
+    CachedDetection cached;
+    if (!lookupDetection(bc->_pr->_cache, key, &cached))
+        return false;
+    FileEntry entry = bc->_entries[slot];
+    entry._face_center = cached._face_center;
+    entry._face_radius = cached._face_radius;
+    for (int i = 0; i < (int)cached._settings.size(); i++) {
+        const CachedSetting& s = cached._settings[i];
+        bc->_results[slot].push_back(FaceDetectResult(entry, cascade_name, s._face));
+        SweepRow row;
+        row._min_neighbors = s._min_neighbors;
+        row._scale_factor = s._scale_factor;
+        row._face = s._face;
+        bc->_sweep_rows[slot].push_back(row);
+    }
+    return true;
+}
+
+static void cacheDetection(BatchContext* bc, int slot, const DetectorState& dp, uint64_t key) {
+    CachedDetection cached;
+    cached._face_center = dp._entry._face_center;
+    cached._face_radius = dp._entry._face_radius;
+    const vector<SweepRow>& rows = bc->_sweep_rows[slot];
+    for (int i = 0; i < (int)rows.size(); i++) {
+        CachedSetting s;
+        s._min_neighbors = rows[i]._min_neighbors;
+        s._scale_factor = rows[i]._scale_factor;
+        s._face = rows[i]._face;
+        cached._settings.push_back(s);
+    }
+    insertDetection(bc->_pr->_cache, key, cached);
+}
+#endif
+
+/*
+ *  Read up to max_items entries into the slots of items first_item on
+ */
+static int readEntries(void* context, int first_item, int max_items) {
+    BatchContext* bc = (BatchContext*)context;
+    vector<FileEntry> batch;
+    if (!readFileEntryBatch(bc->_stream, max_items, &batch))
+        return 0;
+    for (int i = 0; i < (int)batch.size(); i++) {
+        int slot = bc->getSlot(first_item + i);
+        bc->_entries[slot] = batch[i];
+        bc->_results[slot].clear();
+        bc->_stage_times[slot] = StageTimes();
+        bc->_memory[slot] = MemoryStats();
+        if (bc->_pr->_trace)
+            bc->_traces[slot] = DetectTrace();
+        if (bc->_pr->_sweep || bc->_pr->_cache)
+            bc->_sweep_rows[slot].clear();
+    }
+    return (int)batch.size();
+}
+
+static void detectOneEntry(void* context, int worker, int item) {
+    BatchContext* bc = (BatchContext*)context;
+    int slot = bc->getSlot(item);
+    const FileEntry& e = bc->_entries[slot];
+#if VERBOSE        
+    cout << "--------------------- " << e._image_name << " -----------------" << endl;
+#endif        
+    DetectorState& dp = bc->_workers[worker];
+    TRACE_SPAN("image", "image", e._image_name);
+#if RESULTS_VERSION == 2
+    uint64_t cache_key = 0;
+    if (bc->_pr->_cache) {
+        uint64_t content_hash;
+        if (hashFileContents(e._image_name, &content_hash)) {
+            cache_key = makeDetectionKey(content_hash, e, bc->_cache_settings);
+            if (useCachedDetection(bc, slot, dp._cascade_name, cache_key))
+                return;
+        }
+    }
+#endif
+    dp._trace = bc->_pr->_trace ? &bc->_traces[slot] : 0;
+    bool want_rows = bc->_pr->_sweep || bc->_pr->_cache;
+    bc->_results[slot] = detectInOneImage(dp, *bc->_pr, e, want_rows ? &bc->_sweep_rows[slot] : 0);
+    bc->_stage_times[slot] = dp._stage_times;
+    bc->_memory[slot] = dp._memory;
+    dp._trace = 0;
+#if RESULTS_VERSION == 2
+    if (cache_key)
+        cacheDetection(bc, slot, dp, cache_key);
+#endif
+}
+
+/*
+ *  Write out one image's results and add it to the summaries. Called in
+ *  list order
+ */
+static void writeOneEntry(void* context, int item) {
+    BatchContext* bc = (BatchContext*)context;
+    const ParamRanges& pr = *bc->_pr;
+    int slot = bc->getSlot(item);
+    const FileEntry& e = bc->_entries[slot];
+    const vector<FaceDetectResult>& results = bc->_results[slot];
+    for (vector<FaceDetectResult>::const_iterator it = results.begin(); it != results.end(); it++)
+        showOneResultFile(*it, getResultsStream(pr._results));
+#if STAGE_TIMING
+    showStageTimes(e._image_name, bc->_stage_times[slot], pr._timing_file);
+    bc->_stage_summary.add(bc->_stage_times[slot]);
+#endif
+    if (pr._trace) {
+        writeDetectTrace(e._image_name, bc->_traces[slot], pr._trace_file);
+        bc->_trace_summary.add(bc->_traces[slot]);
+    }
+    if (pr._sweep) {
+        SweepImage image;
+        image._name = e._image_name;
+        image._face_center = e._face_center;
+        image._face_radius = e._face_radius;
+        int image_index = addSweepImage(pr._sweep, image);
+        vector<SweepRow>& rows = bc->_sweep_rows[slot];
+        for (int j = 0; j < (int)rows.size(); j++) {
+            rows[j]._image = image_index;
+            rows[j]._cascade = bc->_cascade_index;
+            writeSweepRow(pr._sweep, rows[j]);
+        }
+    }
+    if (pr._memory)
+        showMemoryStats(e._image_name, bc->_memory[slot], pr._memory_file);
+    bc->_memory_summary.add(bc->_memory[slot], pr._memory_budget);
+    if (pr._memory_budget.isExceeded(bc->_memory[slot])) {
+        cerr << "Memory budget exceeded by '" << e._image_name << "'" << endl;
+        pr._num_over_memory_budget++;
+    }
+    pr.flushIfNecessary();
+    if (bc->_all_results)
+        bc->_all_results->insert(bc->_all_results->end(), results.begin(), results.end());
+    bc->_num_images++;
+}
+
+/*
+ *  Detect faces in every image of pr's list with cascade_name and write the
+ *  results as they come in. Appends them to all_results too, unless it is 0
+ */
+void  main_stuff (const ParamRanges& pr, const string cascade_name, vector<FaceDetectResult>* all_results)     {
 /* 
 #if MAC_APP
     CFBundleRef mainBundle  = CFBundleGetMainBundle ();
@@ -871,53 +626,212 @@ vector<FaceDetectResult>  main_stuff (const ParamRanges& pr, const string cascad
 #endif    
 */
     
-    DetectorState dp;
- 
-    dp._cascade_name = cascade_name;
-    const string cascade_path = getCascadePath(cascade_name);
-    dp._cascade = (CvHaarClassifierCascade*) cvLoad (cascade_path.c_str(), 0, 0, 0);
-    if (!dp._cascade) {
-        cerr << "Could not load cascade '" << cascade_path << "'" << endl;
-        abort(); 
-    }
-    dp._storage = cvCreateMemStorage(0);
-    dp._face_crop_ratio = FACE_CROP_RATIO;
-    assert (dp._storage);
-   
 #if DRAW_FACES   
     // create all necessary instances
     cvNamedWindow (WINDOW_NAME, CV_WINDOW_AUTOSIZE);
+    // highgui windows can only be drawn from one thread
+    int num_workers = 1;
+#else
+    int num_workers = pr._num_threads > 0 ? pr._num_threads : getNumCores();
 #endif 
     
+    string list_error;
+    FileListStream* stream = openFileListStream(pr._list_path, pr._image_dir, pr._read_ahead, &list_error);
+    if (!stream) {
+        cerr << list_error << endl;
+        abort();
+    }
     
-
-    vector<FaceDetectResult>  all_results;
-    for (vector<FileEntry>::const_iterator it = pr._file_entries.begin(); it != pr._file_entries.end(); it++) {
-        FileEntry e = *it;
-    
-#if VERBOSE        
-        cout << "--------------------- " << e._image_name << " -----------------" << endl;
-#endif        
-        vector<FaceDetectResult>  results = detectInOneImage(dp, pr, e) ;   
-        all_results.insert(all_results.end(), results.begin(), results.end());
+    // One copy of the classifier data however many workers there are
+    SharedCascade shared;
+    loadCascade(shared, cascade_name);
+    BatchContext bc;
+    bc._pr = &pr;
+    bc._workers.resize(num_workers);
+    for (int i = 0; i < (int)bc._workers.size(); i++) {
+        initDetectorState(bc._workers[i], shared);
+        bc._workers[i]._strategy = pr._strategy;
     }
     
-    cvReleaseMemStorage(&dp._storage);
-    cvFree(&dp._cascade);
+    // One pool of workers for the whole list, fed from the stream as it is 
+    // read, so results start appearing before the whole list has been read.
+    // Only a window of images is held in memory
+    int window = max(pr._window, 1);
+    bc._stream = stream;
+    bc._entries.resize(window);
+    bc._results.resize(window);
+    bc._stage_times.resize(window);
+    bc._memory.resize(window);
+    if (pr._trace)
+        bc._traces.resize(window);
+    if (pr._sweep || pr._cache)
+        bc._sweep_rows.resize(window);
+    bc._cascade_index = pr._sweep ? addSweepCascade(pr._sweep, cascade_name) : 0;
+    bc._num_images = 0;
+    bc._all_results = all_results;
+    bc._cache_settings = cascade_name + " " + strategyAsString(pr._strategy) 
+        + " " + intToStr(pr._min_neighbors_min) + " " + intToStr(pr._min_neighbors_max) + " " + intToStr(pr._min_neighbors_delta)
+        + " " + doubleToStr(pr._scale_factor_min) + " " + doubleToStr(pr._scale_factor_max) + " " + doubleToStr(pr._scale_factor_delta);
+    WorkStats stats = runWorkStream(window, num_workers, readEntries, detectOneEntry, writeOneEntry, (void*)&bc);
+    
+    list_error = getFileListStreamError(stream);
+    if (list_error.size() > 0)
+        cerr << list_error << endl;
+    releaseFileListStream(&stream);
+    
+    for (int i = 0; i < (int)bc._workers.size(); i++)
+        releaseDetectorState(bc._workers[i]);
+    releaseSharedCascade(shared);
     
-    return all_results;
+    if (pr._trace) {
+        pr._trace_file << "# summary " << cascade_name << endl;
+        showDetectTraceSummary(bc._trace_summary, pr._trace_file);
+        showDetectTraceSummary(bc._trace_summary, cout);
+    }
+    if (pr._memory || pr._memory_budget.isLimited())
+        showMemorySummary(bc._memory_summary, pr._memory_budget, cout);
+#if STAGE_TIMING
+    showStageTimePercentiles(bc._stage_summary, cout);
+    pr._timing_summary_file << cascade_name << endl;
+    showStageTimePercentiles(bc._stage_summary, pr._timing_summary_file);
+#endif
+#if VERBOSE
+    cout << "main_stuff: " << bc._num_images << " images on " << bc._workers.size() << " workers, " 
+         << stats.getNumSteals() << " steals" << endl;
+#endif
 }
 
 
 
+/*
+ *  Parameter tuning. 
+ *      One DetectorState per worker thread. Each job runs the face search on
+ *      one image with one (min_neighbors, scale_factor) setting and scores it
+ *      against the ground truth face in the file list.
+ */
+struct TuneContext {
+    vector<DetectorState>   _workers;
+};
+
+static JobScore evaluateSetting(void* context, int worker, const SearchConfig& config, const FileEntry& entry) {
+    TuneContext* tc = (TuneContext*)context;
+    DetectorState& dp = tc->_workers[worker];
+    dp._strategy._scale_factor  = config._scale_factor;
+    dp._strategy._min_neighbors = config._min_neighbors;
+
+    loadCurrentFrame(dp, entry);
+    PwRect best_face = findBestFace(dp);
+    releaseCurrentFrame(dp);
+
+    JobScore score;
+    score._found = !isEmptyRect(best_face) && entry._face_radius > 0;
+    if (score._found) {
+        PwRect  face = offsetRectByRect(best_face, dp._cropped_size);
+        PwPoint center = getCenter(face);
+        double  radius = (double)entry._face_radius;
+        score._center_error = hypot((double)(center.x - entry._face_center.x), (double)(center.y - entry._face_center.y))/radius;
+        score._radius_error = fabs((double)getRadius(face) - radius)/radius;
+    }
+    return score;
+}
+
+/*
+ *  Find the best (min_neighbors, scale_factor) settings in pr for cascade_name
+ *  by successive halving over pr._file_entries
+ */
+static vector<ConfigScore> tuneParameters(const ParamRanges& pr, const string cascade_name, const HalvingParams& params) {
+    // Hardwired settings would make every config run the same detector
+    if (pr._strategy._hardwire_haar_settings)
+        cout << "tuneParameters: hardwire turned off so that min_neighbors and scale_factor take effect" << endl;
+    vector<SearchConfig> configs = makeParamGrid(pr._min_neighbors_min, pr._min_neighbors_max, pr._min_neighbors_delta,
+                                                 pr._scale_factor_min,  pr._scale_factor_max,  pr._scale_factor_delta);
+    SharedCascade shared;
+    loadCascade(shared, cascade_name);
+    TuneContext tc;
+    tc._workers.resize(params._num_threads > 0 ? params._num_threads : getNumCores());
+    for (int i = 0; i < (int)tc._workers.size(); i++) {
+        initDetectorState(tc._workers[i], shared);
+        tc._workers[i]._strategy = pr._strategy;
+        tc._workers[i]._strategy._hardwire_haar_settings = false;
+    }
+    
+    vector<ConfigScore> scores = successiveHalving(configs, pr._file_entries, params, evaluateSetting, (void*)&tc);
+    
+    for (int i = 0; i < (int)tc._workers.size(); i++)
+        releaseDetectorState(tc._workers[i]);
+    releaseSharedCascade(shared);
+    return scores;
+}
+
 int main (int argc, char * const argv[]) {
     startup();
+    // [--tune [initial images] [eta]] [--trace] [--chrome-trace] 
+    // [--memory] [--memory-budget <RSS MB>] [--image-memory-budget <MB>] [--no-echo] [--sweep]
+    // [--cache <file> [--cache-mb <MB>]] [search strategy options]
+    bool tune = false;
+    bool trace = false;
+    bool chrome_trace = false;
+    bool memory = false;
+    MemoryBudget memory_budget;
+    ResultsWriterParams results_params;
+    bool sweep = false;
+    string cache_path;
+    long cache_mb = 256;
+    int num_tune_args = 0;
+    HalvingParams params;
+    SearchStrategy strategy;
+    for (int arg = 1; arg < argc; ) {
+        string error;
+        int parsed = parseStrategyArg(strategy, argc, argv, &arg, &error);
+        if (parsed < 0) {
+            cerr << error << endl;
+            return 1;
+        }
+        if (parsed > 0)
+            continue;
+        if (string(argv[arg]) == "--tune")
+            tune = true;
+        else if (string(argv[arg]) == "--trace")
+            trace = true;
+        else if (string(argv[arg]) == "--chrome-trace")
+            chrome_trace = true;
+        else if (string(argv[arg]) == "--memory")
+            memory = true;
+        else if (string(argv[arg]) == "--memory-budget" && arg + 1 < argc)
+            memory_budget._max_rss_mb = atol(argv[++arg]);
+        else if (string(argv[arg]) == "--image-memory-budget" && arg + 1 < argc)
+            memory_budget._max_image_mb = atol(argv[++arg]);
+        else if (string(argv[arg]) == "--no-echo")
+            results_params._echo = false;
+        else if (string(argv[arg]) == "--sweep")
+            sweep = true;
+        else if (string(argv[arg]) == "--cache" && arg + 1 < argc)
+            cache_path = argv[++arg];
+        else if (string(argv[arg]) == "--cache-mb" && arg + 1 < argc)
+            cache_mb = atol(argv[++arg]);
+        else if (tune && num_tune_args < 2) {
+            if (num_tune_args++ == 0)
+                params._initial_images = atoi(argv[arg]);
+            else
+                params._eta = atoi(argv[arg]);
+        }
+        else {
+            cerr << "Unknown option '" << argv[arg] << "'" << endl;
+            return 1;
+        }
+        arg++;
+    }
+    test_type_name = getSearchAlgorithmName(strategy._algorithm);
 
     string test_file_dir = "/Users/user/Desktop/percipo_pics/";
     string files_list_name = "files_list_verbose.csv";
-    string output_file_name = "results_" + test_type_name + "_" + intToStr(ADAPTIVE_NUM_STEPS) + "_" + doubleToStr(HAAR_SCALE_FACTOR) + ".csv";    
+    string output_file_name = "results_" + strategyAsString(strategy) + ".csv";    
     
     ParamRanges pr;
+    pr._strategy = strategy;
+    pr._trace = trace;
+    pr._memory = memory;
+    pr._memory_budget = memory_budget;
     pr._min_neighbors_min = 3; // 2;
     pr._min_neighbors_max = 3;
     pr._min_neighbors_delta = 1;
@@ -930,39 +844,129 @@ int main (int argc, char * const argv[]) {
  //   pr._cascades.push_back("haarcascade_frontalface_default");
 
  
-    vector<FileEntry> file_entries = readFileListVerbose(test_file_dir + files_list_name, test_file_dir) ;
-    pr._file_entries = file_entries;
-    vector<FaceDetectResult> results, all_results;
+    pr._list_path = test_file_dir + files_list_name;
+    pr._image_dir = test_file_dir;
+    // All results are only kept to be sorted at the end
+#if SORT_AND_SHOW
+    vector<FaceDetectResult> all_results;
+#endif
+
+    if (tune) {
+        // Successive halving samples images from the whole list
+        string list_error;
+        if (!readFileEntries(pr._list_path, pr._image_dir, &pr._file_entries, &list_error)) {
+            cerr << list_error << endl;
+            return 1;
+        }
+        // Wider grid than the single setting used for a normal run
+        pr._min_neighbors_min = 1;
+        pr._min_neighbors_max = 5;
+        pr._scale_factor_min = 1.05;
+        pr._scale_factor_max = 1.3;
+        pr._scale_factor_delta = 0.05;
+        for (vector<string>::const_iterator it = pr._cascades.begin(); it != pr._cascades.end(); it++) {
+            cout << "--------------------- tuning " << *it << " -----------------" << endl;
+            vector<ConfigScore> scores = tuneParameters(pr, *it, params);
+            showParetoTable(scores, cout);
+            ofstream tune_file((test_file_dir + "tune_" + *it + "_" + test_type_name + ".csv").c_str());
+            showParetoTable(scores, tune_file);
+        }
+        return 0;
+    }
     
-    pr._output_file.open((test_file_dir + output_file_name).c_str());
-    showHeaderFile(cout);
-    showHeaderFile(pr._output_file);
+    string results_error;
+    if (cache_path.size() > 0) {
+#if RESULTS_VERSION == 2
+        if (pr._strategy._budget._max_ms > 0.0) {
+            // Results then depend on how busy the machine was
+            cerr << "--cache cannot be used with a time budget" << endl;
+            return 1;
+        }
+        pr._cache = openDetectionCache(cache_path, cache_mb*1024*1024, &results_error);
+        if (!pr._cache) {
+            cerr << results_error << endl;
+            return 1;
+        }
+#else
+        cerr << "--cache needs RESULTS_VERSION 2" << endl;
+        return 1;
+#endif
+    }
+    if (sweep) {
+        // Compact copy of the results for analysis. See framing_sweep
+        pr._sweep = openSweepWriter(test_file_dir + "results_" + strategyAsString(strategy) + ".sweep", &results_error);
+        if (!pr._sweep) {
+            cerr << results_error << endl;
+            return 1;
+        }
+    }
+    pr._results = openResultsWriter(test_file_dir + output_file_name, results_params, &results_error);
+    if (!pr._results) {
+        cerr << results_error << endl;
+        return 1;
+    }
+    showHeaderFile(getResultsStream(pr._results));
+#if STAGE_TIMING
+    pr._timing_file.open((test_file_dir + "results_" + strategyAsString(strategy) + ".timing.csv").c_str());
+    pr._timing_summary_file.open((test_file_dir + "results_" + strategyAsString(strategy) + ".timing_summary.csv").c_str());
+    showStageTimesHeader(pr._timing_file);
+#endif
+    if (pr._trace)
+        pr._trace_file.open((test_file_dir + "results_" + strategyAsString(strategy) + ".trace.log").c_str());
+    if (pr._memory) {
+        pr._memory_file.open((test_file_dir + "results_" + strategyAsString(strategy) + ".memory.csv").c_str());
+        showMemoryHeader(pr._memory_file);
+    }
+    if (chrome_trace)
+        startPipelineTrace();
     
     for (vector<string>::const_iterator it = pr._cascades.begin(); it != pr._cascades.end(); it++) {
         cout << "--------------------- " << *it << " -----------------" << endl;
-        results = main_stuff(pr, *it);
-        all_results.insert(all_results.end(), results.begin(), results.end());
+#if SORT_AND_SHOW
+        main_stuff(pr, *it, &all_results);
         cout << "---------------- all_results --------------" << endl;
         SHOW_RESULTS(all_results);
+#else
+        main_stuff(pr, *it, 0);
+#endif
     }
     
-    pr._output_file.close();
+    if (!closeResultsWriter(&pr._results, &results_error)) {
+        cerr << results_error << endl;
+        return 1;
+    }
+    if (pr._sweep && !closeSweepWriter(&pr._sweep, &results_error)) {
+        cerr << results_error << endl;
+        return 1;
+    }
+    if (pr._cache) {
+        DetectionCacheStats cache_stats;
+        if (!closeDetectionCache(&pr._cache, &cache_stats, &results_error))
+            cerr << results_error << endl;
+        showDetectionCacheStats(cache_stats, cout);
+    }
+    if (chrome_trace) {
+        string error;
+        if (!writePipelineTrace(test_file_dir + "results_" + strategyAsString(strategy) + ".trace.json", &error))
+            cerr << error << endl;
+    }
+#if SORT_AND_SHOW
     cout << "================ all_results ==============" << endl;
     SHOW_RESULTS(all_results);
+#endif
+    if (pr._num_over_memory_budget > 0) {
+        cerr << pr._num_over_memory_budget << " images exceeded the memory budget" << endl;
+        return 2;
+    }
     return 0;
 }
 
 #else // #if TEST_MANY_SETTINGS
 
 FaceDetectResult processOneImage(DetectorState& dp)  {
-#if ADAPTIVE_FACE_SEARCH
-    CroppedFrameList_Adaptive  frame_list = processOneImage_Adaptive(dp);
-#else
-    CroppedFrameList_Histogram frame_list = processOneImage_Histogram(dp);
-#endif
+    PwRect cropped_coords = processOneImage_Strategy(dp)._best_face;
  //   PwRect best_face_orig_coords = offsetRectByRect(frame_list.getBestFace(), dp._entry.getFaceRect(dp._face_crop_ratio));
-    PwRect cropped_coords = frame_list.getBestFace();
-    PwRect scaled_coords = offsetRectByRect(frame_list.getBestFace(), dp._cropped_size);
+    PwRect scaled_coords = offsetRectByRect(cropped_coords, dp._cropped_size);
     double scale_x = (double)dp._scaled_size.width/(double)dp._original_size.width;
     double scale_y = (double)dp._scaled_size.height/(double)dp._original_size.height;
     if (fabs((scale_x - scale_y)/(scale_x + scale_y)) > 0.001)
@@ -971,48 +975,57 @@ FaceDetectResult processOneImage(DetectorState& dp)  {
     PwRect original_coords = scaleRectConcentric(scaled_coords, 1.0/scale_x);
     FaceDetectResult r(dp._entry, dp._cascade_name, scaled_coords);
     showOneResultFile(r, cout);
+    if (dp._degraded)
+        cout << "Search budget exhausted after " << dp._num_detect_calls << " detect calls. Best face so far returned" << endl;
    // showOneResultFile(r, pr._output_file);
     DRAW_RESULT_IMAGE(r);
     return r;
 }
 
 FaceDetectResult detectInOneImage(DetectorState& dp, FileEntry& entry) {
-    dp._entry = entry;
-   
-    IplImage*  image  = cvLoadImage(dp._entry._image_name.c_str());
+    TRACE_SPAN("image", "image", entry._image_name);
+    dp._stage_times.clear();
+    dp._memory.startImage();
+    IplImage*  image;
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_LOAD);
+        TRACE_SPAN("decode", "image");
+        image = cvLoadImage(entry._image_name.c_str());
+    }
     if (!image) {
-        cerr << "Could not find '" << dp._entry._image_name << "'" << endl;
+        cerr << "Could not find '" << entry._image_name << "'" << endl;
         abort();
     }
-    if (entry._face_radius == 0) {
-        PwRect face(0, 0, image->width, image->height);
-        entry._face_radius = getRadius(face);
-        entry._face_center = getCenter(face);
-    }
-    dp._original_size = PwRect(0, 0, image->width, image->height);
     cout << "original image = " << rectAsString(PwRect(0, 0, image->width, image->height)) << endl;
-    IplImage*  scaled_image = scaleImage640x480(image);
-    dp._scaled_size = PwRect(0, 0, scaled_image->width, scaled_image->height);
-    cout << "scaled image   = " << rectAsString(PwRect(0, 0, scaled_image->width, scaled_image->height)) << endl;
-    IplImage*  image2 = rotateImage(scaled_image, entry.getStraighteningAngle(), entry._face_center); 
-    cout << "rotaated image = " << rectAsString(PwRect(0, 0, image2->width, image2->height)) << endl;
-    PwRect face_rect =  entry.getFaceRect(1.0);
-    dp._face_crop_ratio = calcCropRatio(image, face_rect, MIN_CROP_WIDTH, FACE_CROP_RATIO);
-    PwRect crop_rect =  entry.getFaceRect(dp._face_crop_ratio);
-    dp._cropped_size = crop_rect;
-    cout << "crop_rect = " << rectAsString(crop_rect) << endl;
-    dp._current_frame = cropImage(image2,  crop_rect);  
-    assert (dp._current_frame );
+    dp._memory.add(IMAGE_INPUT, image);
+    string frame_error;
+    bool have_frame = setCurrentFrame(dp, image, entry, &frame_error);
+    dp._memory.remove(IMAGE_INPUT, image);
+    cvReleaseImage(&image);
+    if (!have_frame) {
+        cerr << "'" << entry._image_name << "': " << frame_error << endl;
+        abort();
+    }
+#if VERBOSE
+    cout << "face crop ratio = " << dp._face_crop_ratio << ", crop_rect = " << rectAsString(dp._cropped_size) << endl;
+#endif
+    entry = dp._entry;
 
     FaceDetectResult  result = processOneImage(dp) ;
+#if STAGE_TIMING
+    showStageTimesHeader(cout);
+    showStageTimes(entry._image_name, dp._stage_times, cout);
+#endif
   
-    cvReleaseImage(&dp._current_frame); 
-    cvReleaseImage(&scaled_image);
-    cvReleaseImage(&image2);    
+    releaseCurrentFrame(dp);
+    dp._memory.sampleProcess();
     return result;
 }
 
-FaceDetectResult peterFramingFilter(FileEntry& entry)     {
+/*
+ *  memory, if not 0, receives the memory used for the image
+ */
+FaceDetectResult peterFramingFilter(FileEntry& entry, const SearchStrategy& strategy, ostream* trace_out, MemoryStats* memory)     {
     const string cascade_name = "haarcascade_frontalface_alt2";
    /* 
     CFBundleRef mainBundle  = CFBundleGetMainBundle ();
@@ -1034,22 +1047,25 @@ FaceDetectResult peterFramingFilter(FileEntry& entry)     {
     cvNamedWindow (WINDOW_NAME, CV_WINDOW_AUTOSIZE);
 #endif    
 
+    SharedCascade shared;
+    loadCascade(shared, cascade_name);
     DetectorState dp;
-    dp._cascade_name = cascade_name;
-    const string cascade_path = getCascadePath(cascade_name);
-    dp._cascade = (CvHaarClassifierCascade*) cvLoad (cascade_path.c_str(), 0, 0, 0);
-    if (!dp._cascade) {
-        cerr << "Could not load cascade '" << cascade_path << "'" << endl;
-        abort(); 
-    }
-    dp._storage = cvCreateMemStorage(0);
-    assert (dp._storage);
-    
-    dp._face_crop_ratio = FACE_CROP_RATIO;
+    initDetectorState(dp, shared);
+    dp._strategy = strategy;
+    DetectTrace trace;
+    if (trace_out)
+        dp._trace = &trace;
     FaceDetectResult result = detectInOneImage(dp, entry) ;   
-    
-    cvReleaseMemStorage(&dp._storage);
-    cvFree(&dp._cascade);
+    if (trace_out) {
+        writeDetectTrace(entry._image_name, trace, *trace_out);
+        DetectTraceSummary summary;
+        summary.add(trace);
+        showDetectTraceSummary(summary, cout);
+    }
+    if (memory)
+        *memory = dp._memory;
+    releaseDetectorState(dp);
+    releaseSharedCascade(shared);
     return result;
 }
 
@@ -1093,15 +1109,64 @@ int main(int argc, char **argv)
 */
 
 
-int main(int argc, char* argv[]) {
-    if (argc <= 1) {
-        cerr << "Usage: peter_framing_filter <filename>" << endl;
-        return 1;
+/*
+ *  Show the memory stats if show and check them against budget.
+ *  Returns 2 if over budget, 0 otherwise
+ */
+static int reportMemory(const string name, const MemoryStats& stats, bool show, const MemoryBudget& budget) {
+    if (show || budget.isLimited()) {
+        showMemoryHeader(cout);
+        showMemoryStats(name, stats, cout);
+        MemorySummary summary;
+        summary.add(stats, budget);
+        showMemorySummary(summary, budget, cout);
+    }
+    if (budget.isExceeded(stats)) {
+        cerr << "Memory budget exceeded by '" << name << "'" << endl;
+        return 2;
     }
+    return 0;
+}
+
+/*
+ *  Track the face through a video file. Results go to <video>.faces.csv
+ *  Memory is reported for the whole video
+ */
+static int trackVideo(const string video_path, const VideoParams& params, const SearchStrategy& strategy,
+                      bool show_memory, const MemoryBudget& memory_budget) {
+    SharedCascade shared;
+    loadCascade(shared, "haarcascade_frontalface_alt2");
+    DetectorState dp;
+    initDetectorState(dp, shared);
+    dp._strategy = strategy;
+    
+    string output_name = video_path + ".faces.csv";
+    ofstream output_file(output_name.c_str());
+    VideoStats stats;
+    bool ok = processVideoFile(dp, video_path, params, output_file, &stats);
+    int status = ok ? 0 : 1;
+    if (ok) {
+        showVideoStats(stats, cout);
+        dp._memory.sampleProcess();
+        status = reportMemory(video_path, dp._memory, show_memory, memory_budget);
+    }
+    
+    releaseDetectorState(dp);
+    releaseSharedCascade(shared);
+    return status;
+}
+
+/*
+ *  Find the face in image_path and save the framed image next to it
+ */
+static int frameOneImage(const string image_path, const SearchStrategy& strategy, ostream* trace_out,
+                         bool show_memory, const MemoryBudget& memory_budget) {
     FileEntry entry;
-    entry._image_name = argv[1];
-    FaceDetectResult result = peterFramingFilter(entry) ;
+    entry._image_name = image_path;
+    MemoryStats memory;
+    FaceDetectResult result = peterFramingFilter(entry, strategy, trace_out, &memory) ;
     
+    TRACE_SPAN("framed_image", "image", entry._image_name);
     IplImage*  image  = cvLoadImage(entry._image_name.c_str());
     if (!image) {
         cerr << "Could not find '" << entry._image_name << "'" << endl;
@@ -1110,12 +1175,90 @@ int main(int argc, char* argv[]) {
     IplImage*  scaled_image = scaleImage640x480(image);
     IplImage*  cropped_image = cropImage(scaled_image, result._face_rect);  
     string cropped_image_name = entry._image_name + ".framed.jpg";
-    cvSaveImage(cropped_image_name.c_str(), cropped_image);
+    {
+        TRACE_SPAN("encode", "image");
+        cvSaveImage(cropped_image_name.c_str(), cropped_image);
+    }
   
     cvReleaseImage(&scaled_image);
     cvReleaseImage(&cropped_image); 
     cvReleaseImage(&image);    
-    return 0;
+    return reportMemory(entry._image_name, memory, show_memory, memory_budget);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc <= 1) {
+        cerr << "Usage: peter_framing_filter [search options] [--trace <log file>] [--chrome-trace <json file>] [memory options] <filename>" << endl;
+        cerr << "       peter_framing_filter [search options] [--trace <log file>] [--chrome-trace <json file>] [memory options] --video <video filename> [--no-predict] [--skip-threshold <t>] [--fps <target>]" << endl;
+        cerr << "Memory options: [--memory] [--memory-budget <peak RSS MB>] [--image-memory-budget <MB>]" << endl;
+        cerr << "Search options: [--strategy <file>] [--search adaptive|histogram] [--recursive 0|1] [--steps <n>] [--size-steps <n>]" << endl;
+        cerr << "                [--scale-factor <f>] [--min-neighbors <n>] [--hardwire 0|1] [--max-calls <n>] [--max-ms <t>]" << endl;
+        return 1;
+    }
+    SearchStrategy strategy;
+    VideoParams params;
+    string video_path, image_path, trace_path, chrome_trace_path;
+    bool show_memory = false;
+    MemoryBudget memory_budget;
+    for (int arg = 1; arg < argc; ) {
+        string error;
+        int parsed = parseStrategyArg(strategy, argc, argv, &arg, &error);
+        if (parsed < 0) {
+            cerr << error << endl;
+            return 1;
+        }
+        if (parsed > 0)
+            continue;
+        string option = argv[arg];
+        if (option == "--video" && arg + 1 < argc)
+            video_path = argv[++arg];
+        else if (option == "--no-predict")
+            params._use_prediction = false;
+        else if (option == "--skip-threshold" && arg + 1 < argc)
+            params._skip_threshold = atof(argv[++arg]);
+        else if (option == "--fps" && arg + 1 < argc)
+            params._target_fps = atof(argv[++arg]);
+        else if (option == "--trace" && arg + 1 < argc)
+            trace_path = argv[++arg];
+        else if (option == "--chrome-trace" && arg + 1 < argc)
+            chrome_trace_path = argv[++arg];
+        else if (option == "--memory")
+            show_memory = true;
+        else if (option == "--memory-budget" && arg + 1 < argc)
+            memory_budget._max_rss_mb = atol(argv[++arg]);
+        else if (option == "--image-memory-budget" && arg + 1 < argc)
+            memory_budget._max_image_mb = atol(argv[++arg]);
+        else if (option.compare(0, 2, "--") != 0 && image_path.size() == 0)
+            image_path = option;
+        else {
+            cerr << "Unknown option '" << option << "'" << endl;
+            return 1;
+        }
+        arg++;
+    }
+    test_type_name = getSearchAlgorithmName(strategy._algorithm);
+    cout << "search strategy = " << strategyAsString(strategy) << endl;
+    ofstream trace_file;
+    if (trace_path.size() > 0) {
+        trace_file.open(trace_path.c_str());
+        params._trace_out = &trace_file;
+    }
+    if (video_path.size() == 0 && image_path.size() == 0) {
+        cerr << "No image file given" << endl;
+        return 1;
+    }
+    if (chrome_trace_path.size() > 0)
+        startPipelineTrace();
+    int status = video_path.size() > 0 ? trackVideo(video_path, params, strategy, show_memory, memory_budget)
+                                       : frameOneImage(image_path, strategy, params._trace_out, show_memory, memory_budget);
+    if (chrome_trace_path.size() > 0) {
+        string error;
+        if (!writePipelineTrace(chrome_trace_path, &error)) {
+            cerr << error << endl;
+            return 1;
+        }
+    }
+    return status;
 }
 
 #endif  // #if TEST_MANY_SETTINGS
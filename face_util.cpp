@@ -5,20 +5,47 @@
  *  Created by peter on 11/03/10.
  */
 
-#include <sstream>
+#include <charconv>
+#include <iomanip>
+#include <string>
 
 #include "face_util.h"
 
 using namespace std;
 
 string intToStr(int n) {
-    stringstream s;
-    s << n;
-    return s.str();
+    char s[16];
+    return string(s, to_chars(s, s + sizeof(s), n).ptr);
 }
 
+/*
+ *  Same as ostream << n with default flags: %g with precision 6
+ */
 string doubleToStr(double n) {
-    stringstream s;
-    s << n;
-    return s.str();
-}
\ No newline at end of file
+    char s[32];
+    return string(s, to_chars(s, s + sizeof(s), n, chars_format::general, 6).ptr);
+}
+
+double percentile(const vector<double>& sorted, double p) {
+    if (sorted.size() == 0)
+        return 0.0;
+    int i = (int)(p * (double)(sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+/*
+ *  Quotes, backslashes and control characters are escaped
+ */
+void writeJsonString(const string s, ostream& out) {
+    out << '"';
+    for (string::size_type i = 0; i < s.size(); i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (c < 0x20)
+            out << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec << setfill(' ');
+        else
+            out << c;
+    }
+    out << '"';
+}
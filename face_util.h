@@ -1,3 +1,5 @@
+#ifndef FACE_UTIL_H
+#define FACE_UTIL_H
 /*
  *  face_util.h
  *  FaceTracker
@@ -5,7 +7,22 @@
  *  Created by peter on 11/03/10.
  */
  
+#include <ostream>
+#include <string>
+#include <vector>
 #include "config.h"
 
 std::string intToStr(int n);
-std::string doubleToStr(double n);
\ No newline at end of file
+std::string doubleToStr(double n);
+
+/*
+ *  Nearest rank percentile, p in [0, 1], of sorted values. 0 if there are none
+ */
+double percentile(const std::vector<double>& sorted, double p);
+
+/*
+ *  Write s to out as a quoted JSON string
+ */
+void writeJsonString(const std::string s, std::ostream& out);
+
+#endif // #ifndef FACE_UTIL_H
@@ -0,0 +1,434 @@
+/*
+ *  face_video.cpp
+ *  FaceTracker
+ *
+ *  Face tracking through the frames of a video file
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <stdlib.h>
+#include "face_video.h"
+#include "core_opencv.h"
+#include "face_calc.h"
+#include "pipeline_trace.h"
+
+using namespace std;
+
+void VideoStats::add(const VideoFrameResult& r) {
+    _num_frames++;
+    _num_found += r._found ? 1 : 0;
+    _num_tracked += r._tracked ? 1 : 0;
+    _num_full_searches += (r._tracked || r._skipped || r._dropped) ? 0 : 1;
+    _num_detect_calls += r._num_detect_calls;
+    _num_detect_calls_saved += r._detect_calls_saved;
+    _num_skipped += r._skipped ? 1 : 0;
+    _num_skipped_found += (r._skipped && r._found) ? 1 : 0;
+    _num_dropped += r._dropped ? 1 : 0;
+    if (!r._dropped && !r._skipped) {
+        _num_reduced_depth += r._num_steps < _configured_num_steps ? 1 : 0;
+        _num_degraded += r._degraded ? 1 : 0;
+        _min_num_steps = _min_num_steps > 0 ? min(_min_num_steps, r._num_steps) : r._num_steps;
+    }
+}
+
+void releaseVideoFaceTracker(VideoFaceTracker& tracker) {
+    if (tracker._last_thumb)
+        cvReleaseImage(&tracker._last_thumb);
+}
+
+static IplImage* makeThumbnail(const IplImage* frame) {
+    IplImage* thumb = cvCreateImage(cvSize(CHANGE_THUMB_WIDTH, CHANGE_THUMB_HEIGHT), IPL_DEPTH_8U, 1);
+    if (frame->nChannels == 1) {
+        cvResize(frame, thumb, CV_INTER_AREA);
+    }
+    else {
+        // Shrink first so only the thumbnail is converted to gray
+        IplImage* small_image = cvCreateImage(cvSize(CHANGE_THUMB_WIDTH, CHANGE_THUMB_HEIGHT), frame->depth, frame->nChannels);
+        cvResize(frame, small_image, CV_INTER_AREA);
+        cvCvtColor(small_image, thumb, CV_BGR2GRAY);
+        cvReleaseImage(&small_image);
+    }
+    return thumb;
+}
+
+/*
+ *  Mean absolute difference of two thumbnails. The inner loop is simple
+ *  enough for the compiler to vectorize
+ */
+static double getThumbnailDifference(const IplImage* thumb1, const IplImage* thumb2) {
+    long total = 0;
+    for (int y = 0; y < thumb1->height; y++) {
+        const unsigned char* p1 = (const unsigned char*)(thumb1->imageData + y*thumb1->widthStep);
+        const unsigned char* p2 = (const unsigned char*)(thumb2->imageData + y*thumb2->widthStep);
+        int row_total = 0;
+        for (int x = 0; x < thumb1->width; x++)
+            row_total += abs((int)p1[x] - (int)p2[x]);
+        total += row_total;
+    }
+    return (double)total/(double)(thumb1->width*thumb1->height);
+}
+
+double getFrameChange(const VideoFaceTracker& tracker, const IplImage* frame, IplImage** thumb) {
+    IplImage* frame_thumb = makeThumbnail(frame);
+    double change = tracker._last_thumb ? getThumbnailDifference(frame_thumb, tracker._last_thumb) : -1.0;
+    if (thumb)
+        *thumb = frame_thumb;
+    else
+        cvReleaseImage(&frame_thumb);
+    return change;
+}
+
+bool FacePredictor::predict(PwPoint* center, int* radius) {
+    if (!_valid)
+        return false;
+    _x += _vx;
+    _y += _vy;
+    _r += _vr;
+    *center = PwPoint(cvRound(_x), cvRound(_y));
+    *radius = max(1, cvRound(_r));
+    return true;
+}
+
+void FacePredictor::update(PwPoint center, int radius) {
+    if (!_valid) {
+        _x = center.x;
+        _y = center.y;
+        _r = radius;
+        _vx = _vy = _vr = 0.0;
+        _valid = true;
+    }
+    else {
+        // predict() has already moved the estimate to this frame
+        double dx = center.x - _x, dy = center.y - _y, dr = radius - _r;
+        _x += _alpha*dx;
+        _y += _alpha*dy;
+        _r += _alpha*dr;
+        _vx += _beta*dx;
+        _vy += _beta*dy;
+        _vr += _beta*dr;
+    }
+    _num_misses = 0;
+}
+
+void FacePredictor::miss() {
+    if (++_num_misses > PREDICT_MAX_MISSES)
+        _valid = false;
+}
+
+/*
+ *  Crop of the scaled frame around the predicted face, chosen the same way
+ *  as for still images. 
+ */
+static PwRect getPredictedSearchRect(const IplImage* scaled_image, PwPoint center, int radius, double* crop_ratio) {
+    PwRect image_rect(0, 0, scaled_image->width, scaled_image->height);
+    FileEntry entry;
+    entry._face_center = PwPoint(max(0, min(center.x, scaled_image->width - 1)), max(0, min(center.y, scaled_image->height - 1)));
+    entry._face_radius = radius;
+    *crop_ratio = calcCropRatio(scaled_image, entry.getFaceRect(1.0), MIN_CROP_WIDTH, PREDICT_CROP_RATIO);
+    return clipRect(entry.getFaceRect(*crop_ratio), image_rect);
+}
+
+/*
+ *  Run the tracking check then the full search on dp._current_frame, 
+ *  which is search_rect of the scaled frame. Returns face in scaled frame 
+ *  coordinates
+ */
+static PwRect searchFrame(DetectorState& dp, const VideoFaceTracker& tracker, PwRect search_rect, bool* tracked) {
+    PwRect face = EMPTY_RECT;
+    *tracked = false;
+    if (tracker._tracking) {
+        PwRect last_face(tracker._face.x - search_rect.x, tracker._face.y - search_rect.y, tracker._face.width, tracker._face.height);
+        if (containsRect(PwRect(0, 0, search_rect.width, search_rect.height), last_face)) {
+            face = trackFace(dp, last_face);
+            *tracked = !isEmptyRect(face);
+        }
+    }
+    if (!*tracked) {
+        face = findBestFace(dp);
+    }
+    if (!isEmptyRect(face))
+        face = offsetRectByRect(face, search_rect);
+    return face;
+}
+
+VideoFrameResult detectInVideoFrame(DetectorState& dp, VideoFaceTracker& tracker, const IplImage* frame) {
+    VideoFrameResult result;
+    int num_detect_calls = dp._num_detect_calls;
+    startSearchBudget(dp);
+    
+    // There is no ground truth face to crop around, only the prediction
+    dp._original_size = PwRect(0, 0, frame->width, frame->height);
+    IplImage* scaled_image;
+    {
+        STAGE_TIMER(dp._stage_times, STAGE_SCALE);
+        scaled_image = scaleImage640x480(frame);
+    }
+    dp._memory.add(IMAGE_SCALED, scaled_image);
+    dp._scaled_size = PwRect(0, 0, scaled_image->width, scaled_image->height);
+    
+    PwPoint predicted_center;
+    int     predicted_radius = 0;
+    PwRect  search_rect = dp._scaled_size;
+    if (tracker._use_prediction && tracker._predictor.predict(&predicted_center, &predicted_radius)) {
+        double crop_ratio;
+        PwRect rect = getPredictedSearchRect(scaled_image, predicted_center, predicted_radius, &crop_ratio);
+        if (!isEmptyRect(rect)) {
+            search_rect = rect;
+            dp._face_crop_ratio = crop_ratio;
+            result._predicted = true;
+        }
+    }
+    
+    bool tracked = false;
+    dp._current_frame = cropImage(scaled_image, search_rect);
+    dp._memory.add(IMAGE_FRAME, dp._current_frame);
+    dp._cropped_size  = search_rect;
+    PwRect face = searchFrame(dp, tracker, search_rect, &tracked);
+    releaseCurrentFrame(dp);
+    
+    if (isEmptyRect(face) && result._predicted) {
+        // Face is not where it was expected. Search the whole frame
+        search_rect = dp._scaled_size;
+        dp._face_crop_ratio = FACE_CROP_RATIO;
+        dp._current_frame = cvCloneImage(scaled_image);
+        dp._memory.add(IMAGE_FRAME, dp._current_frame);
+        dp._cropped_size  = search_rect;
+        face = searchFrame(dp, tracker, search_rect, &tracked);
+        releaseCurrentFrame(dp);
+    }
+    dp._memory.remove(IMAGE_SCALED, scaled_image);
+    cvReleaseImage(&scaled_image);
+    cvClearMemStorage(dp._storage);
+    
+    tracker._tracking = !isEmptyRect(face);
+    tracker._face = face;
+    if (tracker._tracking)
+        tracker._predictor.update(getCenter(face), getRadius(face));
+    else
+        tracker._predictor.miss();
+    
+    result._tracked = tracked;
+    result._found = tracker._tracking;
+    result._search_rect = search_rect;
+    result._degraded = dp._degraded;
+    result._num_detect_calls = dp._num_detect_calls - num_detect_calls;
+    if (!tracked && search_rect.width == dp._scaled_size.width && search_rect.height == dp._scaled_size.height) {
+        tracker._full_frame_calls += result._num_detect_calls;
+        tracker._num_full_frame++;
+    }
+    result._detect_calls_saved = max(0, cvRound(tracker.getBaselineCalls()) - result._num_detect_calls);
+    if (result._found) {
+        result._face_rect = unscaleRect(face, dp._scaled_size, dp._original_size);
+        if (result._predicted) {
+            PwPoint found_center = getCenter(face);
+            result._offset_x = found_center.x - predicted_center.x;
+            result._offset_y = found_center.y - predicted_center.y;
+            result._offset_radius = getRadius(face) - predicted_radius;
+        }
+    }
+    return result;
+}
+
+/*
+ *  Real-time budget. Frame n arrives n/target_fps seconds after the first. 
+ *  A frame that is still waiting when the next one arrives is dropped, so 
+ *  at most one frame is ever queued.
+ */
+struct RealTimeBudget {
+    double  _interval_ms;
+    double  _mean_ms;           // Smoothed processing time per frame searched
+    chrono::steady_clock::time_point _start;
+    RealTimeBudget(double target_fps): _interval_ms(1000.0/target_fps), _mean_ms(0.0), _start(chrono::steady_clock::now()) {}
+    double getElapsedMs() const { return chrono::duration<double, milli>(chrono::steady_clock::now() - _start).count(); }
+    bool isOverdue(int frame_num) const { return getElapsedMs() > (double)(frame_num + 1)*_interval_ms; }
+    void waitForFrame(int frame_num) const {
+        this_thread::sleep_until(_start + chrono::duration<double, milli>((double)frame_num*_interval_ms));
+    }
+};
+
+/*
+ *  Lower the search depth while frames take longer than the interval and 
+ *  raise it back when there is slack. Depths stay odd so the search has a 
+ *  middle step
+ */
+static void adjustSearchDepth(DetectorState& dp, RealTimeBudget& budget, const SearchStrategy& configured, double process_ms) {
+    budget._mean_ms = budget._mean_ms > 0.0 ? 0.8*budget._mean_ms + 0.2*process_ms : process_ms;
+    int num_steps = dp._strategy._adaptive_num_steps;
+    if (budget._mean_ms > budget._interval_ms)
+        num_steps = max(min(MIN_BUDGET_NUM_STEPS, configured._adaptive_num_steps), num_steps - 2);
+    else if (budget._mean_ms < 0.6*budget._interval_ms)
+        num_steps = min(configured._adaptive_num_steps, num_steps + 2);
+    dp._strategy._adaptive_num_steps = num_steps;
+    dp._strategy._size_num_steps = min(configured._size_num_steps, 
+        max(MIN_BUDGET_NUM_STEPS, (configured._size_num_steps*num_steps/configured._adaptive_num_steps) | 1));
+}
+
+/*
+ *  Result for a frame that was not searched
+ */
+static VideoFrameResult reuseLastResult(const VideoFrameResult& last_result, const VideoFaceTracker& tracker) {
+    VideoFrameResult r = last_result;
+    r._tracked = false;
+    r._predicted = false;
+    r._num_detect_calls = 0;
+    r._detect_calls_saved = cvRound(tracker.getBaselineCalls());
+    r._offset_x = r._offset_y = r._offset_radius = 0;
+    r._process_ms = 0.0;
+    return r;
+}
+
+bool processVideoFile(DetectorState& dp, const string video_path, const VideoParams& params, ostream& out, VideoStats* stats) {
+    CvCapture* capture = cvCaptureFromFile(video_path.c_str());
+    if (!capture) {
+        cerr << "Could not open video '" << video_path << "'" << endl;
+        return false;
+    }
+    
+    VideoFaceTracker tracker;
+    tracker._use_prediction = params._use_prediction;
+    VideoFrameResult last_result;
+    RealTimeBudget budget(params._target_fps > 0.0 ? params._target_fps : 1.0);
+    bool use_budget = params._target_fps > 0.0;
+    const SearchStrategy configured = dp._strategy;
+    DetectTrace trace;
+    DetectTrace* saved_trace = dp._trace;
+    if (params._trace_out)
+        dp._trace = &trace;
+    if (stats)
+        stats->_configured_num_steps = configured._adaptive_num_steps;
+    showVideoHeader(out);
+    for (int frame_num = 0; ; frame_num++) {
+        // CV_CAP_PROP_POS_MSEC is the time of the frame last grabbed, so it 
+        // is read after each grab
+        if (use_budget && budget.isOverdue(frame_num)) {
+            // Grab without retrieving so the dropped frame is not converted
+            if (!cvGrabFrame(capture))
+                break;
+            VideoFrameResult r = reuseLastResult(last_result, tracker);
+            r._dropped = true;
+            r._frame_num = frame_num;
+            r._time_ms = cvGetCaptureProperty(capture, CV_CAP_PROP_POS_MSEC);
+            showVideoFrameResult(r, out);
+            if (stats)
+                stats->add(r);
+            continue;
+        }
+        if (use_budget)
+            budget.waitForFrame(frame_num);
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        
+        TRACE_SPAN("frame", "image", "frame " + to_string(frame_num));
+        // Owned by capture. Must not be released
+        IplImage* frame;
+        {
+            TRACE_SPAN("decode", "image");
+            frame = cvQueryFrame(capture);
+        }
+        if (!frame)
+            break;
+        double time_ms = cvGetCaptureProperty(capture, CV_CAP_PROP_POS_MSEC);
+        VideoFrameResult r;
+        IplImage* thumb = 0;
+        double change = params._skip_threshold > 0.0 ? getFrameChange(tracker, frame, &thumb) : -1.0;
+        if (change >= 0.0 && change < params._skip_threshold) {
+            // Compared against the last frame searched, not the last frame, 
+            // so that slow drift is not skipped forever
+            r = reuseLastResult(last_result, tracker);
+            r._skipped = true;
+            cvReleaseImage(&thumb);
+        }
+        else {
+            trace.clear();
+            r = detectInVideoFrame(dp, tracker, frame);
+            if (params._trace_out) {
+                writeDetectTrace("frame " + to_string(frame_num), trace, *params._trace_out);
+                if (stats)
+                    stats->_trace_summary.add(trace);
+            }
+            r._num_steps = dp._strategy._adaptive_num_steps;
+            r._process_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+            if (use_budget)
+                adjustSearchDepth(dp, budget, configured, r._process_ms);
+            last_result = r;
+            if (thumb) {
+                if (tracker._last_thumb)
+                    cvReleaseImage(&tracker._last_thumb);
+                tracker._last_thumb = thumb;
+            }
+        }
+        r._frame_change = change;
+        r._frame_num = frame_num;
+        r._time_ms = time_ms;
+        showVideoFrameResult(r, out);
+        if (stats)
+            stats->add(r);
+    }
+    
+    if (stats) {
+        stats->_target_fps = params._target_fps;
+        stats->_elapsed_seconds = budget.getElapsedMs()/1000.0;
+    }
+    dp._strategy = configured;
+    dp._trace = saved_trace;
+    releaseVideoFaceTracker(tracker);
+    cvReleaseCapture(&capture);
+    return true;
+}
+
+void showVideoHeader(ostream& out) {
+    out << "FRAME, TIME_MS, FOUND, TRACKED, FACE_X, FACE_Y, FACE_WIDTH, FACE_HEIGHT, DETECT_CALLS, "
+        << "PREDICTED, SEARCH_X, SEARCH_Y, SEARCH_WIDTH, SEARCH_HEIGHT, OFFSET_X, OFFSET_Y, OFFSET_RADIUS, CALLS_SAVED, "
+        << "SKIPPED, FRAME_CHANGE, DROPPED, NUM_STEPS, PROCESS_MS, DEGRADED" << endl;
+}
+
+void showVideoFrameResult(const VideoFrameResult& r, ostream& out) {
+    out << setw(6) << r._frame_num << ", "
+        << setw(9) << fixed << setprecision(1) << r._time_ms << ", "
+        << (r._found ? 1 : 0) << ", " << (r._tracked ? 1 : 0) << ", "
+        << setw(4) << r._face_rect.x << ", " << setw(4) << r._face_rect.y << ", "
+        << setw(4) << r._face_rect.width << ", " << setw(4) << r._face_rect.height << ", "
+        << setw(4) << r._num_detect_calls << ", "
+        << (r._predicted ? 1 : 0) << ", "
+        << setw(4) << r._search_rect.x << ", " << setw(4) << r._search_rect.y << ", "
+        << setw(4) << r._search_rect.width << ", " << setw(4) << r._search_rect.height << ", "
+        << setw(4) << r._offset_x << ", " << setw(4) << r._offset_y << ", " << setw(4) << r._offset_radius << ", "
+        << setw(4) << r._detect_calls_saved << ", "
+        << (r._skipped ? 1 : 0) << ", "
+        << setw(6) << setprecision(2) << r._frame_change << ", "
+        << (r._dropped ? 1 : 0) << ", "
+        << setw(3) << r._num_steps << ", "
+        << setw(8) << setprecision(1) << r._process_ms << ", "
+        << (r._degraded ? 1 : 0) << endl;
+}
+
+void showVideoStats(const VideoStats& stats, ostream& out) {
+    double calls_per_frame = stats._num_frames > 0 ? (double)stats._num_detect_calls/(double)stats._num_frames : 0.0;
+    out << "frames = " << stats._num_frames 
+        << ", found = " << stats._num_found 
+        << ", tracked = " << stats._num_tracked 
+        << ", full searches = " << stats._num_full_searches 
+        << ", detect calls = " << stats._num_detect_calls 
+        << " (" << setprecision(3) << calls_per_frame << " per frame)"
+        << ", detect calls saved = " << stats._num_detect_calls_saved << endl;
+    double skip_rate = stats._num_frames > 0 ? (double)stats._num_skipped/(double)stats._num_frames : 0.0;
+    out << "skipped static frames = " << stats._num_skipped 
+        << " (" << setprecision(3) << skip_rate*100.0 << "%)"
+        << ", with face = " << stats._num_skipped_found << endl;
+    if (stats._num_degraded > 0)
+        out << "frames with search budget exhausted = " << stats._num_degraded << endl;
+    if (stats._trace_summary._num_images > 0)
+        showDetectTraceSummary(stats._trace_summary, out);
+    if (stats._target_fps > 0.0) {
+        int num_processed = stats._num_frames - stats._num_dropped;
+        double achieved_fps = stats._elapsed_seconds > 0.0 ? (double)num_processed/stats._elapsed_seconds : 0.0;
+        out << "target fps = " << setprecision(3) << stats._target_fps
+            << ", achieved fps = " << setprecision(3) << achieved_fps
+            << ", dropped = " << stats._num_dropped 
+            << ", reduced depth frames = " << stats._num_reduced_depth
+            << ", min steps = " << stats._min_num_steps << endl;
+    }
+}
@@ -0,0 +1,167 @@
+#ifndef FACE_VIDEO_H
+#define FACE_VIDEO_H
+/*
+ *  face_video.h
+ *  FaceTracker
+ *
+ *  Face tracking through the frames of a video file.
+ *
+ *  The face found in one frame seeds the search in the next. If it has not
+ *  moved far, trackFace() confirms and resizes it with a few detect calls.
+ *  The full search selected by dp._strategy is only run on the first
+ *  frame and whenever tracking is lost.
+ *
+ *  A constant velocity predictor over face center and radius picks the
+ *  region of the next frame to search, so the searches run on a crop around
+ *  where the face is expected rather than the whole frame.
+ *
+ *  Frames that differ little from the last frame searched reuse its result
+ *  without any detect calls. The difference is the mean absolute difference
+ *  of small gray thumbnails. Photo bursts can be run as image sequences, e.g.
+ *  "burst_%04d.jpg".
+ *
+ *  With a target frame rate, frames are taken to arrive at that rate. Frames
+ *  overtaken by the next one are dropped and the adaptive search depth is 
+ *  lowered while processing cannot keep up.
+ */
+
+#include <ostream>
+#include <string>
+#include "config.h"
+#include "face_detect.h"
+
+// (Diameter of area searched)/(predicted face diameter) 
+static const double PREDICT_CROP_RATIO = 2.0;
+
+// Frames the predictor coasts without a measurement before it is reset
+static const int PREDICT_MAX_MISSES = 3;
+
+// Least search depth the real-time budget will lower the adaptive search to
+static const int MIN_BUDGET_NUM_STEPS = 5;
+
+// Size of the gray thumbnail compared between frames to detect a static scene
+static const int CHANGE_THUMB_WIDTH  = 64;
+static const int CHANGE_THUMB_HEIGHT = 48;
+
+/*
+ *  Alpha-beta (constant velocity) filter over face center and radius.
+ *  Units are scaled frame pixels and frames.
+ */
+struct FacePredictor {
+    bool    _valid;
+    double  _x, _y, _r;         // Estimate
+    double  _vx, _vy, _vr;      // Velocity per frame
+    int     _num_misses;
+    double  _alpha, _beta;
+    FacePredictor(): _valid(false), _x(0.0), _y(0.0), _r(0.0), _vx(0.0), _vy(0.0), _vr(0.0),
+        _num_misses(0), _alpha(0.7), _beta(0.3) {}
+    /*
+     *  Advance one frame. Returns false if there is nothing to predict from
+     */
+    bool predict(PwPoint* center, int* radius);
+    void update(PwPoint center, int radius);
+    void miss();
+};
+
+/*
+ *  State carried from one frame to the next
+ */
+struct VideoFaceTracker {
+    bool    _tracking;          // A face was found in the previous frame
+    PwRect  _face;              // Where, in scaled frame coordinates
+    bool    _use_prediction;
+    FacePredictor _predictor;
+    long    _full_frame_calls;  // Detect calls made by whole frame full searches
+    int     _num_full_frame;    // Number of whole frame full searches
+    IplImage* _last_thumb;      // Thumbnail of the last frame searched
+    VideoFaceTracker(): _tracking(false), _use_prediction(true), _full_frame_calls(0), _num_full_frame(0), _last_thumb(0) {}
+    /*
+     *  Estimated detect calls per frame without tracking or prediction
+     */
+    double getBaselineCalls() const { return _num_full_frame > 0 ? (double)_full_frame_calls/(double)_num_full_frame : 0.0; }
+};
+
+struct VideoFrameResult {
+    int     _frame_num;
+    double  _time_ms;           // Position in the video
+    bool    _tracked;           // Found by tracking rather than a full search
+    bool    _found;
+    PwRect  _face_rect;         // In video frame coordinates
+    int     _num_detect_calls;
+  // Prediction. Offsets are found - predicted in scaled frame pixels
+    bool    _predicted;
+    PwRect  _search_rect;       // Region searched, in scaled frame coordinates
+    int     _offset_x, _offset_y, _offset_radius;
+    int     _detect_calls_saved;    // Against the mean of whole frame full searches
+  // Static scene skipping
+    bool    _skipped;           // Result copied from the last frame searched
+    double  _frame_change;      // Mean absolute gray level difference from it
+  // Real-time budget
+    bool    _dropped;           // Not decoded or searched to keep up with the target rate
+    int     _num_steps;         // Adaptive search depth used
+    double  _process_ms;
+    bool    _degraded;          // Search budget ran out
+    VideoFrameResult(): _frame_num(0), _time_ms(0.0), _tracked(false), _found(false), _num_detect_calls(0),
+        _predicted(false), _offset_x(0), _offset_y(0), _offset_radius(0), _detect_calls_saved(0),
+        _skipped(false), _frame_change(0.0), _dropped(false), _num_steps(0), _process_ms(0.0), _degraded(false) {}
+};
+
+struct VideoStats {
+    int     _num_frames;
+    int     _num_found;
+    int     _num_tracked;
+    int     _num_full_searches;
+    long    _num_detect_calls;
+    long    _num_detect_calls_saved;
+    int     _num_skipped;
+    int     _num_skipped_found;     // Skipped frames that reused a found face
+    int     _num_dropped;
+    int     _num_reduced_depth;     // Frames searched below the configured depth
+    int     _num_degraded;          // Frames whose search budget ran out
+    int     _min_num_steps;
+    int     _configured_num_steps;
+    double  _target_fps;
+    double  _elapsed_seconds;
+    DetectTraceSummary _trace_summary;  // If VideoParams::_trace_out
+    VideoStats(): _num_frames(0), _num_found(0), _num_tracked(0), _num_full_searches(0), _num_detect_calls(0),
+        _num_detect_calls_saved(0), _num_skipped(0), _num_skipped_found(0), 
+        _num_dropped(0), _num_reduced_depth(0), _num_degraded(0), _min_num_steps(0), _configured_num_steps(0), _target_fps(0.0), _elapsed_seconds(0.0) {}
+    void add(const VideoFrameResult& r);
+};
+
+/*
+ *  Options for processVideoFile()
+ */
+struct VideoParams {
+    bool    _use_prediction;    // Search around the predicted face before the whole frame
+    double  _skip_threshold;    // Reuse the last result below this frame change, e.g. 2.0. 0 (default) to never skip
+    double  _target_fps;        // Real-time budget. 0 to process every frame fully
+    std::ostream* _trace_out;   // Detect call trace of every frame searched is written here if set
+    VideoParams(): _use_prediction(true), _skip_threshold(0.0), _target_fps(0.0), _trace_out(0) {}
+};
+
+void releaseVideoFaceTracker(VideoFaceTracker& tracker);
+
+/*
+ *  Mean absolute gray level difference between frame and the last frame 
+ *  searched by tracker. Returns -1 if there is no last frame. If thumb is 
+ *  not 0 it is set to frame's thumbnail, which the caller then owns
+ */
+double getFrameChange(const VideoFaceTracker& tracker, const IplImage* frame, IplImage** thumb);
+
+/*
+ *  Find the face in one video frame, using and updating tracker
+ */
+VideoFrameResult detectInVideoFrame(DetectorState& dp, VideoFaceTracker& tracker, const IplImage* frame);
+
+/*
+ *  Track the face through every frame of video_path, writing one line per 
+ *  frame to out. Returns false if the video cannot be opened
+ */
+bool processVideoFile(DetectorState& dp, const std::string video_path, const VideoParams& params, std::ostream& out, VideoStats* stats);
+
+void showVideoHeader(std::ostream& out);
+void showVideoFrameResult(const VideoFrameResult& r, std::ostream& out);
+void showVideoStats(const VideoStats& stats, std::ostream& out);
+
+#endif // #ifndef FACE_VIDEO_H
@@ -0,0 +1,224 @@
+/*
+ *  file_list.cpp
+ *  FaceTracker
+ *
+ *  Fast reading of file-list CSVs into FileEntry's
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include "face_csv.h"
+#include "file_list.h"
+
+using namespace std;
+
+/*
+ *  Values of the column named name, or 0's if there is no such column
+ */
+static const vector<int>& getIntColumn(CsvTable& table, const string name, const vector<int>& zeros) {
+    int col = table.getColumn(name);
+    return col >= 0 ? table.getInts(col) : zeros;
+}
+
+bool readFileEntries(const string list_path, const string image_dir, vector<FileEntry>* entries, string* error) {
+    entries->clear();
+    CsvTable table;
+    if (!table.read(list_path)) {
+        if (error)
+            *error = "Could not read file list '" + list_path + "'";
+        return false;
+    }
+    int name_col = table.getColumn(KEY_IMAGE_NAME);
+    if (name_col < 0) {
+        if (error)
+            *error = "No " + KEY_IMAGE_NAME + " column in '" + list_path + "'";
+        return false;
+    }
+    int num_rows = table.getNumRows();
+    vector<int>    int_zeros(num_rows, 0);
+    vector<double> double_zeros(num_rows, 0.0);
+    const vector<int>& center_x = getIntColumn(table, KEY_FACE_CENTER_X, int_zeros);
+    const vector<int>& center_y = getIntColumn(table, KEY_FACE_CENTER_Y, int_zeros);
+    const vector<int>& radius   = getIntColumn(table, KEY_FACE_RADIUS,   int_zeros);
+    int angle_col = table.getColumn(KEY_FACE_ANGLE);
+    const vector<double>& angle = angle_col >= 0 ? table.getDoubles(angle_col) : double_zeros;
+
+    entries->reserve(num_rows);
+    for (int i = 0; i < num_rows; i++) {
+        string_view name = table.getText(i, name_col);
+        if (name.size() == 0)
+            continue;
+        entries->push_back(FileEntry());
+        FileEntry& e = entries->back();
+        e._image_name.reserve(image_dir.size() + name.size());
+        e._image_name.append(image_dir).append(name);
+        e._face_center = PwPoint(center_x[i], center_y[i]);
+        e._face_radius = radius[i];
+        e._face_angle  = angle[i];
+    }
+    return true;
+}
+
+/*
+ *  _lock guards everything below it
+ */
+struct FileListStream {
+    ifstream                _file;
+    string                  _list_path;
+    string                  _image_dir;
+    int                     _max_read_ahead;
+    int                     _name_col, _center_x_col, _center_y_col, _radius_col, _angle_col;
+    thread                  _reader;
+
+    mutable mutex           _lock;
+    condition_variable      _entries_ready;
+    condition_variable      _queue_not_full;
+    deque<FileEntry>        _entries;
+    bool                    _done;          // Reader has finished
+    bool                    _shutting_down;
+    string                  _error;
+};
+
+static const int FILE_LIST_CHUNK_BYTES = 256*1024;
+
+static string_view getField(const vector<string_view>& fields, size_t begin, size_t end, int col) {
+    return (col >= 0 && begin + col < end) ? fields[begin + col] : string_view();
+}
+
+/*
+ *  Queue entries, waiting for room. Returns false if the stream is shutting down
+ */
+static bool pushEntries(FileListStream* stream, const vector<FileEntry>& entries) {
+    int i = 0;
+    unique_lock<mutex> guard(stream->_lock);
+    while (i < (int)entries.size()) {
+        stream->_queue_not_full.wait(guard, [stream] { 
+            return stream->_shutting_down || (int)stream->_entries.size() < stream->_max_read_ahead; 
+        });
+        if (stream->_shutting_down)
+            return false;
+        while (i < (int)entries.size() && (int)stream->_entries.size() < stream->_max_read_ahead)
+            stream->_entries.push_back(entries[i++]);
+        stream->_entries_ready.notify_one();
+    }
+    return true;
+}
+
+static void readFileList(FileListStream* stream) {
+    vector<char> chunk(FILE_LIST_CHUNK_BYTES);
+    string pending;             // Text not yet split into rows. Ends in a partial line
+    vector<string_view> fields;
+    vector<size_t> row_starts;
+    vector<FileEntry> entries;
+    bool running = true;
+    while (running) {
+        stream->_file.read(&chunk[0], chunk.size());
+        size_t n = stream->_file.gcount();
+        bool at_end = n < chunk.size();
+        pending.append(&chunk[0], n);
+        size_t end = at_end ? pending.size() : pending.rfind('\n');
+        if (end == string::npos)
+            continue;
+        if (!at_end)
+            end++;
+        splitCsvRows(pending.data(), end, fields, row_starts);
+        entries.clear();
+        for (int r = 0; r + 1 < (int)row_starts.size(); r++) {
+            size_t b = row_starts[r], e = row_starts[r + 1];
+            string_view name = getField(fields, b, e, stream->_name_col);
+            if (name.size() == 0)
+                continue;
+            entries.push_back(FileEntry());
+            FileEntry& entry = entries.back();
+            entry._image_name.reserve(stream->_image_dir.size() + name.size());
+            entry._image_name.append(stream->_image_dir).append(name);
+            entry._face_center = PwPoint(csvToInt(getField(fields, b, e, stream->_center_x_col)), 
+                                         csvToInt(getField(fields, b, e, stream->_center_y_col)));
+            entry._face_radius = csvToInt(getField(fields, b, e, stream->_radius_col));
+            entry._face_angle  = csvToDouble(getField(fields, b, e, stream->_angle_col));
+        }
+        pending.erase(0, end);
+        running = pushEntries(stream, entries) && !at_end;
+    }
+    lock_guard<mutex> guard(stream->_lock);
+    if (stream->_file.bad())
+        stream->_error = "Error reading file list '" + stream->_list_path + "'";
+    stream->_done = true;
+    stream->_entries_ready.notify_all();
+}
+
+FileListStream* openFileListStream(const string list_path, const string image_dir, int max_read_ahead, string* error) {
+    FileListStream* stream = new FileListStream;
+    stream->_file.open(list_path.c_str(), ios::in | ios::binary);
+    
+    // The header is the first non-blank line
+    string header;
+    vector<string_view> names;
+    vector<size_t> row_starts;
+    while (names.size() == 0 && getline(stream->_file, header))
+        splitCsvRows(header.data(), header.size(), names, row_starts);
+    if (names.size() == 0) {
+        if (error)
+            *error = "Could not read file list '" + list_path + "'";
+        delete stream;
+        return 0;
+    }
+    int cols[5] = { -1, -1, -1, -1, -1 };
+    const string keys[5] = { KEY_IMAGE_NAME, KEY_FACE_CENTER_X, KEY_FACE_CENTER_Y, KEY_FACE_RADIUS, KEY_FACE_ANGLE };
+    for (int i = (int)names.size() - 1; i >= 0; i--)
+        for (int k = 0; k < 5; k++)
+            if (names[i] == keys[k])
+                cols[k] = i;
+    if (cols[0] < 0) {
+        if (error)
+            *error = "No " + KEY_IMAGE_NAME + " column in '" + list_path + "'";
+        delete stream;
+        return 0;
+    }
+    stream->_list_path = list_path;
+    stream->_image_dir = image_dir;
+    stream->_max_read_ahead = max(max_read_ahead, 1);
+    stream->_name_col = cols[0];
+    stream->_center_x_col = cols[1];
+    stream->_center_y_col = cols[2];
+    stream->_radius_col = cols[3];
+    stream->_angle_col = cols[4];
+    stream->_done = false;
+    stream->_shutting_down = false;
+    stream->_reader = thread(readFileList, stream);
+    return stream;
+}
+
+void releaseFileListStream(FileListStream** stream) {
+    if (*stream) {
+        {
+            lock_guard<mutex> guard((*stream)->_lock);
+            (*stream)->_shutting_down = true;
+        }
+        (*stream)->_queue_not_full.notify_all();
+        (*stream)->_reader.join();
+        delete *stream;
+        *stream = 0;
+    }
+}
+
+bool readFileEntryBatch(FileListStream* stream, int max_entries, vector<FileEntry>* batch) {
+    batch->clear();
+    unique_lock<mutex> guard(stream->_lock);
+    stream->_entries_ready.wait(guard, [stream] { return stream->_done || !stream->_entries.empty(); });
+    while (!stream->_entries.empty() && (int)batch->size() < max(max_entries, 1)) {
+        batch->push_back(stream->_entries.front());
+        stream->_entries.pop_front();
+    }
+    stream->_queue_not_full.notify_one();
+    return batch->size() > 0;
+}
+
+string getFileListStreamError(const FileListStream* stream) {
+    lock_guard<mutex> guard(stream->_lock);
+    return stream->_error;
+}
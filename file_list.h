@@ -0,0 +1,52 @@
+#ifndef FILE_LIST_H
+#define FILE_LIST_H
+/*
+ *  file_list.h
+ *  FaceTracker
+ *
+ *  Fast reading of file-list CSVs into FileEntry's, either all at once or
+ *  streamed a batch at a time for lists too long to hold in memory
+ */
+
+#include <string>
+#include <vector>
+#include "config.h"
+#include "face_io.h"
+
+/*
+ *  Read a file list with a header row naming IMAGE_NAME and optionally
+ *  FACE_CENTER_X, FACE_CENTER_Y, FACE_RADIUS and FACE_ANGLE columns. 
+ *  Image names are relative to image_dir. Rows with no image name are
+ *  skipped. A missing numeric column reads as 0 (no ground truth)
+ */
+bool readFileEntries(const std::string list_path, const std::string image_dir, std::vector<FileEntry>* entries, std::string* error);
+
+/*
+ *  The same file list read on a background thread. The reader stays at most
+ *  max_read_ahead entries (plus one read chunk) ahead of the caller
+ */
+struct FileListStream;
+
+/*
+ *  Returns 0 and sets *error if the list cannot be opened or has no 
+ *  IMAGE_NAME column
+ */
+FileListStream* openFileListStream(const std::string list_path, const std::string image_dir, int max_read_ahead, std::string* error);
+
+/*
+ *  Stops the reader, which may not have reached the end of the list
+ */
+void releaseFileListStream(FileListStream** stream);
+
+/*
+ *  Replace *batch with the next 1 to max_entries entries in list order. 
+ *  Blocks until they have been read. Returns false at the end of the list
+ */
+bool readFileEntryBatch(FileListStream* stream, int max_entries, std::vector<FileEntry>* batch);
+
+/*
+ *  Empty unless reading stopped early on an error
+ */
+std::string getFileListStreamError(const FileListStream* stream);
+
+#endif // #ifndef FILE_LIST_H
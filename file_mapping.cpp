@@ -0,0 +1,37 @@
+/*
+ *  file_mapping.cpp
+ *  FaceTracker
+ *
+ *  Read-only memory mapping of a whole file
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "file_mapping.h"
+
+using namespace std;
+
+FileMapping::~FileMapping() {
+    if (_data && _size > 0)
+        munmap((void*)_data, _size);
+}
+
+bool FileMapping::open(const string path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size > 0) {
+        void* p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = p != MAP_FAILED;
+        if (ok) {
+            _data = (const char*)p;
+            _size = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,24 @@
+#ifndef FILE_MAPPING_H
+#define FILE_MAPPING_H
+/*
+ *  file_mapping.h
+ *  FaceTracker
+ *
+ *  Read-only memory mapping of a whole file
+ */
+
+#include <string>
+#include "config.h"
+
+struct FileMapping {
+    const char* _data;      // 0 for an empty file
+    size_t      _size;
+    FileMapping(): _data(0), _size(0) {}
+    ~FileMapping();
+    bool open(const std::string path);
+private:
+    FileMapping(const FileMapping&);
+    FileMapping& operator=(const FileMapping&);
+};
+
+#endif // #ifndef FILE_MAPPING_H
@@ -0,0 +1,264 @@
+/*
+ *  framing_async.cpp
+ *  FaceTracker
+ *
+ *  Asynchronous batch interface on top of a FramingContext
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "framing_async.h"
+#include "pipeline_trace.h"
+#include "work_pool.h"
+
+using namespace std;
+
+/*
+ *  The image is _image if it is set, else it is loaded from _image_path or
+ *  decoded from _data by the worker
+ */
+struct FramingJob {
+    const IplImage* _image;
+    string          _image_path;
+    const char*     _data;
+    long            _size;
+    long            _tag;
+    bool            _want_framed_image;
+    FramingJob(): _image(0), _data(0), _size(0), _tag(0), _want_framed_image(false) {}
+};
+
+/*
+ *  _lock guards everything below it.
+ *  _num_outstanding counts jobs submitted whose completion has not yet been
+ *  delivered, so waitCompletion() knows when there is nothing left to wait for.
+ *  _cancelled holds completions of cancelled jobs waiting for a worker to pass
+ *  them to the callback, so the callback never runs on the cancelling thread.
+ */
+struct AsyncFraming {
+    FramingContext*             _context;
+    AsyncFramingParams          _params;
+    vector<thread>              _workers;
+    
+    mutable mutex               _lock;
+    condition_variable          _job_ready;
+    condition_variable          _queue_not_full;
+    condition_variable          _completion_ready;
+    deque<FramingJob>           _jobs;
+    deque<FramingCompletion>    _completions;
+    deque<FramingCompletion>    _cancelled;
+    int                         _num_outstanding;
+    bool                        _shutting_down;
+};
+
+/*
+ *  Called with _lock held
+ */
+static void deliverLocked(AsyncFraming* async, unique_lock<mutex>& guard, const FramingCompletion& completion) {
+    if (async->_params._callback) {
+        guard.unlock();
+        async->_params._callback(async->_params._callback_user, completion);
+        guard.lock();
+        async->_num_outstanding--;
+    }
+    else {
+        async->_completions.push_back(completion);
+    }
+    async->_completion_ready.notify_all();
+}
+
+/*
+ *  Load or decode job's image if needed and frame it
+ */
+static FramingResult runJob(AsyncFraming* async, const FramingJob& job) {
+    if (job._image)
+        return framingFilter(async->_context, job._image, job._want_framed_image);
+    IplImage* image;
+    {
+        TRACE_SPAN("decode", "image");
+        if (job._data) {
+            CvMat mat = cvMat(1, (int)job._size, CV_8UC1, (void*)job._data);
+            image = cvDecodeImage(&mat, CV_LOAD_IMAGE_COLOR);
+        }
+        else {
+            image = cvLoadImage(job._image_path.c_str());
+        }
+    }
+    FramingResult result;
+    if (!image) {
+        result._error = job._data ? "Could not decode image" : "Could not read '" + job._image_path + "'";
+        return result;
+    }
+    result = framingFilter(async->_context, image, job._want_framed_image);
+    cvReleaseImage(&image);
+    return result;
+}
+
+static void asyncWorker(AsyncFraming* async) {
+    unique_lock<mutex> guard(async->_lock);
+    while (true) {
+        async->_job_ready.wait(guard, [async] { 
+            return async->_shutting_down || !async->_jobs.empty() || !async->_cancelled.empty(); 
+        });
+        if (!async->_cancelled.empty()) {
+            FramingCompletion completion = async->_cancelled.front();
+            async->_cancelled.pop_front();
+            deliverLocked(async, guard, completion);
+            continue;
+        }
+        if (async->_jobs.empty())
+            break;
+        FramingJob job = async->_jobs.front();
+        async->_jobs.pop_front();
+        async->_queue_not_full.notify_one();
+        
+        guard.unlock();
+        FramingCompletion completion;
+        completion._tag = job._tag;
+        completion._result = runJob(async, job);
+        guard.lock();
+        
+        deliverLocked(async, guard, completion);
+    }
+}
+
+AsyncFraming* createAsyncFraming(FramingContext* context, const AsyncFramingParams& params) {
+    AsyncFraming* async = new AsyncFraming;
+    async->_context = context;
+    async->_params = params;
+    if (async->_params._num_workers <= 0)
+        async->_params._num_workers = getNumCores();
+    if (async->_params._queue_depth <= 0)
+        async->_params._queue_depth = 1;
+    async->_num_outstanding = 0;
+    async->_shutting_down = false;
+    for (int i = 0; i < async->_params._num_workers; i++)
+        async->_workers.push_back(thread(asyncWorker, async));
+    return async;
+}
+
+void releaseAsyncFraming(AsyncFraming** async) {
+    if (*async) {
+        cancelAllFraming(*async);
+        {
+            lock_guard<mutex> guard((*async)->_lock);
+            (*async)->_shutting_down = true;
+        }
+        (*async)->_job_ready.notify_all();
+        (*async)->_queue_not_full.notify_all();
+        for (int i = 0; i < (int)(*async)->_workers.size(); i++)
+            (*async)->_workers[i].join();
+        // Undelivered completions may still hold framed images
+        for (int i = 0; i < (int)(*async)->_completions.size(); i++) {
+            if ((*async)->_completions[i]._result._framed_image)
+                cvReleaseImage(&(*async)->_completions[i]._result._framed_image);
+        }
+        delete *async;
+        *async = 0;
+    }
+}
+
+static bool submitJob(AsyncFraming* async, const FramingJob& job) {
+    unique_lock<mutex> guard(async->_lock);
+    async->_queue_not_full.wait(guard, [async] { 
+        return async->_shutting_down || (int)async->_jobs.size() < async->_params._queue_depth; 
+    });
+    if (async->_shutting_down)
+        return false;
+    async->_jobs.push_back(job);
+    async->_num_outstanding++;
+    async->_job_ready.notify_one();
+    return true;
+}
+
+bool submitFraming(AsyncFraming* async, const IplImage* image, long tag, bool want_framed_image) {
+    FramingJob job;
+    job._image = image;
+    job._tag = tag;
+    job._want_framed_image = want_framed_image;
+    return submitJob(async, job);
+}
+
+bool submitFramingFile(AsyncFraming* async, const string image_path, long tag, bool want_framed_image) {
+    FramingJob job;
+    job._image_path = image_path;
+    job._tag = tag;
+    job._want_framed_image = want_framed_image;
+    return submitJob(async, job);
+}
+
+bool submitFramingBytes(AsyncFraming* async, const char* data, long size, long tag, bool want_framed_image) {
+    FramingJob job;
+    job._data = data;
+    job._size = size;
+    job._tag = tag;
+    job._want_framed_image = want_framed_image;
+    return submitJob(async, job);
+}
+
+static bool popCompletionLocked(AsyncFraming* async, FramingCompletion* completion) {
+    if (async->_completions.empty())
+        return false;
+    *completion = async->_completions.front();
+    async->_completions.pop_front();
+    async->_num_outstanding--;
+    return true;
+}
+
+bool tryGetCompletion(AsyncFraming* async, FramingCompletion* completion) {
+    lock_guard<mutex> guard(async->_lock);
+    return popCompletionLocked(async, completion);
+}
+
+bool waitCompletion(AsyncFraming* async, FramingCompletion* completion) {
+    unique_lock<mutex> guard(async->_lock);
+    async->_completion_ready.wait(guard, [async] { 
+        return !async->_completions.empty() || async->_num_outstanding == 0 || async->_params._callback != 0; 
+    });
+    return popCompletionLocked(async, completion);
+}
+
+/*
+ *  Cancel pending jobs with this tag, or all pending jobs
+ */
+static int cancelMatching(AsyncFraming* async, bool all, long tag) {
+    unique_lock<mutex> guard(async->_lock);
+    vector<FramingJob> cancelled;
+    deque<FramingJob> kept;
+    for (int i = 0; i < (int)async->_jobs.size(); i++) {
+        if (all || async->_jobs[i]._tag == tag)
+            cancelled.push_back(async->_jobs[i]);
+        else
+            kept.push_back(async->_jobs[i]);
+    }
+    async->_jobs = kept;
+    async->_queue_not_full.notify_all();
+    for (int i = 0; i < (int)cancelled.size(); i++) {
+        FramingCompletion completion;
+        completion._tag = cancelled[i]._tag;
+        completion._cancelled = true;
+        completion._result._error = "Cancelled";
+        if (async->_params._callback)
+            async->_cancelled.push_back(completion);
+        else
+            deliverLocked(async, guard, completion);
+    }
+    if (async->_params._callback && !cancelled.empty())
+        async->_job_ready.notify_all();
+    return (int)cancelled.size();
+}
+
+int cancelFraming(AsyncFraming* async, long tag) {
+    return cancelMatching(async, false, tag);
+}
+
+int cancelAllFraming(AsyncFraming* async) {
+    return cancelMatching(async, true, 0);
+}
+
+int getNumPendingFraming(const AsyncFraming* async) {
+    lock_guard<mutex> guard(async->_lock);
+    return (int)async->_jobs.size();
+}
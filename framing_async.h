@@ -0,0 +1,91 @@
+#ifndef FRAMING_ASYNC_H
+#define FRAMING_ASYNC_H
+/*
+ *  framing_async.h
+ *  FaceTracker
+ *
+ *  Asynchronous batch interface on top of a FramingContext.
+ *
+ *  Images are submitted with a caller chosen tag and processed by a fixed
+ *  set of worker threads. Each finished (or cancelled) job produces one
+ *  FramingCompletion, which is either passed to a callback on the worker 
+ *  thread or put on a completion queue for the caller to collect.
+ *
+ *  The caller owns submitted images, and the encoded bytes of images 
+ *  submitted that way, and must keep them alive until their completion has
+ *  been delivered.
+ */
+
+#include <string>
+#include "config.h"
+#include "framing_filter.h"
+
+struct FramingCompletion {
+    long            _tag;
+    bool            _cancelled;     // Job was cancelled before it ran. _result is empty
+    FramingResult   _result;
+    FramingCompletion(): _tag(0), _cancelled(false) {}
+};
+
+/*
+ *  Called on a worker thread. Must not call back into the AsyncFraming
+ */
+typedef void (*FramingCallback)(void* user, const FramingCompletion& completion);
+
+struct AsyncFramingParams {
+    int             _num_workers;   // 0 => one per core
+    int             _queue_depth;   // Max jobs waiting to run. submitFraming() blocks when full
+    FramingCallback _callback;      // 0 => use the completion queue
+    void*           _callback_user;
+    AsyncFramingParams(): _num_workers(0), _queue_depth(64), _callback(0), _callback_user(0) {}
+};
+
+struct AsyncFraming;
+
+/*
+ *  context must outlive the returned AsyncFraming
+ */
+AsyncFraming* createAsyncFraming(FramingContext* context, const AsyncFramingParams& params);
+
+/*
+ *  Cancels pending jobs, waits for running ones and stops the workers
+ */
+void releaseAsyncFraming(AsyncFraming** async);
+
+/*
+ *  Queue image for framing. Blocks while the queue is full.
+ *  Returns false if async is shutting down
+ */
+bool submitFraming(AsyncFraming* async, const IplImage* image, long tag, bool want_framed_image);
+
+/*
+ *  As submitFraming() but the worker loads the image from image_path, or 
+ *  decodes it from the size bytes at data, so decoding is spread over the
+ *  workers too. If the image cannot be read the completion's _result has 
+ *  _ok false
+ */
+bool submitFramingFile(AsyncFraming* async, const std::string image_path, long tag, bool want_framed_image);
+bool submitFramingBytes(AsyncFraming* async, const char* data, long size, long tag, bool want_framed_image);
+
+/*
+ *  Get the next completion from the queue. 
+ *  tryGetCompletion() returns false at once if there is none.
+ *  waitCompletion() blocks until there is one and returns false only when
+ *  no jobs are outstanding.
+ *  Both return false at once when a callback is used instead of the queue.
+ */
+bool tryGetCompletion(AsyncFraming* async, FramingCompletion* completion);
+bool waitCompletion(AsyncFraming* async, FramingCompletion* completion);
+
+/*
+ *  Cancel jobs that have not started. Running jobs are not interrupted.
+ *  Each cancelled job still produces a completion with _cancelled set,
+ *  which goes to the callback on a worker thread like any other.
+ *  Return the number of jobs cancelled.
+ */
+int  cancelFraming(AsyncFraming* async, long tag);
+int  cancelAllFraming(AsyncFraming* async);
+
+int  getNumPendingFraming(const AsyncFraming* async);
+
+#endif // #ifndef FRAMING_ASYNC_H
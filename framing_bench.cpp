@@ -0,0 +1,382 @@
+/*
+ *  framing_bench.cpp
+ *  FaceTracker
+ *
+ *  Microbenchmarks of the image primitives and of detectFacesCrop().
+ *
+ *  Each case is run for a number of timed iterations after a warm up and
+ *  reported as min, median and p99 in microseconds. Images are synthetic
+ *  unless --image is given, so the suite runs offline and gives the same
+ *  inputs on every build.
+ *
+ *      framing_bench [--iterations <n>] [--filter <substring>] [--image <file>]
+ *                    [--cascade <xml file>] [--label <build name>] [--json <file>]
+ *      framing_bench --compare <base json> <new json>
+ *
+ *  The JSON has one case per line so two runs can be compared with
+ *  --compare or diffed directly.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include "config.h"
+#include "face_common.h"
+#include "face_util.h"
+#include "core_opencv.h"
+#include "shared_cascade.h"
+#include "face_detect.h"
+
+using namespace std;
+
+static const int NUM_WARMUP_ITERATIONS = 2;
+
+struct BenchParams {
+    int     _iterations;
+    string  _filter;
+    string  _image_path;
+    string  _cascade_path;
+    string  _label;
+    string  _json_path;
+    BenchParams(): _iterations(50), _cascade_path("haarcascade_frontalface_alt2.xml"), _label("build") {}
+};
+
+struct BenchResult {
+    string  _name;
+    int     _iterations;
+    double  _min_us;
+    double  _median_us;
+    double  _p99_us;
+    double  _mean_us;
+};
+
+/*
+ *  One benchmark case. run() is called once per iteration and timed
+ */
+struct BenchCase {
+    virtual ~BenchCase() {}
+    virtual void run() = 0;
+};
+
+static BenchResult timeCase(const string name, BenchCase& bench_case, int iterations) {
+    for (int i = 0; i < NUM_WARMUP_ITERATIONS; i++)
+        bench_case.run();
+    vector<double> us(iterations);
+    for (int i = 0; i < iterations; i++) {
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        bench_case.run();
+        us[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count();
+    }
+    sort(us.begin(), us.end());
+    BenchResult r;
+    r._name = name;
+    r._iterations = iterations;
+    r._min_us = us.size() > 0 ? us[0] : 0.0;
+    r._median_us = percentile(us, 0.50);
+    r._p99_us = percentile(us, 0.99);
+    double total = 0.0;
+    for (int i = 0; i < iterations; i++)
+        total += us[i];
+    r._mean_us = iterations > 0 ? total/(double)iterations : 0.0;
+    return r;
+}
+
+/*
+ *  Smooth gradient with a bright disc and deterministic noise, so the
+ *  detector has edges to work on
+ */
+static IplImage* createSyntheticImage(int width, int height) {
+    IplImage* image = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 3);
+    unsigned int seed = 12345;
+    int cx = width/2, cy = height/2, r = min(width, height)/4;
+    for (int y = 0; y < height; y++) {
+        unsigned char* row = (unsigned char*)image->imageData + y*image->widthStep;
+        for (int x = 0; x < width; x++) {
+            seed = seed*1103515245 + 12345;
+            int noise = (int)((seed >> 16) & 0x1f);
+            bool in_disc = (x - cx)*(x - cx) + (y - cy)*(y - cy) < r*r;
+            int v = in_disc ? 200 : (x*255)/width/2 + (y*255)/height/2;
+            row[3*x + 0] = (unsigned char)min(255, v/2 + noise);
+            row[3*x + 1] = (unsigned char)min(255, v*3/4 + noise);
+            row[3*x + 2] = (unsigned char)min(255, v + noise);
+        }
+    }
+    return image;
+}
+
+/*
+ *  image resized to width x height. Caller must cvReleaseImage() it
+ */
+static IplImage* createInputImage(const IplImage* source, int width, int height) {
+    if (!source)
+        return createSyntheticImage(width, height);
+    IplImage* image = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 3);
+    cvResize(source, image, CV_INTER_LINEAR);
+    return image;
+}
+
+static PwRect centeredRect(const IplImage* image, double fraction) {
+    int w = max(1, cvRound((double)image->width*fraction));
+    int h = max(1, cvRound((double)image->height*fraction));
+    return PwRect((image->width - w)/2, (image->height - h)/2, w, h);
+}
+
+struct CropCase: public BenchCase {
+    const IplImage* _image;
+    PwRect          _rect;
+    void run() {
+        IplImage* out = cropImage(_image, _rect);
+        cvReleaseImage(&out);
+    }
+};
+
+struct ScaleCase: public BenchCase {
+    const IplImage* _image;
+    void run() {
+        IplImage* out = scaleImageWH(_image, 640, 480);
+        cvReleaseImage(&out);
+    }
+};
+
+struct RotateCase: public BenchCase {
+    const IplImage* _image;
+    double          _angle;
+    void run() {
+        IplImage* out = rotateImage(_image, _angle, PwPoint(_image->width/2, _image->height/2));
+        cvReleaseImage(&out);
+    }
+};
+
+struct ResizeCase: public BenchCase {
+    const IplImage* _image;
+    void run() {
+        IplImage* out = resizeImage(_image, _image->width/8, _image->height/8);
+        cvReleaseImage(&out);
+    }
+};
+
+/*
+ *  The conversion detectFacesCrop() does before each Haar call
+ */
+struct GrayDownscaleCase: public BenchCase {
+    const IplImage* _image;
+    void run() {
+        IplImage* gray  = cvCreateImage(cvSize(_image->width, _image->height), IPL_DEPTH_8U, 1);
+        IplImage* small = cvCreateImage(cvSize(_image->width/SMALL_IMAGE_SCALE, _image->height/SMALL_IMAGE_SCALE), IPL_DEPTH_8U, 1);
+        cvCvtColor(_image, gray, CV_BGR2GRAY);
+        cvResize(gray, small, CV_INTER_LINEAR);
+        cvReleaseImage(&gray);
+        cvReleaseImage(&small);
+    }
+};
+
+struct DetectCase: public BenchCase {
+    const DetectorState* _dp;
+    PwRect               _rect;
+    void run() {
+        startSearchBudget(*_dp);
+        detectFacesCrop(*_dp, &_rect);
+        cvClearMemStorage(_dp->_storage);
+    }
+};
+
+static string caseName(const string op, const IplImage* image, const string detail) {
+    ostringstream s;
+    s << op << " " << image->width << "x" << image->height;
+    if (detail.size() > 0)
+        s << " " << detail;
+    return s.str();
+}
+
+static string fractionName(const string prefix, double fraction) {
+    ostringstream s;
+    s << prefix << "=" << fixed << setprecision(2) << fraction;
+    return s.str();
+}
+
+static void runCase(const BenchParams& params, const string name, BenchCase& bench_case, vector<BenchResult>& results) {
+    if (params._filter.size() > 0 && name.find(params._filter) == string::npos)
+        return;
+    BenchResult r = timeCase(name, bench_case, params._iterations);
+    cout << setw(36) << left << r._name << right << fixed << setprecision(1)
+         << " min " << setw(10) << r._min_us << " us"
+         << "  median " << setw(10) << r._median_us << " us"
+         << "  p99 " << setw(10) << r._p99_us << " us" << endl;
+    results.push_back(r);
+}
+
+static vector<BenchResult> runBenchmarks(const BenchParams& params) {
+    static const int    sizes[][2] = { {640, 480}, {1280, 960}, {2592, 1944} };
+    static const double fractions[] = { 0.25, 0.5, 1.0 };
+    const int num_sizes = sizeof(sizes)/sizeof(sizes[0]);
+    const int num_fractions = sizeof(fractions)/sizeof(fractions[0]);
+
+    IplImage* source = 0;
+    if (params._image_path.size() > 0) {
+        source = cvLoadImage(params._image_path.c_str());
+        if (!source) {
+            cerr << "Could not read '" << params._image_path << "'" << endl;
+            exit(1);
+        }
+    }
+    vector<BenchResult> results;
+
+    for (int i = 0; i < num_sizes; i++) {
+        IplImage* image = createInputImage(source, sizes[i][0], sizes[i][1]);
+        for (int j = 0; j < num_fractions; j++) {
+            CropCase c;
+            c._image = image;
+            c._rect = centeredRect(image, fractions[j]);
+            runCase(params, caseName("cropImage", image, fractionName("rect", fractions[j])), c, results);
+        }
+        ScaleCase s;
+        s._image = image;
+        runCase(params, caseName("scaleImageWH", image, "to=640x480"), s, results);
+        RotateCase r;
+        r._image = image;
+        r._angle = 10.0;
+        runCase(params, caseName("rotateImage", image, "angle=10"), r, results);
+        ResizeCase z;
+        z._image = image;
+        runCase(params, caseName("resizeImage", image, "border=1/8"), z, results);
+        GrayDownscaleCase g;
+        g._image = image;
+        runCase(params, caseName("grayDownscale", image, ""), g, results);
+        cvReleaseImage(&image);
+    }
+
+    // Detection runs on the 640x480 frames the pipeline searches
+    SharedCascade shared;
+    if (!loadSharedCascade(shared, params._cascade_path, "bench")) {
+        cerr << "Could not load cascade '" << params._cascade_path << "'. Skipping detectFacesCrop cases" << endl;
+    }
+    else {
+        DetectorState dp;
+        initDetectorState(dp, shared);
+        dp._current_frame = createInputImage(source, 640, 480);
+        for (int j = 0; j < num_fractions; j++) {
+            DetectCase d;
+            d._dp = &dp;
+            d._rect = centeredRect(dp._current_frame, fractions[j]);
+            runCase(params, caseName("detectFacesCrop", dp._current_frame, fractionName("rect", fractions[j])), d, results);
+        }
+        cvReleaseImage(&dp._current_frame);
+        releaseDetectorState(dp);
+        releaseSharedCascade(shared);
+    }
+
+    if (source)
+        cvReleaseImage(&source);
+    return results;
+}
+
+static void writeResultsJson(const BenchParams& params, const vector<BenchResult>& results, ostream& out) {
+    out << "{\"label\": ";
+    writeJsonString(params._label, out);
+    out << ", \"iterations\": " << params._iterations << ", \"image\": ";
+    writeJsonString(params._image_path.size() > 0 ? params._image_path : "synthetic", out);
+    out << ", \"cases\": [" << endl;
+    for (int i = 0; i < (int)results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "{\"name\": ";
+        writeJsonString(r._name, out);
+        out << fixed << setprecision(3)
+            << ", \"iterations\": " << r._iterations
+            << ", \"min_us\": " << r._min_us
+            << ", \"median_us\": " << r._median_us
+            << ", \"p99_us\": " << r._p99_us
+            << ", \"mean_us\": " << r._mean_us << "}"
+            << (i + 1 < (int)results.size() ? "," : "") << endl;
+    }
+    out << "]}" << endl;
+}
+
+/*
+ *  Read back the case lines written by writeResultsJson(). Returns median_us by case name
+ */
+static bool readResultsJson(const string path, map<string, double>* medians, vector<string>* names) {
+    ifstream in(path.c_str());
+    if (!in)
+        return false;
+    string line;
+    while (getline(in, line)) {
+        const string name_key = "{\"name\": \"", median_key = "\"median_us\": ";
+        if (line.compare(0, name_key.size(), name_key) != 0)
+            continue;
+        string::size_type end = line.find('"', name_key.size());
+        string::size_type m = line.find(median_key);
+        if (end == string::npos || m == string::npos)
+            continue;
+        string name = line.substr(name_key.size(), end - name_key.size());
+        (*medians)[name] = atof(line.c_str() + m + median_key.size());
+        names->push_back(name);
+    }
+    return true;
+}
+
+static int compareResults(const string base_path, const string new_path) {
+    map<string, double> base, current;
+    vector<string> base_names, new_names;
+    if (!readResultsJson(base_path, &base, &base_names) || !readResultsJson(new_path, &current, &new_names)) {
+        cerr << "Could not read '" << base_path << "' or '" << new_path << "'" << endl;
+        return 1;
+    }
+    cout << "CASE, BASE_MEDIAN_US, NEW_MEDIAN_US, NEW/BASE" << endl;
+    for (int i = 0; i < (int)base_names.size(); i++) {
+        const string& name = base_names[i];
+        if (current.find(name) == current.end())
+            continue;
+        double b = base[name], n = current[name];
+        cout << setw(36) << left << name << right << ", " << fixed << setprecision(1)
+             << setw(10) << b << ", " << setw(10) << n << ", "
+             << setprecision(3) << (b > 0.0 ? n/b : 0.0) << endl;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    BenchParams params;
+    for (int arg = 1; arg < argc; arg++) {
+        string option = argv[arg];
+        if (option == "--compare" && arg + 2 < argc)
+            return compareResults(argv[arg + 1], argv[arg + 2]);
+        else if (option == "--iterations" && arg + 1 < argc)
+            params._iterations = max(1, atoi(argv[++arg]));
+        else if (option == "--filter" && arg + 1 < argc)
+            params._filter = argv[++arg];
+        else if (option == "--image" && arg + 1 < argc)
+            params._image_path = argv[++arg];
+        else if (option == "--cascade" && arg + 1 < argc)
+            params._cascade_path = argv[++arg];
+        else if (option == "--label" && arg + 1 < argc)
+            params._label = argv[++arg];
+        else if (option == "--json" && arg + 1 < argc)
+            params._json_path = argv[++arg];
+        else {
+            cerr << "Usage: framing_bench [--iterations <n>] [--filter <substring>] [--image <file>]" << endl;
+            cerr << "                     [--cascade <xml file>] [--label <build name>] [--json <file>]" << endl;
+            cerr << "       framing_bench --compare <base json> <new json>" << endl;
+            return 1;
+        }
+    }
+
+    vector<BenchResult> results = runBenchmarks(params);
+    if (params._json_path.size() > 0) {
+        ofstream out(params._json_path.c_str());
+        if (!out) {
+            cerr << "Could not write '" << params._json_path << "'" << endl;
+            return 1;
+        }
+        writeResultsJson(params, results, out);
+    }
+    else
+        writeResultsJson(params, results, cout);
+    return 0;
+}
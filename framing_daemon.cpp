@@ -0,0 +1,429 @@
+/*
+ *  framing_daemon.cpp
+ *  FaceTracker
+ *
+ *  Long running framing server on a Unix domain socket.
+ *  Keeps the cascade and a pool of DetectorStates warm so that callers do
+ *  not pay for a process start and cascade load per image.
+ *
+ *  Protocol. One request per line, one response line per request, in order.
+ *  Clients may send several requests before reading the responses. Requests
+ *  that arrive together are run on the workers together, including reading 
+ *  and decoding their images.
+ *
+ *      FRAME <image path>
+ *      FRAMEBYTES <n>\n<n bytes of encoded image>
+ *          => OK <found> <x> <y> <width> <height> <center x> <center y> <radius> <degraded>
+ *          => ERR <message>
+ *      STATS
+ *          => STATS queue=<n> served=<n> errors=<n> p50_ms=<t> p90_ms=<t> p99_ms=<t> max_ms=<t>
+ *          served and the latencies are of requests that were framed. errors
+ *          also counts requests rejected before framing
+ *      QUIT
+ *          => BYE
+ *          then closes the connection
+ *
+ *  Access. FRAME opens any path the daemon's user can read, so the socket is
+ *  created with mode 0600 and only that user can connect. Put it in a
+ *  directory with the access you want if other users need to connect.
+ *
+ *  SIGINT and SIGTERM stop accepting connections, let open connections 
+ *  finish the requests they have sent, then shut down cleanly.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "framing_filter.h"
+#include "face_util.h"
+#include "framing_async.h"
+
+using namespace std;
+
+// Largest inline image accepted
+static const long MAX_IMAGE_BYTES = 64L*1024L*1024L;
+
+// Number of recent latencies kept for percentiles
+static const int NUM_LATENCIES = 10000;
+
+/*
+ *  Latencies of the last NUM_LATENCIES requests that were framed.
+ *  Requests rejected before framing only count as errors
+ */
+struct DaemonStats {
+    mutex           _lock;
+    vector<double>  _latencies_ms;
+    int             _next;
+    long            _num_served;
+    long            _num_errors;
+    DaemonStats(): _next(0), _num_served(0), _num_errors(0) {}
+    void add(double ms, bool ok) {
+        lock_guard<mutex> guard(_lock);
+        if ((int)_latencies_ms.size() < NUM_LATENCIES)
+            _latencies_ms.push_back(ms);
+        else
+            _latencies_ms[_next] = ms;
+        _next = (_next + 1) % NUM_LATENCIES;
+        _num_served++;
+        if (!ok)
+            _num_errors++;
+    }
+    void addError() {
+        lock_guard<mutex> guard(_lock);
+        _num_errors++;
+    }
+};
+
+/*
+ *  One request on a connection. Filled in by the AsyncFraming callback
+ */
+struct DaemonRequest {
+    string      _error;         // Set if the request could not be submitted
+    string      _bytes;         // Encoded image of a FRAMEBYTES request
+    bool        _done;
+    FramingCompletion _completion;
+    chrono::steady_clock::time_point _start;
+    struct Connection* _connection;
+    DaemonRequest(): _done(false), _connection(0) {}
+};
+
+struct Connection {
+    int                 _fd;
+    string              _buffer;    // Bytes read but not yet parsed
+    mutex               _lock;
+    condition_variable  _done;
+};
+
+/*
+ *  _connections_lock guards _connection_fds, the sockets of connections
+ *  being served, so shutdown can close their read side and wait for them
+ */
+struct Daemon {
+    FramingContext*     _context;
+    AsyncFraming*       _async;
+    DaemonStats         _stats;
+    mutex               _connections_lock;
+    condition_variable  _connections_done;
+    vector<int>         _connection_fds;
+};
+
+static Daemon daemon_state;
+
+// Written by the signal handler to wake the accept loop
+static int stop_pipe[2] = { -1, -1 };
+
+static void stopSignal(int) {
+    char c = 0;
+    ssize_t n = write(stop_pipe[1], &c, 1);
+    (void)n;
+}
+
+static void requestDone(void* user, const FramingCompletion& completion) {
+    DaemonRequest* request = (DaemonRequest*)completion._tag;
+    Connection* connection = request->_connection;
+    lock_guard<mutex> guard(connection->_lock);
+    request->_completion = completion;
+    request->_done = true;
+    connection->_done.notify_all();
+}
+
+static bool writeAll(int fd, const string& s) {
+    const char* p = s.c_str();
+    size_t n = s.size();
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return false;
+        p += w;
+        n -= w;
+    }
+    return true;
+}
+
+/*
+ *  Read more bytes into connection's buffer. Returns false on EOF or error
+ */
+static bool fillBuffer(Connection& connection) {
+    char buf[65536];
+    while (true) {
+        ssize_t n = read(connection._fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        connection._buffer.append(buf, n);
+        return true;
+    }
+}
+
+/*
+ *  Take one complete request from connection's buffer into line (and bytes for
+ *  FRAMEBYTES). Returns false if the buffer does not hold a complete request
+ */
+static bool parseRequest(Connection& connection, string* line, string* bytes) {
+    string::size_type eol = connection._buffer.find('\n');
+    if (eol == string::npos)
+        return false;
+    string l = connection._buffer.substr(0, eol);
+    if (l.size() > 0 && l[l.size()-1] == '\r')
+        l.resize(l.size()-1);
+    string::size_type consumed = eol + 1;
+    if (l.compare(0, 11, "FRAMEBYTES ") == 0) {
+        long n = atol(l.c_str() + 11);
+        if (n > 0 && n <= MAX_IMAGE_BYTES) {
+            if (connection._buffer.size() < consumed + n)
+                return false;
+            *bytes = connection._buffer.substr(consumed, n);
+            consumed += n;
+        }
+    }
+    *line = l;
+    connection._buffer.erase(0, consumed);
+    return true;
+}
+
+static string statsLine() {
+    vector<double> sorted;
+    long num_served, num_errors;
+    {
+        lock_guard<mutex> guard(daemon_state._stats._lock);
+        sorted = daemon_state._stats._latencies_ms;
+        num_served = daemon_state._stats._num_served;
+        num_errors = daemon_state._stats._num_errors;
+    }
+    sort(sorted.begin(), sorted.end());
+    ostringstream out;
+    out << "STATS queue=" << getNumPendingFraming(daemon_state._async)
+        << " served=" << num_served << " errors=" << num_errors
+        << " p50_ms=" << percentile(sorted, 0.50)
+        << " p90_ms=" << percentile(sorted, 0.90)
+        << " p99_ms=" << percentile(sorted, 0.99)
+        << " max_ms=" << (sorted.size() > 0 ? sorted[sorted.size()-1] : 0.0) << "\n";
+    return out.str();
+}
+
+static string resultLine(const DaemonRequest& request) {
+    ostringstream out;
+    const FramingResult& r = request._completion._result;
+    if (request._error.size() > 0)
+        out << "ERR " << request._error << "\n";
+    else if (!r._ok)
+        out << "ERR " << r._error << "\n";
+    else
+        out << "OK " << (r._found ? 1 : 0) << " "
+            << r._face_rect.x << " " << r._face_rect.y << " " << r._face_rect.width << " " << r._face_rect.height << " "
+            << r._face_center.x << " " << r._face_center.y << " " << r._face_radius << " " 
+            << (r._degraded ? 1 : 0) << "\n";
+    return out.str();
+}
+
+/*
+ *  Serve one client. Every complete request in the buffer is submitted
+ *  before waiting for any of them, so pipelined requests run in parallel.
+ *  fd is in daemon_state._connection_fds and is removed and closed on exit
+ */
+static void serveConnection(int fd) {
+    Connection connection;
+    connection._fd = fd;
+    bool open = true;
+    while (open && fillBuffer(connection)) {
+        vector<DaemonRequest*> batch;
+        vector<string> replies;     // Replies that need no framing, by batch index
+        string line, bytes;
+        while (parseRequest(connection, &line, &bytes)) {
+            DaemonRequest* request = new DaemonRequest;
+            request->_connection = &connection;
+            request->_start = chrono::steady_clock::now();
+            batch.push_back(request);
+            replies.push_back("");
+            if (line == "QUIT") {
+                open = false;
+                replies.back() = "BYE\n";
+                break;
+            }
+            else if (line == "STATS") {
+                replies.back() = statsLine();
+                continue;
+            }
+            // Images are read and decoded on the framing workers
+            else if (line.compare(0, 6, "FRAME ") == 0) {
+                if (!submitFramingFile(daemon_state._async, line.substr(6), (long)request, false))
+                    request->_error = "Shutting down";
+            }
+            else if (line.compare(0, 11, "FRAMEBYTES ") == 0) {
+                request->_bytes.swap(bytes);
+                if (atol(line.c_str() + 11) > MAX_IMAGE_BYTES) {
+                    // The image bytes were not consumed so the stream cannot be resynchronized
+                    request->_error = "Image too large";
+                    open = false;
+                }
+                else if (request->_bytes.size() == 0)
+                    request->_error = "Could not decode image";
+                else if (!submitFramingBytes(daemon_state._async, request->_bytes.data(), (long)request->_bytes.size(), (long)request, false))
+                    request->_error = "Shutting down";
+            }
+            else {
+                request->_error = "Unknown request '" + line + "'";
+            }
+            if (request->_error.size() > 0)
+                replies.back() = resultLine(*request);
+            bytes.clear();
+            if (!open)
+                break;
+        }
+
+        string out;
+        for (int i = 0; i < (int)batch.size(); i++) {
+            DaemonRequest* request = batch[i];
+            if (replies[i].size() == 0) {
+                unique_lock<mutex> guard(connection._lock);
+                connection._done.wait(guard, [request] { return request->_done; });
+                guard.unlock();
+                replies[i] = resultLine(*request);
+                double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - request->_start).count();
+                daemon_state._stats.add(ms, request->_completion._result._ok);
+            }
+            else if (replies[i].compare(0, 4, "ERR ") == 0) {
+                daemon_state._stats.addError();
+            }
+            out += replies[i];
+            delete request;
+        }
+        if (out.size() > 0 && !writeAll(fd, out))
+            open = false;
+    }
+    {
+        lock_guard<mutex> guard(daemon_state._connections_lock);
+        vector<int>& fds = daemon_state._connection_fds;
+        fds.erase(find(fds.begin(), fds.end(), fd));
+        close(fd);
+    }
+    daemon_state._connections_done.notify_all();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc <= 1) {
+        cerr << "Usage: framing_daemon <socket path> [cascade path] [num workers] [queue depth] [strategy file]" << endl;
+        return 1;
+    }
+    string socket_path  = argv[1];
+    string cascade_path = argc > 2 ? argv[2] : "haarcascade_frontalface_alt2.xml";
+    AsyncFramingParams params;
+    params._num_workers = argc > 3 ? atoi(argv[3]) : 0;
+    params._queue_depth = argc > 4 ? atoi(argv[4]) : 256;
+    params._callback = requestDone;
+
+    string error;
+    daemon_state._context = createFramingContext(cascade_path, &error);
+    if (!daemon_state._context) {
+        cerr << error << endl;
+        return 1;
+    }
+    SearchStrategy strategy;
+    if (argc > 5 && !readStrategyFile(strategy, argv[5], &error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    setFramingStrategy(daemon_state._context, strategy);
+    daemon_state._async = createAsyncFraming(daemon_state._context, params);
+
+    signal(SIGPIPE, SIG_IGN);
+    if (pipe(stop_pipe) < 0) {
+        cerr << "pipe: " << strerror(errno) << endl;
+        return 1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGTERM, &action, 0);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        cerr << "socket: " << strerror(errno) << endl;
+        return 1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        cerr << "Socket path too long '" << socket_path << "'" << endl;
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+    // Owner only from the moment the socket exists
+    mode_t old_mask = umask(0177);
+    int bound = bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound < 0 || listen(listen_fd, 64) < 0) {
+        cerr << "Could not listen on '" << socket_path << "': " << strerror(errno) << endl;
+        return 1;
+    }
+    cout << "framing_daemon listening on " << socket_path << ", strategy " << strategyAsString(strategy) << endl;
+
+    while (true) {
+        struct pollfd fds[2];
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = stop_pipe[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            cerr << "poll: " << strerror(errno) << endl;
+            break;
+        }
+        if (fds[1].revents)
+            break;
+        if (!fds[0].revents)
+            continue;
+        int fd = accept(listen_fd, 0, 0);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            cerr << "accept: " << strerror(errno) << endl;
+            break;
+        }
+        {
+            lock_guard<mutex> guard(daemon_state._connections_lock);
+            daemon_state._connection_fds.push_back(fd);
+        }
+        thread(serveConnection, fd).detach();
+    }
+    cout << "framing_daemon shutting down" << endl;
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    // Connections see EOF after the requests they have already sent and exit.
+    // They use the AsyncFraming so must be gone before it is released
+    {
+        unique_lock<mutex> guard(daemon_state._connections_lock);
+        for (int i = 0; i < (int)daemon_state._connection_fds.size(); i++)
+            shutdown(daemon_state._connection_fds[i], SHUT_RD);
+        daemon_state._connections_done.wait(guard, [] { return daemon_state._connection_fds.empty(); });
+    }
+    releaseAsyncFraming(&daemon_state._async);
+    releaseFramingContext(&daemon_state._context);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    return 0;
+}
@@ -0,0 +1,305 @@
+/*
+ *  framing_eval.cpp
+ *  FaceTracker
+ *
+ *  End to end benchmark of the framing pipeline on a labelled data set.
+ *
+ *  Runs every image in a files_list_verbose.csv style list through the full
+ *  pipeline (load, scale, straighten, crop, search) once per search
+ *  strategy and reports, per strategy
+ *      throughput in images/sec
+ *      per image latency percentiles
+ *      detect calls per image
+ *      distribution of the center and radius errors against the ground
+ *      truth FACE_CENTER_X/Y and FACE_RADIUS, relative to the true radius
+ *
+ *  so that a faster search can be checked for lost framing accuracy.
+ *
+ *      framing_eval [--threads <n>] [--cascade <name>] [--csv <per image file>]
+ *                   [search options] <files list> [<image dir>] [--compare <strategy file> ...]
+ *
+ *  The search options set the base strategy. Each --compare file is read on
+ *  top of the base strategy and evaluated as another strategy.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include "config.h"
+#include "face_common.h"
+#include "face_util.h"
+#include "face_io.h"
+#include "file_list.h"
+#include "face_calc.h"
+#include "work_pool.h"
+#include "shared_cascade.h"
+#include "face_detect.h"
+
+using namespace std;
+
+/*
+ *  Result of framing one image with one strategy
+ */
+struct EvalImageResult {
+    bool    _found;
+    bool    _degraded;
+    double  _ms;
+    int     _detect_calls;
+    double  _center_error;      // (center distance)/(true radius). Only if _found
+    double  _radius_error;      // |radius - true radius|/(true radius). Only if _found
+    EvalImageResult(): _found(false), _degraded(false), _ms(0.0), _detect_calls(0), _center_error(0.0), _radius_error(0.0) {}
+};
+
+struct EvalContext {
+    const vector<FileEntry>*    _entries;
+    vector<DetectorState>       _workers;
+    vector<EvalImageResult>     _results;
+};
+
+static void evaluateImage(void* context, int worker, int item) {
+    EvalContext* ec = (EvalContext*)context;
+    const FileEntry& entry = (*ec->_entries)[item];
+    DetectorState& dp = ec->_workers[worker];
+    EvalImageResult& r = ec->_results[item];
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    int num_detect_calls = dp._num_detect_calls;
+    IplImage* image = cvLoadImage(entry._image_name.c_str());
+    if (!image) {
+        cerr << "Could not find '" << entry._image_name << "'" << endl;
+        abort();
+    }
+    string frame_error;
+    bool have_frame = setCurrentFrame(dp, image, entry, &frame_error);
+    cvReleaseImage(&image);
+    if (!have_frame) {
+        cerr << "'" << entry._image_name << "': " << frame_error << endl;
+        abort();
+    }
+    PwRect best_face = findBestFace(dp);
+    releaseCurrentFrame(dp);
+    r._ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+    r._detect_calls = dp._num_detect_calls - num_detect_calls;
+    r._degraded = dp._degraded;
+
+    r._found = !isEmptyRect(best_face) && entry._face_radius > 0;
+    if (r._found) {
+        // Ground truth is in scaled image coordinates
+        PwRect  face = offsetRectByRect(best_face, dp._cropped_size);
+        PwPoint center = getCenter(face);
+        double  radius = (double)entry._face_radius;
+        r._center_error = hypot((double)(center.x - entry._face_center.x), (double)(center.y - entry._face_center.y))/radius;
+        r._radius_error = fabs((double)getRadius(face) - radius)/radius;
+    }
+}
+
+/*
+ *  Run strategy over all entries. Returns the wall clock seconds taken
+ */
+static double evaluateStrategy(const SearchStrategy& strategy, const SharedCascade& shared, int num_threads,
+                               const vector<FileEntry>& entries, vector<EvalImageResult>* results) {
+    EvalContext ec;
+    ec._entries = &entries;
+    ec._workers.resize(min(num_threads, max((int)entries.size(), 1)));
+    for (int i = 0; i < (int)ec._workers.size(); i++) {
+        initDetectorState(ec._workers[i], shared);
+        ec._workers[i]._strategy = strategy;
+    }
+    ec._results.resize(entries.size());
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    runWorkStealing((int)entries.size(), (int)ec._workers.size(), evaluateImage, (void*)&ec);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    for (int i = 0; i < (int)ec._workers.size(); i++)
+        releaseDetectorState(ec._workers[i]);
+    *results = ec._results;
+    return seconds;
+}
+
+/*
+ *  Summary of one strategy over the data set
+ */
+struct EvalSummary {
+    string  _strategy;
+    int     _num_images;
+    int     _num_found;
+    int     _num_degraded;
+    double  _seconds;
+    double  _mean_detect_calls;
+    vector<double> _ms;             // Sorted
+    vector<double> _center_errors;  // Sorted, found images only
+    vector<double> _radius_errors;
+};
+
+static EvalSummary summarize(const string strategy_name, const vector<EvalImageResult>& results, double seconds) {
+    EvalSummary s;
+    s._strategy = strategy_name;
+    s._num_images = (int)results.size();
+    s._num_found = 0;
+    s._num_degraded = 0;
+    s._seconds = seconds;
+    long calls = 0;
+    for (int i = 0; i < (int)results.size(); i++) {
+        const EvalImageResult& r = results[i];
+        s._ms.push_back(r._ms);
+        calls += r._detect_calls;
+        s._num_degraded += r._degraded ? 1 : 0;
+        if (r._found) {
+            s._num_found++;
+            s._center_errors.push_back(r._center_error);
+            s._radius_errors.push_back(r._radius_error);
+        }
+    }
+    sort(s._ms.begin(), s._ms.end());
+    sort(s._center_errors.begin(), s._center_errors.end());
+    sort(s._radius_errors.begin(), s._radius_errors.end());
+    s._mean_detect_calls = results.size() > 0 ? (double)calls/(double)results.size() : 0.0;
+    return s;
+}
+
+static void showSummaryHeader(ostream& out) {
+    out << "STRATEGY, IMAGES, FOUND, DEGRADED, IMAGES_PER_SEC, P50_MS, P90_MS, P99_MS, MAX_MS, DETECT_CALLS_PER_IMAGE, "
+        << "CENTER_ERR_P50, CENTER_ERR_P90, CENTER_ERR_MAX, RADIUS_ERR_P50, RADIUS_ERR_P90, RADIUS_ERR_MAX" << endl;
+}
+
+static void showSummary(const EvalSummary& s, ostream& out) {
+    out << s._strategy << ", " << s._num_images << ", " << s._num_found << ", " << s._num_degraded << ", "
+        << fixed << setprecision(2) << (s._seconds > 0.0 ? (double)s._num_images/s._seconds : 0.0) << ", "
+        << setprecision(1)
+        << percentile(s._ms, 0.50) << ", " << percentile(s._ms, 0.90) << ", " << percentile(s._ms, 0.99) << ", "
+        << (s._ms.size() > 0 ? s._ms.back() : 0.0) << ", "
+        << setprecision(2) << s._mean_detect_calls << ", "
+        << setprecision(3)
+        << percentile(s._center_errors, 0.50) << ", " << percentile(s._center_errors, 0.90) << ", "
+        << (s._center_errors.size() > 0 ? s._center_errors.back() : 0.0) << ", "
+        << percentile(s._radius_errors, 0.50) << ", " << percentile(s._radius_errors, 0.90) << ", "
+        << (s._radius_errors.size() > 0 ? s._radius_errors.back() : 0.0) << endl;
+}
+
+/*
+ *  Fraction of all images with center error at most each threshold.
+ *  Images with no face found count as over every threshold
+ */
+static void showErrorDistribution(const EvalSummary& s, ostream& out) {
+    static const double thresholds[] = { 0.05, 0.1, 0.2, 0.3, 0.5, 1.0 };
+    out << s._strategy << " center error <=";
+    for (int i = 0; i < (int)(sizeof(thresholds)/sizeof(thresholds[0])); i++) {
+        int n = (int)(upper_bound(s._center_errors.begin(), s._center_errors.end(), thresholds[i]) - s._center_errors.begin());
+        out << "  " << fixed << setprecision(2) << thresholds[i] << ": " << setprecision(3)
+            << (s._num_images > 0 ? (double)n/(double)s._num_images : 0.0);
+    }
+    out << endl;
+}
+
+static void showImageResults(const string strategy_name, const vector<FileEntry>& entries,
+                             const vector<EvalImageResult>& results, ostream& out) {
+    for (int i = 0; i < (int)results.size(); i++) {
+        const EvalImageResult& r = results[i];
+        out << strategy_name << ", " << entries[i]._image_name << ", "
+            << fixed << setprecision(3) << r._ms << ", " << r._detect_calls << ", "
+            << (r._found ? 1 : 0) << ", " << (r._degraded ? 1 : 0) << ", "
+            << r._center_error << ", " << r._radius_error << endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    SearchStrategy base;
+    vector<string> compare_files;
+    string list_path, image_dir, csv_path;
+    string cascade_name = "haarcascade_frontalface_alt2";
+    int num_threads = 1;
+    for (int arg = 1; arg < argc; ) {
+        string error;
+        int parsed = parseStrategyArg(base, argc, argv, &arg, &error);
+        if (parsed < 0) {
+            cerr << error << endl;
+            return 1;
+        }
+        if (parsed > 0)
+            continue;
+        string option = argv[arg];
+        if (option == "--threads" && arg + 1 < argc)
+            num_threads = atoi(argv[++arg]);
+        else if (option == "--cascade" && arg + 1 < argc)
+            cascade_name = argv[++arg];
+        else if (option == "--csv" && arg + 1 < argc)
+            csv_path = argv[++arg];
+        else if (option == "--compare" && arg + 1 < argc)
+            compare_files.push_back(argv[++arg]);
+        else if (option.compare(0, 2, "--") != 0 && list_path.size() == 0)
+            list_path = option;
+        else if (option.compare(0, 2, "--") != 0 && image_dir.size() == 0)
+            image_dir = option;
+        else {
+            cerr << "Usage: framing_eval [--threads <n>] [--cascade <name>] [--csv <per image file>]" << endl;
+            cerr << "                    [search options] <files list> [<image dir>] [--compare <strategy file> ...]" << endl;
+            return 1;
+        }
+        arg++;
+    }
+    if (list_path.size() == 0) {
+        cerr << "No files list given" << endl;
+        return 1;
+    }
+    if (num_threads <= 0)
+        num_threads = getNumCores();
+
+    vector<SearchStrategy> strategies(1, base);
+    for (int i = 0; i < (int)compare_files.size(); i++) {
+        SearchStrategy strategy = base;
+        string error;
+        if (!readStrategyFile(strategy, compare_files[i], &error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        strategies.push_back(strategy);
+    }
+
+    vector<FileEntry> entries;
+    string list_error;
+    if (!readFileEntries(list_path, image_dir, &entries, &list_error)) {
+        cerr << list_error << endl;
+        return 1;
+    }
+    if (entries.size() == 0) {
+        cerr << "No images in '" << list_path << "'" << endl;
+        return 1;
+    }
+    SharedCascade shared;
+    if (!loadSharedCascade(shared, cascade_name + ".xml", cascade_name)) {
+        cerr << "Could not load cascade '" << cascade_name << ".xml'" << endl;
+        return 1;
+    }
+    ofstream csv_file;
+    if (csv_path.size() > 0) {
+        csv_file.open(csv_path.c_str());
+        csv_file << "STRATEGY, IMAGE, MS, DETECT_CALLS, FOUND, DEGRADED, CENTER_ERR, RADIUS_ERR" << endl;
+    }
+
+    vector<EvalSummary> summaries;
+    for (int i = 0; i < (int)strategies.size(); i++) {
+        string name = strategyAsString(strategies[i]);
+        cout << "--------------------- " << name << " -----------------" << endl;
+        vector<EvalImageResult> results;
+        double seconds = evaluateStrategy(strategies[i], shared, num_threads, entries, &results);
+        summaries.push_back(summarize(name, results, seconds));
+        if (csv_file.is_open())
+            showImageResults(name, entries, results, csv_file);
+    }
+    releaseSharedCascade(shared);
+
+    cout << "================ " << entries.size() << " images, " << num_threads << " threads ==============" << endl;
+    showSummaryHeader(cout);
+    for (int i = 0; i < (int)summaries.size(); i++)
+        showSummary(summaries[i], cout);
+    for (int i = 0; i < (int)summaries.size(); i++)
+        showErrorDistribution(summaries[i], cout);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ *  framing_filter.cpp
+ *  FaceTracker
+ *
+ *  In-process face framing library
+ */
+
+#include <mutex>
+#include <vector>
+#include "framing_filter.h"
+#include "face_detect.h"
+#include "face_calc.h"
+#include "core_opencv.h"
+#include "pipeline_trace.h"
+
+using namespace std;
+
+/*
+ *  DetectorStates are created on demand, one per concurrent caller, and kept
+ *  in _free_states between calls
+ */
+struct FramingContext {
+    SharedCascade           _shared;
+    mutex                   _lock;
+    vector<DetectorState*>  _all_states;
+    vector<DetectorState*>  _free_states;
+    SearchStrategy          _strategy;
+};
+
+FramingContext* createFramingContext(const string cascade_path, string* error) {
+    FramingContext* context = new FramingContext;
+    if (!loadSharedCascade(context->_shared, cascade_path, cascade_path)) {
+        if (error)
+            *error = "Could not load cascade '" + cascade_path + "'";
+        delete context;
+        return 0;
+    }
+    return context;
+}
+
+void releaseFramingContext(FramingContext** context) {
+    if (*context) {
+        for (int i = 0; i < (int)(*context)->_all_states.size(); i++) {
+            releaseDetectorState(*(*context)->_all_states[i]);
+            delete (*context)->_all_states[i];
+        }
+        releaseSharedCascade((*context)->_shared);
+        delete *context;
+        *context = 0;
+    }
+}
+
+void setFramingStrategy(FramingContext* context, const SearchStrategy& strategy) {
+    lock_guard<mutex> guard(context->_lock);
+    context->_strategy = strategy;
+}
+
+static DetectorState* acquireDetectorState(FramingContext* context) {
+    lock_guard<mutex> guard(context->_lock);
+    DetectorState* dp;
+    if (context->_free_states.size() > 0) {
+        dp = context->_free_states.back();
+        context->_free_states.pop_back();
+    }
+    else {
+        dp = new DetectorState;
+        initDetectorState(*dp, context->_shared);
+        context->_all_states.push_back(dp);
+    }
+    dp->_strategy = context->_strategy;
+    return dp;
+}
+
+static void returnDetectorState(FramingContext* context, DetectorState* dp) {
+    // Face lists from this call are no longer needed
+    cvClearMemStorage(dp->_storage);
+    lock_guard<mutex> guard(context->_lock);
+    context->_free_states.push_back(dp);
+}
+
+FramingResult framingFilter(FramingContext* context, const IplImage* image, bool want_framed_image) {
+    FramingResult result;
+    if (!context) {
+        result._error = "No framing context";
+        return result;
+    }
+    TRACE_SPAN("image", "image");
+    if (!image || image->width <= 0 || image->height <= 0) {
+        result._error = "Empty image";
+        return result;
+    }
+    if (image->depth != IPL_DEPTH_8U || (image->nChannels != 1 && image->nChannels != 3)) {
+        result._error = "Image must be 8 bit gray or BGR";
+        return result;
+    }
+
+    // The detector works on BGR images
+    const IplImage* color_image = image;
+    IplImage* converted_image = 0;
+    if (image->nChannels == 1) {
+        converted_image = cvCreateImage(cvSize(image->width, image->height), IPL_DEPTH_8U, 3);
+        cvCvtColor(image, converted_image, CV_GRAY2BGR);
+        color_image = converted_image;
+    }
+    
+    DetectorState* dp = acquireDetectorState(context);
+    dp->_memory.startImage();
+    if (!setCurrentFrame(*dp, color_image, FileEntry(), &result._error)) {
+        returnDetectorState(context, dp);
+        if (converted_image)
+            cvReleaseImage(&converted_image);
+        return result;
+    }
+    PwRect best_face = findBestFace(*dp);
+    releaseCurrentFrame(*dp);
+    PwRect scaled_size = dp->_scaled_size;
+    PwRect cropped_size = dp->_cropped_size;
+    result._degraded = dp->_degraded;
+    returnDetectorState(context, dp);
+
+    result._ok = true;
+    result._found = !isEmptyRect(best_face);
+    if (result._found)
+        result._face_rect = unscaleRect(offsetRectByRect(best_face, cropped_size), scaled_size, PwRect(0, 0, image->width, image->height));
+    else
+        result._face_rect = PwRect(0, 0, image->width, image->height);
+    result._face_center = getCenter(result._face_rect);
+    result._face_radius = getRadius(result._face_rect);
+    if (want_framed_image) {
+        TRACE_SPAN("framed_image", "image");
+        result._framed_image = cropImage(color_image, result._face_rect);
+    }
+
+    if (converted_image)
+        cvReleaseImage(&converted_image);
+    return result;
+}
+
+IplImage* peter_framing_filter(FramingContext* context, const IplImage* image) {
+    FramingResult result = framingFilter(context, image, true);
+    return result._framed_image;
+}
@@ -0,0 +1,62 @@
+#ifndef FRAMING_FILTER_H
+#define FRAMING_FILTER_H
+/*
+ *  framing_filter.h
+ *  FaceTracker
+ *
+ *  In-process face framing library. 
+ *
+ *  A FramingContext holds the loaded cascade and a pool of DetectorStates.
+ *  It is created once and then framingFilter() can be called on it from any
+ *  number of threads at once. Nothing in here aborts or reads files other
+ *  than the cascade. Errors are returned in FramingResult.
+ *
+ *      FramingContext* context = createFramingContext("haarcascade_frontalface_alt2.xml", &error);
+ *      IplImage* new_image = peter_framing_filter(context, image);
+ *      ...
+ *      releaseFramingContext(&context);
+ */
+
+#include <string>
+#include "config.h"
+#include "face_common.h"
+#include "search_strategy.h"
+
+struct FramingResult {
+    bool        _ok;            // false if the call failed. _error says why
+    std::string _error;
+    bool        _found;         // false if no face was found. Then _face_rect is the whole image
+    PwRect      _face_rect;     // In input image coordinates
+    PwPoint     _face_center;   
+    int         _face_radius;
+    IplImage*   _framed_image;  // Input image cropped to _face_rect if requested. Caller releases it
+    bool        _degraded;      // Search budget ran out. The face is the best found before that
+    FramingResult(): _ok(false), _found(false), _face_radius(0), _framed_image(0), _degraded(false) {}
+};
+
+struct FramingContext;
+
+/*
+ *  Returns 0 and sets *error if the cascade cannot be loaded
+ */
+FramingContext* createFramingContext(const std::string cascade_path, std::string* error);
+void releaseFramingContext(FramingContext** context);
+
+/*
+ *  Search settings, including the per image budget, for later 
+ *  framingFilter() calls. The default is SearchStrategy()
+ */
+void setFramingStrategy(FramingContext* context, const SearchStrategy& strategy);
+
+/*
+ *  Find the face in image. image is a single, roughly centred and upright
+ *  face with padding around it. 8 bit gray or BGR.
+ */
+FramingResult framingFilter(FramingContext* context, const IplImage* image, bool want_framed_image);
+
+/*
+ *  Returns image cropped to the face, or 0 on error. Caller releases it
+ */
+IplImage* peter_framing_filter(FramingContext* context, const IplImage* image);
+
+#endif // #ifndef FRAMING_FILTER_H
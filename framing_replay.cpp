@@ -0,0 +1,316 @@
+/*
+ *  framing_replay.cpp
+ *  FaceTracker
+ *
+ *  Record detector answers for a data set once, then try search strategies
+ *  on the recordings without running the detector.
+ *
+ *      framing_replay record [--threads <n>] [--cascade <name>] [--grid-scale <s>] [--grid-step <f>] [--grid-min <pixels>]
+ *                            [search options] <files list> <image dir> <detect log>
+ *      framing_replay simulate [--csv <per image file>] [search options] <detect log> [--compare <strategy file> ...]
+ *
+ *  record runs the detector on a dense grid of rects in every image (see
+ *  detection_log.h) with the detector settings of the search options.
+ *  simulate runs the search options' strategy, and each --compare strategy
+ *  file on top of it, against the recordings and reports detect calls per
+ *  image, the face chosen and, where the list had one, its error against
+ *  the ground truth face.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include "config.h"
+#include "face_common.h"
+#include "face_util.h"
+#include "face_io.h"
+#include "file_list.h"
+#include "face_calc.h"
+#include "work_pool.h"
+#include "shared_cascade.h"
+#include "face_detect.h"
+#include "detection_log.h"
+
+using namespace std;
+
+/*
+ *  Recording
+ */
+struct RecordContext {
+    const vector<FileEntry>*    _entries;
+    DetectGridParams            _grid;
+    vector<DetectorState>       _workers;
+    vector<ImageDetectLog>      _logs;
+    mutex                       _output_lock;   // Progress lines from the workers
+};
+
+static void recordImage(void* context, int worker, int item) {
+    RecordContext* rc = (RecordContext*)context;
+    const FileEntry& entry = (*rc->_entries)[item];
+    DetectorState& dp = rc->_workers[worker];
+    IplImage* image = cvLoadImage(entry._image_name.c_str());
+    if (!image) {
+        cerr << "Could not find '" << entry._image_name << "'" << endl;
+        abort();
+    }
+    string frame_error;
+    bool have_frame = setCurrentFrame(dp, image, entry, &frame_error);
+    cvReleaseImage(&image);
+    if (!have_frame) {
+        cerr << "'" << entry._image_name << "': " << frame_error << endl;
+        abort();
+    }
+    recordDetectGrid(dp, entry, rc->_grid, &rc->_logs[item]);
+    releaseCurrentFrame(dp);
+    lock_guard<mutex> guard(rc->_output_lock);
+    cout << entry._image_name << ": " << rc->_logs[item]._detects.size() << " rects" << endl;
+}
+
+static int recordDetections(const SearchStrategy& strategy, const DetectGridParams& grid, int num_threads, const string cascade_name,
+                            const string list_path, const string image_dir, const string log_path) {
+    vector<FileEntry> entries;
+    string list_error;
+    if (!readFileEntries(list_path, image_dir, &entries, &list_error)) {
+        cerr << list_error << endl;
+        return 1;
+    }
+    if (entries.size() == 0) {
+        cerr << "No images in '" << list_path << "'" << endl;
+        return 1;
+    }
+    ofstream out(log_path.c_str());
+    if (!out) {
+        cerr << "Could not write '" << log_path << "'" << endl;
+        return 1;
+    }
+    SharedCascade shared;
+    if (!loadSharedCascade(shared, cascade_name + ".xml", cascade_name)) {
+        cerr << "Could not load cascade '" << cascade_name << ".xml'" << endl;
+        return 1;
+    }
+    RecordContext rc;
+    rc._entries = &entries;
+    rc._grid = grid;
+    rc._workers.resize(min(num_threads, (int)entries.size()));
+    for (int i = 0; i < (int)rc._workers.size(); i++) {
+        initDetectorState(rc._workers[i], shared);
+        rc._workers[i]._strategy = strategy;
+        // Every grid rect must be detected
+        rc._workers[i]._strategy._budget = SearchBudget();
+    }
+    rc._logs.resize(entries.size());
+    runWorkStealing((int)entries.size(), (int)rc._workers.size(), recordImage, (void*)&rc);
+    for (int i = 0; i < (int)rc._workers.size(); i++)
+        releaseDetectorState(rc._workers[i]);
+    releaseSharedCascade(shared);
+
+    writeDetectLogHeader(strategy, grid, out);
+    for (int i = 0; i < (int)rc._logs.size(); i++)
+        writeImageDetectLog(rc._logs[i], out);
+    return out ? 0 : 1;
+}
+
+/*
+ *  Simulation
+ */
+struct SimImageResult {
+    int     _detect_calls;
+    PwRect  _face;              // In scaled image coordinates. EMPTY_RECT if none found
+    bool    _scored;            // Found and there is a ground truth face
+    double  _center_error;      // Relative to the true radius. Only if _scored
+    double  _radius_error;
+};
+
+static SimImageResult simulateImage(DetectorState& dp, const ImageDetectLog& log) {
+    SimImageResult r;
+    int num_detect_calls = dp._num_detect_calls;
+    setReplayFrame(dp, log);
+    PwRect best_face = findBestFace(dp);
+    releaseReplayFrame(dp);
+    r._detect_calls = dp._num_detect_calls - num_detect_calls;
+    r._face = isEmptyRect(best_face) ? EMPTY_RECT : offsetRectByRect(best_face, log._cropped_size);
+    r._scored = !isEmptyRect(best_face) && log._face_radius > 0;
+    r._center_error = 0.0;
+    r._radius_error = 0.0;
+    if (r._scored) {
+        PwPoint center = getCenter(r._face);
+        double  radius = (double)log._face_radius;
+        r._center_error = hypot((double)(center.x - log._face_center.x), (double)(center.y - log._face_center.y))/radius;
+        r._radius_error = fabs((double)getRadius(r._face) - radius)/radius;
+    }
+    return r;
+}
+
+static void showSimulationHeader(ostream& out) {
+    out << "STRATEGY, IMAGES, FOUND, DETECT_CALLS_PER_IMAGE, CALLS_P50, CALLS_P90, CALLS_MAX, "
+        << "CENTER_ERR_P50, CENTER_ERR_P90, RADIUS_ERR_P50, RADIUS_ERR_P90, SIM_MS" << endl;
+}
+
+static void showSimulation(const string name, const vector<SimImageResult>& results, double ms, ostream& out) {
+    vector<double> calls, center_errors, radius_errors;
+    int num_found = 0;
+    long total_calls = 0;
+    for (int i = 0; i < (int)results.size(); i++) {
+        const SimImageResult& r = results[i];
+        calls.push_back((double)r._detect_calls);
+        total_calls += r._detect_calls;
+        num_found += isEmptyRect(r._face) ? 0 : 1;
+        if (r._scored) {
+            center_errors.push_back(r._center_error);
+            radius_errors.push_back(r._radius_error);
+        }
+    }
+    sort(calls.begin(), calls.end());
+    sort(center_errors.begin(), center_errors.end());
+    sort(radius_errors.begin(), radius_errors.end());
+    out << name << ", " << results.size() << ", " << num_found << ", "
+        << fixed << setprecision(2) << (results.size() > 0 ? (double)total_calls/(double)results.size() : 0.0) << ", "
+        << setprecision(0) << percentile(calls, 0.50) << ", " << percentile(calls, 0.90) << ", "
+        << (calls.size() > 0 ? calls.back() : 0.0) << ", "
+        << setprecision(3) << percentile(center_errors, 0.50) << ", " << percentile(center_errors, 0.90) << ", "
+        << percentile(radius_errors, 0.50) << ", " << percentile(radius_errors, 0.90) << ", "
+        << setprecision(1) << ms << endl;
+}
+
+/*
+ *  Does strategy run the detector the way the recording did. The log keeps
+ *  9 digits of scale_factor
+ */
+static bool sameDetectorSettings(const SearchStrategy& strategy, const DetectLogSettings& recorded) {
+    if (strategy._hardwire_haar_settings != recorded._hardwire_haar_settings)
+        return false;
+    return strategy._hardwire_haar_settings || 
+        (fabs(strategy._scale_factor - recorded._scale_factor) < 1e-6 && strategy._min_neighbors == recorded._min_neighbors);
+}
+
+static int simulateStrategies(const vector<SearchStrategy>& strategies, const string log_path, const string csv_path) {
+    DetectLogSettings recorded;
+    vector<ImageDetectLog> logs;
+    string error;
+    if (!readDetectLog(log_path, &recorded, &logs, &error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    cout << logs.size() << " images recorded with " << recorded._strategy << endl;
+    if (!recorded._has_detector)
+        cerr << "Warning: " << log_path << " does not say which detector settings it was recorded with" << endl;
+    ofstream csv_file;
+    if (csv_path.size() > 0) {
+        csv_file.open(csv_path.c_str());
+        csv_file << "STRATEGY, IMAGE, DETECT_CALLS, FACE_X, FACE_Y, FACE_WIDTH, FACE_HEIGHT, CENTER_ERR, RADIUS_ERR" << endl;
+    }
+
+    // No cascade is needed. detectFacesCrop() answers from the recordings
+    vector<vector<SimImageResult> > all_results;
+    vector<double> all_ms;
+    for (int s = 0; s < (int)strategies.size(); s++) {
+        DetectorState dp;
+        dp._strategy = strategies[s];
+        if (recorded._has_detector && !sameDetectorSettings(strategies[s], recorded))
+            cerr << "Warning: " << strategyAsString(strategies[s]) << " changes detector settings. The recorded answers are used" << endl;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        vector<SimImageResult> results;
+        for (int i = 0; i < (int)logs.size(); i++)
+            results.push_back(simulateImage(dp, logs[i]));
+        all_ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+        all_results.push_back(results);
+        if (csv_file.is_open()) {
+            string name = strategyAsString(strategies[s]);
+            for (int i = 0; i < (int)results.size(); i++) {
+                const SimImageResult& r = results[i];
+                csv_file << name << ", " << logs[i]._image_name << ", " << r._detect_calls << ", "
+                         << r._face.x << ", " << r._face.y << ", " << r._face.width << ", " << r._face.height << ", "
+                         << fixed << setprecision(3) << r._center_error << ", " << r._radius_error << endl;
+            }
+        }
+    }
+    showSimulationHeader(cout);
+    for (int s = 0; s < (int)strategies.size(); s++)
+        showSimulation(strategyAsString(strategies[s]), all_results[s], all_ms[s], cout);
+    return 0;
+}
+
+static void showUsage() {
+    cerr << "Usage: framing_replay record [--threads <n>] [--cascade <name>] [--grid-scale <s>] [--grid-step <f>] [--grid-min <pixels>]" << endl;
+    cerr << "                             [search options] <files list> <image dir> <detect log>" << endl;
+    cerr << "       framing_replay simulate [--csv <per image file>] [search options] <detect log> [--compare <strategy file> ...]" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || (string(argv[1]) != "record" && string(argv[1]) != "simulate")) {
+        showUsage();
+        return 1;
+    }
+    bool record = string(argv[1]) == "record";
+    SearchStrategy base;
+    DetectGridParams grid;
+    vector<string> compare_files, paths;
+    string cascade_name = "haarcascade_frontalface_alt2";
+    string csv_path;
+    int num_threads = 0;
+    for (int arg = 2; arg < argc; ) {
+        string error;
+        int parsed = parseStrategyArg(base, argc, argv, &arg, &error);
+        if (parsed < 0) {
+            cerr << error << endl;
+            return 1;
+        }
+        if (parsed > 0)
+            continue;
+        string option = argv[arg];
+        if (option == "--threads" && arg + 1 < argc)
+            num_threads = atoi(argv[++arg]);
+        else if (option == "--cascade" && arg + 1 < argc)
+            cascade_name = argv[++arg];
+        else if (option == "--grid-scale" && arg + 1 < argc)
+            grid._scale_step = atof(argv[++arg]);
+        else if (option == "--grid-step" && arg + 1 < argc)
+            grid._position_step = atof(argv[++arg]);
+        else if (option == "--grid-min" && arg + 1 < argc)
+            grid._min_size = atoi(argv[++arg]);
+        else if (option == "--csv" && arg + 1 < argc)
+            csv_path = argv[++arg];
+        else if (option == "--compare" && arg + 1 < argc)
+            compare_files.push_back(argv[++arg]);
+        else if (option.compare(0, 2, "--") != 0)
+            paths.push_back(option);
+        else {
+            showUsage();
+            return 1;
+        }
+        arg++;
+    }
+    if (num_threads <= 0)
+        num_threads = getNumCores();
+
+    if (record) {
+        if (paths.size() != 3 || grid._scale_step <= 0.0 || grid._scale_step >= 1.0 || grid._position_step <= 0.0) {
+            showUsage();
+            return 1;
+        }
+        return recordDetections(base, grid, num_threads, cascade_name, paths[0], paths[1], paths[2]);
+    }
+
+    if (paths.size() != 1) {
+        showUsage();
+        return 1;
+    }
+    vector<SearchStrategy> strategies(1, base);
+    for (int i = 0; i < (int)compare_files.size(); i++) {
+        SearchStrategy strategy = base;
+        string error;
+        if (!readStrategyFile(strategy, compare_files[i], &error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        strategies.push_back(strategy);
+    }
+    return simulateStrategies(strategies, paths[0], csv_path);
+}
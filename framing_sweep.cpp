@@ -0,0 +1,114 @@
+/*
+ *  framing_sweep.cpp
+ *  FaceTracker
+ *
+ *  Tools for the binary sweep results written by peter_framing_filter --sweep
+ *  in a TEST_MANY_SETTINGS build.
+ *
+ *      framing_sweep csv <sweep file> [<csv file>]
+ *      framing_sweep summary <sweep file>
+ *
+ *  csv converts the sweep to CSV, one line per row, on stdout if no csv 
+ *  file is given. summary aggregates over images for each (cascade, 
+ *  min_neighbors, scale_factor) setting: the fraction of images where a 
+ *  face was found and, over images with a ground truth face, the mean and
+ *  worst distance of the face found from it in ground truth radii.
+ */
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "config.h"
+#include "results_writer.h"
+#include "sweep_results.h"
+
+using namespace std;
+
+struct SettingSummary {
+    long    _num_rows;
+    long    _num_found;
+    long    _num_scored;        // Found and the image has a ground truth face
+    double  _sum_center_error;
+    double  _max_center_error;
+    SettingSummary(): _num_rows(0), _num_found(0), _num_scored(0), _sum_center_error(0.0), _max_center_error(0.0) {}
+};
+
+typedef tuple<int, int, double> SettingKey;   // cascade, min_neighbors, scale_factor
+
+static void summarizeSweep(const SweepTable& table, ostream& out) {
+    map<SettingKey, SettingSummary> summaries;
+    for (int g = 0; g < (int)table._groups.size(); g++) {
+        const SweepGroup& group = table._groups[g];
+        for (int i = 0; i < group._num_rows; i++) {
+            SettingSummary& s = summaries[SettingKey(group._cascade[i], group._min_neighbors[i], group._scale_factor[i])];
+            s._num_rows++;
+            if (group._face_width[i] <= 0 || group._face_height[i] <= 0)
+                continue;
+            s._num_found++;
+            int image = group._image[i];
+            if (image < 0 || image >= (int)table._images.size() || table._images[image]._face_radius <= 0)
+                continue;
+            const SweepImage& truth = table._images[image];
+            double dx = group._face_x[i] + group._face_width[i]/2.0 - truth._face_center.x;
+            double dy = group._face_y[i] + group._face_height[i]/2.0 - truth._face_center.y;
+            double error = hypot(dx, dy)/truth._face_radius;
+            s._num_scored++;
+            s._sum_center_error += error;
+            s._max_center_error = max(s._max_center_error, error);
+        }
+    }
+    out << "cascade, min_neighbors, scale_factor, images, found, mean center error, max center error" << endl;
+    for (map<SettingKey, SettingSummary>::const_iterator it = summaries.begin(); it != summaries.end(); it++) {
+        int cascade = get<0>(it->first);
+        const SettingSummary& s = it->second;
+        out << ((cascade >= 0 && cascade < (int)table._cascades.size()) ? table._cascades[cascade] : "?") << ", "
+            << get<1>(it->first) << ", " << get<2>(it->first) << ", " << s._num_rows << ", " 
+            << fixed << setprecision(3) << (double)s._num_found/(double)s._num_rows << ", ";
+        if (s._num_scored > 0)
+            out << s._sum_center_error/s._num_scored << ", " << s._max_center_error;
+        else
+            out << ", ";
+        out << defaultfloat << setprecision(6) << endl;
+    }
+}
+
+static void showUsage() {
+    cerr << "Usage: framing_sweep csv <sweep file> [<csv file>]" << endl;
+    cerr << "       framing_sweep summary <sweep file>" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || (string(argv[1]) == "csv" && argc > 4) || (string(argv[1]) == "summary" && argc != 3)
+        || (string(argv[1]) != "csv" && string(argv[1]) != "summary")) {
+        showUsage();
+        return 1;
+    }
+    SweepTable table;
+    string error;
+    if (!readSweepTable(argv[2], &table, &error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    if (string(argv[1]) == "summary") {
+        summarizeSweep(table, cout);
+        return 0;
+    }
+    ResultsWriterParams params;
+    params._echo = false;
+    ResultsWriter* out = openResultsWriter(argc == 4 ? argv[3] : "", params, &error);
+    if (!out) {
+        cerr << error << endl;
+        return 1;
+    }
+    writeSweepCsvHeader(out);
+    writeSweepCsv(table, out);
+    if (!closeResultsWriter(&out, &error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    return 0;
+}
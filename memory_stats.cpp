@@ -0,0 +1,157 @@
+/*
+ *  memory_stats.cpp
+ *  FaceTracker
+ *
+ *  Image buffer, CvMemStorage and process memory accounting
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __APPLE__
+ #include <mach/mach.h>
+#endif
+#include "memory_stats.h"
+
+using namespace std;
+
+static const char* owner_names[NUM_IMAGE_OWNERS] = {
+    "INPUT", "SCALED", "ROTATED", "FRAME", "DETECT_CROP", "DETECT_GRAY", "DETECT_SMALL"
+};
+
+const char* getImageOwnerName(int owner) {
+    return owner >= 0 && owner < NUM_IMAGE_OWNERS ? owner_names[owner] : "?";
+}
+
+long getImageBytes(const IplImage* image) {
+    return image ? (long)image->imageSize : 0L;
+}
+
+long getStorageBytes(const CvMemStorage* storage) {
+    if (!storage)
+        return 0L;
+    long n = 0;
+    for (const CvMemBlock* block = storage->bottom; block; block = block->next)
+        n++;
+    return n * (long)storage->block_size;
+}
+
+long getProcessRssKb() {
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+        return 0L;
+    return (long)(info.resident_size/1024);
+#else
+    ifstream statm("/proc/self/statm");
+    long size = 0, resident = 0;
+    if (!(statm >> size >> resident))
+        return 0L;
+    return resident * (sysconf(_SC_PAGESIZE)/1024);
+#endif
+}
+
+long getProcessPeakRssKb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0L;
+#ifdef __APPLE__
+    return (long)(usage.ru_maxrss/1024);    // Bytes on OS X
+#else
+    return (long)usage.ru_maxrss;
+#endif
+}
+
+MemoryStats::MemoryStats(): _live_total(0), _peak_total(0), _start_live_total(0),
+    _storage_peak(0), _rss_kb(0), _peak_rss_kb(0) {
+    for (int i = 0; i < NUM_IMAGE_OWNERS; i++) {
+        _live[i] = 0;
+        _peak[i] = 0;
+    }
+}
+
+void MemoryStats::startImage() {
+    for (int i = 0; i < NUM_IMAGE_OWNERS; i++)
+        _peak[i] = _live[i];
+    _peak_total = _live_total;
+    _start_live_total = _live_total;
+    _storage_peak = 0;
+}
+
+void MemoryStats::add(ImageOwner owner, const IplImage* image) {
+    long bytes = getImageBytes(image);
+    _live[owner] += bytes;
+    _live_total += bytes;
+    _peak[owner] = max(_peak[owner], _live[owner]);
+    _peak_total = max(_peak_total, _live_total);
+}
+
+void MemoryStats::remove(ImageOwner owner, const IplImage* image) {
+    long bytes = getImageBytes(image);
+    _live[owner] -= bytes;
+    _live_total -= bytes;
+}
+
+void MemoryStats::sampleStorage(const CvMemStorage* storage) {
+    _storage_peak = max(_storage_peak, getStorageBytes(storage));
+}
+
+void MemoryStats::sampleProcess() {
+    _rss_kb = getProcessRssKb();
+    _peak_rss_kb = getProcessPeakRssKb();
+}
+
+bool MemoryBudget::isExceeded(const MemoryStats& stats) const {
+    if (_max_rss_mb > 0 && stats._peak_rss_kb > _max_rss_mb*1024L)
+        return true;
+    if (_max_image_mb > 0 && stats._peak_total > _max_image_mb*1024L*1024L)
+        return true;
+    return false;
+}
+
+void showMemoryHeader(ostream& out) {
+    out << "IMAGE";
+    for (int i = 0; i < NUM_IMAGE_OWNERS; i++)
+        out << ", " << owner_names[i] << "_BYTES";
+    out << ", PEAK_IMAGE_BYTES, STORAGE_BYTES, LEAKED_BYTES, RSS_KB, PEAK_RSS_KB" << endl;
+}
+
+void showMemoryStats(const string image_name, const MemoryStats& stats, ostream& out) {
+    out << image_name;
+    for (int i = 0; i < NUM_IMAGE_OWNERS; i++)
+        out << ", " << stats._peak[i];
+    out << ", " << stats._peak_total << ", " << stats._storage_peak << ", " << stats.getLeakedBytes()
+        << ", " << stats._rss_kb << ", " << stats._peak_rss_kb << endl;
+}
+
+void MemorySummary::add(const MemoryStats& stats, const MemoryBudget& budget) {
+    for (int j = 0; j < NUM_IMAGE_OWNERS; j++)
+        _most._peak[j] = max(_most._peak[j], stats._peak[j]);
+    _most._peak_total   = max(_most._peak_total, stats._peak_total);
+    _most._storage_peak = max(_most._storage_peak, stats._storage_peak);
+    _most._rss_kb       = max(_most._rss_kb, stats._rss_kb);
+    _most._peak_rss_kb  = max(_most._peak_rss_kb, stats._peak_rss_kb);
+    _leaked += stats.getLeakedBytes();
+    if (budget.isExceeded(stats))
+        _num_over_budget++;
+    _num_images++;
+}
+
+void showMemorySummary(const MemorySummary& summary, const MemoryBudget& budget, ostream& out) {
+    const MemoryStats& most = summary._most;
+    out << "OWNER, MAX_BYTES_PER_IMAGE" << endl;
+    for (int j = 0; j < NUM_IMAGE_OWNERS; j++)
+        out << setw(12) << owner_names[j] << ", " << setw(10) << most._peak[j] << endl;
+    out << "images = " << summary._num_images
+        << ", peak image bytes = " << most._peak_total
+        << ", peak storage bytes = " << most._storage_peak
+        << ", leaked bytes = " << summary._leaked
+        << ", max RSS = " << most._rss_kb << " KB"
+        << ", peak RSS = " << most._peak_rss_kb << " KB" << endl;
+    if (budget.isLimited())
+        out << "memory budget: RSS " << budget._max_rss_mb << " MB, image " << budget._max_image_mb << " MB (0 = none), "
+            << summary._num_over_budget << " images over budget" << endl;
+}
@@ -0,0 +1,99 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+/*
+ *  memory_stats.h
+ *  FaceTracker
+ *
+ *  Memory used while framing one image: bytes of image buffers held by
+ *  each stage of the pipeline, CvMemStorage blocks used by the Haar
+ *  detector, and the process resident set size.
+ *
+ *  Image buffers are counted where the pipeline creates and releases them
+ *  so bytes still live after an image is done are buffers that leaked.
+ */
+
+#include <ostream>
+#include <string>
+#include "config.h"
+#include "face_common.h"
+
+enum ImageOwner {
+    IMAGE_INPUT,            // Decoded input image
+    IMAGE_SCALED,           // scaleImage640x480
+    IMAGE_ROTATED,          // rotateImage
+    IMAGE_FRAME,            // dp._current_frame
+    IMAGE_DETECT_CROP,      // detectFacesCrop() working images
+    IMAGE_DETECT_GRAY,
+    IMAGE_DETECT_SMALL,
+    NUM_IMAGE_OWNERS
+};
+
+const char* getImageOwnerName(int owner);
+
+long getImageBytes(const IplImage* image);
+long getStorageBytes(const CvMemStorage* storage);
+
+/*
+ *  Resident set size of the process now and at its peak. 0 if unknown
+ */
+long getProcessRssKb();
+long getProcessPeakRssKb();
+
+struct MemoryStats {
+    long    _live[NUM_IMAGE_OWNERS];    // Bytes now
+    long    _peak[NUM_IMAGE_OWNERS];    // Most bytes at once since startImage()
+    long    _live_total;
+    long    _peak_total;                // Most bytes of all owners at once
+    long    _start_live_total;          // _live_total at startImage()
+    long    _storage_peak;              // Most CvMemStorage block bytes
+    long    _rss_kb;                    // Set by sampleProcess()
+    long    _peak_rss_kb;
+    MemoryStats();
+    /*
+     *  Start peaks for a new image. Live bytes carry over
+     */
+    void startImage();
+    void add(ImageOwner owner, const IplImage* image);
+    void remove(ImageOwner owner, const IplImage* image);
+    void sampleStorage(const CvMemStorage* storage);
+    void sampleProcess();
+    /*
+     *  Bytes created since startImage() and not released yet
+     */
+    long getLeakedBytes() const { return _live_total - _start_live_total; }
+};
+
+/*
+ *  Limits checked after each image. 0 => no limit
+ */
+struct MemoryBudget {
+    long    _max_rss_mb;        // Process peak RSS
+    long    _max_image_mb;      // Peak image buffer bytes of one image
+    MemoryBudget(): _max_rss_mb(0), _max_image_mb(0) {}
+    bool isLimited() const { return _max_rss_mb > 0 || _max_image_mb > 0; }
+    bool isExceeded(const MemoryStats& stats) const;
+};
+
+/*
+ *  Per image memory, one line per image.
+ *  LEAKED_BYTES is getLeakedBytes() when the image was done
+ */
+void showMemoryHeader(std::ostream& out);
+void showMemoryStats(const std::string image_name, const MemoryStats& stats, std::ostream& out);
+
+/*
+ *  Maximum of each column over all images and the images over budget,
+ *  added one image at a time
+ */
+struct MemorySummary {
+    MemoryStats _most;
+    long        _leaked;
+    int         _num_images;
+    int         _num_over_budget;
+    MemorySummary(): _leaked(0), _num_images(0), _num_over_budget(0) {}
+    void add(const MemoryStats& stats, const MemoryBudget& budget);
+};
+
+void showMemorySummary(const MemorySummary& summary, const MemoryBudget& budget, std::ostream& out);
+
+#endif // #ifndef MEMORY_STATS_H
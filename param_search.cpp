@@ -0,0 +1,222 @@
+/*
+ *  param_search.cpp
+ *  FaceTracker
+ *
+ *  Parallel successive halving search over Haar detector settings
+ */
+
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include "param_search.h"
+#include "work_pool.h"
+
+using namespace std;
+
+vector<SearchConfig> makeParamGrid(int min_neighbors_min, int min_neighbors_max, int min_neighbors_delta,
+                                   double scale_factor_min, double scale_factor_max, double scale_factor_delta) {
+    vector<SearchConfig> configs;
+    for (int min_neighbors = min_neighbors_min; min_neighbors <= min_neighbors_max; min_neighbors += min_neighbors_delta) {
+        // Half a step of slack so that 1.1 + 0.1 + 0.1 still reaches a max of 1.3
+        for (double scale_factor = scale_factor_min; scale_factor <= scale_factor_max + scale_factor_delta/2.0; scale_factor += scale_factor_delta) {
+            configs.push_back(SearchConfig(min_neighbors, scale_factor));
+        }
+    }
+    return configs;
+}
+
+/*
+ *  One (config x image) job
+ */
+struct Job {
+    int         _config_num;
+    int         _image_num;
+    JobScore    _score;
+};
+
+struct JobRunner {
+    const vector<SearchConfig>* _configs;
+    const vector<FileEntry>*    _entries;
+    vector<Job>*                _jobs;
+    EvaluateJob                 _evaluate;
+    void*                       _context;
+    atomic<int>                 _next_job;
+};
+
+/*
+ *  Worker loop. Jobs are handed out one at a time from a shared counter so
+ *  slow images do not hold up a whole chunk. Each job writes only its own slot.
+ */
+static void runJobsWorker(JobRunner* runner, int worker) {
+    vector<Job>& jobs = *runner->_jobs;
+    while (true) {
+        int j = runner->_next_job.fetch_add(1);
+        if (j >= (int)jobs.size())
+            break;
+        Job& job = jobs[j];
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        job._score = runner->_evaluate(runner->_context, worker, (*runner->_configs)[job._config_num], (*runner->_entries)[job._image_num]);
+        job._score._seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    }
+}
+
+static void runJobs(JobRunner* runner, int num_threads) {
+    runner->_next_job = 0;
+    num_threads = min(num_threads, (int)runner->_jobs->size());
+    vector<thread> threads;
+    for (int i = 1; i < num_threads; i++)
+        threads.push_back(thread(runJobsWorker, runner, i));
+    runJobsWorker(runner, 0);
+    for (int i = 0; i < (int)threads.size(); i++)
+        threads[i].join();
+}
+
+static bool dominates(double err_a, double sec_a, double err_b, double sec_b) {
+    return err_a <= err_b && sec_a <= sec_b && (err_a < err_b || sec_a < sec_b);
+}
+
+static bool SortScoresByError(const ConfigScore& s1, const ConfigScore& s2) {
+    if (s1._rung != s2._rung)
+        return s1._rung > s2._rung;
+    return s1.getMeanError() < s2.getMeanError();
+}
+
+vector<ConfigScore> successiveHalving(const vector<SearchConfig>& configs,
+                                      const vector<FileEntry>& entries,
+                                      const HalvingParams& params,
+                                      EvaluateJob evaluate, void* context) {
+    int num_threads = params._num_threads > 0 ? params._num_threads : getNumCores();
+    int eta = max(params._eta, 2);
+    int num_images_total = (int)entries.size();
+
+    vector<ConfigScore> scores(configs.size());
+    vector<int> survivors;
+    for (int i = 0; i < (int)configs.size(); i++) {
+        scores[i]._config = configs[i];
+        survivors.push_back(i);
+    }
+
+    JobRunner runner;
+    runner._configs  = &configs;
+    runner._entries  = &entries;
+    runner._evaluate = evaluate;
+    runner._context  = context;
+
+    int num_images_done = 0;
+    int num_images = min(max(params._initial_images, 1), num_images_total);
+    for (int rung = 0; survivors.size() > 0 && num_images > num_images_done; rung++) {
+        // Survivors keep the scores of the images they have already seen and
+        // are only run on the new ones
+        vector<Job> jobs;
+        for (int i = 0; i < (int)survivors.size(); i++) {
+            for (int n = num_images_done; n < num_images; n++) {
+                Job job;
+                job._config_num = survivors[i];
+                job._image_num  = n;
+                jobs.push_back(job);
+            }
+        }
+        runner._jobs = &jobs;
+        cout << "successiveHalving: rung " << rung << ", " << survivors.size() << " configs x "
+             << num_images << " images, " << jobs.size() << " jobs on " << num_threads << " threads" << endl;
+        runJobs(&runner, num_threads);
+
+        for (int j = 0; j < (int)jobs.size(); j++) {
+            ConfigScore& s = scores[jobs[j]._config_num];
+            s._num_images++;
+            s._num_found += jobs[j]._score._found ? 1 : 0;
+            s._total_error += jobs[j]._score.getError();
+            s._total_seconds += jobs[j]._score._seconds;
+            if (rung == 0) {
+                s._num_first_images++;
+                s._first_error += jobs[j]._score.getError();
+                s._first_seconds += jobs[j]._score._seconds;
+            }
+            s._rung = rung;
+        }
+        num_images_done = num_images;
+
+        if (survivors.size() <= 1 || num_images >= num_images_total)
+            break;
+
+        // Fewest survivors faster and more accurate first, then most accurate
+        vector<ConfigScore> ranked;
+        for (int i = 0; i < (int)survivors.size(); i++)
+            ranked.push_back(scores[survivors[i]]);
+        vector<int> num_dominating(ranked.size(), 0);
+        for (int i = 0; i < (int)ranked.size(); i++) {
+            for (int j = 0; j < (int)ranked.size(); j++) {
+                if (dominates(ranked[j].getMeanError(), ranked[j].getMeanSeconds(), ranked[i].getMeanError(), ranked[i].getMeanSeconds()))
+                    num_dominating[i]++;
+            }
+        }
+        vector<int> order(survivors.size());
+        for (int i = 0; i < (int)order.size(); i++)
+            order[i] = i;
+        sort(order.begin(), order.end(), [&ranked, &num_dominating](int a, int b) { 
+            if (num_dominating[a] != num_dominating[b])
+                return num_dominating[a] < num_dominating[b];
+            return ranked[a].getMeanError() < ranked[b].getMeanError(); 
+        });
+        int num_keep = max(1, ((int)survivors.size() + eta - 1)/eta);
+        vector<int> next_survivors;
+        for (int i = 0; i < num_keep; i++)
+            next_survivors.push_back(survivors[order[i]]);
+        survivors = next_survivors;
+        num_images = min(num_images*eta, num_images_total);
+    }
+
+    sort(scores.begin(), scores.end(), SortScoresByError);
+    markParetoFront(scores);
+    return scores;
+}
+
+/*
+ *  A config is on the Pareto front if no other config is both at least as
+ *  fast and at least as accurate, and strictly better in one of them.
+ *  Configs are compared on the first rung's images, the only ones all of 
+ *  them were scored on.
+ */
+void markParetoFront(vector<ConfigScore>& scores) {
+    for (int i = 0; i < (int)scores.size(); i++) {
+        double err_i = scores[i].getFirstMeanError();
+        double sec_i = scores[i].getFirstMeanSeconds();
+        bool dominated = false;
+        for (int j = 0; j < (int)scores.size() && !dominated; j++) {
+            if (i != j)
+                dominated = dominates(scores[j].getFirstMeanError(), scores[j].getFirstMeanSeconds(), err_i, sec_i);
+        }
+        scores[i]._pareto = !dominated;
+    }
+}
+
+/*
+ *  The first rung numbers and Pareto front, then the numbers over all the
+ *  images each config reached
+ */
+void showParetoTable(const vector<ConfigScore>& scores, ostream& out) {
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << "MIN_NEIGHBORS, SCALE_FACTOR, FIRST_IMAGES, FIRST_MEAN_ERROR, FIRST_MEAN_SECONDS, PARETO, "
+        << "RUNG, NUM_IMAGES, NUM_FOUND, MEAN_ERROR, MEAN_SECONDS" << endl;
+    for (int i = 0; i < (int)scores.size(); i++) {
+        const ConfigScore& s = scores[i];
+        out << setw(13) << s._config._min_neighbors << ", "
+            << setw(12) << setprecision(3) << s._config._scale_factor << ", "
+            << setw(12) << s._num_first_images << ", "
+            << setw(16) << setprecision(4) << s.getFirstMeanError() << ", "
+            << setw(18) << setprecision(4) << s.getFirstMeanSeconds() << ", "
+            << setw(6)  << (s._pareto ? "*" : "") << ", "
+            << setw(4)  << s._rung << ", "
+            << setw(10) << s._num_images << ", "
+            << setw(9)  << s._num_found << ", "
+            << setw(10) << setprecision(4) << s.getMeanError() << ", "
+            << setw(12) << setprecision(4) << s.getMeanSeconds() << endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,100 @@
+#ifndef PARAM_SEARCH_H
+#define PARAM_SEARCH_H
+/*
+ *  param_search.h
+ *  FaceTracker
+ *
+ *  Parallel search over Haar detector settings using successive halving.
+ *  Every configuration is scored on a small subset of the images, then only
+ *  the best 1/eta of them are given eta times as many images, and so on 
+ *  until one configuration is left or the image list is exhausted. Configs
+ *  are ranked by how many others beat them on both speed and accuracy, then
+ *  by accuracy, so fast configs that are nearly as accurate survive.
+ */
+
+#include <ostream>
+#include <vector>
+#include "config.h"
+#include "face_io.h"
+
+// Error charged to a job in which no face was found
+static const double MISSED_FACE_ERROR = 2.0;
+
+/*
+ *  One point in the parameter grid
+ */
+struct SearchConfig {
+    int     _min_neighbors;
+    double  _scale_factor;
+    SearchConfig(): _min_neighbors(0), _scale_factor(0.0) {}
+    SearchConfig(int min_neighbors, double scale_factor): _min_neighbors(min_neighbors), _scale_factor(scale_factor) {}
+};
+
+/*
+ *  Result of running one configuration on one image
+ *      errors are relative to ground truth face radius
+ */
+struct JobScore {
+    bool    _found;
+    double  _center_error;
+    double  _radius_error;
+    double  _seconds;
+    JobScore(): _found(false), _center_error(0.0), _radius_error(0.0), _seconds(0.0) {}
+    double getError() const { return _found ? _center_error + _radius_error : MISSED_FACE_ERROR; }
+};
+
+/*
+ *  Accumulated score of one configuration over the images it has been given
+ *      The _first_ totals are over the first rung's images, which every
+ *      config was scored on, so they can be compared across all configs
+ */
+struct ConfigScore {
+    SearchConfig _config;
+    int     _num_images;
+    int     _num_found;
+    double  _total_error;
+    double  _total_seconds;
+    int     _num_first_images;
+    double  _first_error;
+    double  _first_seconds;
+    int     _rung;          // Last successive halving rung this config reached
+    bool    _pareto;        // On the speed/accuracy Pareto front of the first rung
+    ConfigScore(): _num_images(0), _num_found(0), _total_error(0.0), _total_seconds(0.0), 
+        _num_first_images(0), _first_error(0.0), _first_seconds(0.0), _rung(0), _pareto(false) {}
+    double getMeanError() const   { return _num_images > 0 ? _total_error/(double)_num_images : MISSED_FACE_ERROR; }
+    double getMeanSeconds() const { return _num_images > 0 ? _total_seconds/(double)_num_images : 0.0; }
+    double getFirstMeanError() const   { return _num_first_images > 0 ? _first_error/(double)_num_first_images : MISSED_FACE_ERROR; }
+    double getFirstMeanSeconds() const { return _num_first_images > 0 ? _first_seconds/(double)_num_first_images : 0.0; }
+};
+
+/*
+ *  Evaluate one configuration on one image.
+ *      worker is in [0, num_threads) and is never used by two threads at once
+ *      so it can index per-thread detector state in context
+ */
+typedef JobScore (*EvaluateJob)(void* context, int worker, const SearchConfig& config, const FileEntry& entry);
+
+struct HalvingParams {
+    int     _initial_images;    // Images given to every config in the first rung
+    int     _eta;               // Keep 1/eta of configs and give them eta x images each rung
+    int     _num_threads;
+    HalvingParams(): _initial_images(8), _eta(3), _num_threads(0) {}
+};
+
+std::vector<SearchConfig> makeParamGrid(int min_neighbors_min, int min_neighbors_max, int min_neighbors_delta,
+                                        double scale_factor_min, double scale_factor_max, double scale_factor_delta);
+
+/*
+ *  Run successive halving over configs. Returns the score of every config,
+ *  furthest rung and most accurate first, with the speed/accuracy Pareto 
+ *  front of all configs on the first rung's images marked
+ */
+std::vector<ConfigScore> successiveHalving(const std::vector<SearchConfig>& configs,
+                                           const std::vector<FileEntry>& entries,
+                                           const HalvingParams& params,
+                                           EvaluateJob evaluate, void* context);
+
+void markParetoFront(std::vector<ConfigScore>& scores);
+void showParetoTable(const std::vector<ConfigScore>& scores, std::ostream& out);
+
+#endif // #ifndef PARAM_SEARCH_H
@@ -0,0 +1,140 @@
+/*
+ *  pipeline_trace.cpp
+ *  FaceTracker
+ *
+ *  Per thread span recording and Chrome Trace Event JSON output
+ */
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "pipeline_trace.h"
+#include "face_util.h"
+
+using namespace std;
+
+struct TraceEvent {
+    const char* _name;
+    const char* _category;
+    string      _detail;
+    double      _start_us;      // From startPipelineTrace()
+    double      _dur_us;
+};
+
+/*
+ *  Only written by the thread that owns it
+ */
+struct ThreadTraceBuffer {
+    int                 _tid;
+    vector<TraceEvent>  _events;
+};
+
+static atomic<bool>                         trace_on(false);
+static chrono::steady_clock::time_point     trace_start;
+static mutex                                registry_lock;      // Guards buffers
+static vector<unique_ptr<ThreadTraceBuffer> > buffers;          // Kept for the life of the program
+static thread_local ThreadTraceBuffer*      this_thread_buffer = 0;
+
+static ThreadTraceBuffer* getThreadBuffer() {
+    if (!this_thread_buffer) {
+        lock_guard<mutex> guard(registry_lock);
+        buffers.push_back(unique_ptr<ThreadTraceBuffer>(new ThreadTraceBuffer()));
+        buffers.back()->_tid = (int)buffers.size();
+        this_thread_buffer = buffers.back().get();
+    }
+    return this_thread_buffer;
+}
+
+void startPipelineTrace() {
+    lock_guard<mutex> guard(registry_lock);
+    for (int i = 0; i < (int)buffers.size(); i++)
+        buffers[i]->_events.clear();
+    trace_start = chrono::steady_clock::now();
+    trace_on = true;
+}
+
+bool isPipelineTraceOn() {
+    return trace_on.load(memory_order_relaxed);
+}
+
+long getNumPipelineTraceSpans() {
+    lock_guard<mutex> guard(registry_lock);
+    long n = 0;
+    for (int i = 0; i < (int)buffers.size(); i++)
+        n += (long)buffers[i]->_events.size();
+    return n;
+}
+
+TraceSpan::TraceSpan(const char* name, const char* category):
+    _name(name), _category(category), _on(isPipelineTraceOn()) {
+    if (_on)
+        _start = chrono::steady_clock::now();
+}
+
+TraceSpan::TraceSpan(const char* name, const char* category, const string& detail):
+    _name(name), _category(category), _on(isPipelineTraceOn()) {
+    if (_on) {
+        _detail = detail;
+        _start = chrono::steady_clock::now();
+    }
+}
+
+TraceSpan::~TraceSpan() {
+    if (!_on)
+        return;
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    TraceEvent e;
+    e._name = _name;
+    e._category = _category;
+    e._detail.swap(_detail);
+    e._start_us = chrono::duration<double, micro>(_start - trace_start).count();
+    e._dur_us = chrono::duration<double, micro>(end - _start).count();
+    getThreadBuffer()->_events.push_back(e);
+}
+
+bool writePipelineTrace(const string path, string* error) {
+    trace_on = false;
+    ofstream out(path.c_str());
+    if (!out) {
+        if (error)
+            *error = "Could not write trace file '" + path + "'";
+        return false;
+    }
+    lock_guard<mutex> guard(registry_lock);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+    bool first = true;
+    for (int i = 0; i < (int)buffers.size(); i++) {
+        const ThreadTraceBuffer& b = *buffers[i];
+        if (b._events.size() == 0)
+            continue;
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b._tid
+            << ",\"args\":{\"name\":\"thread " << b._tid << "\"}}";
+        first = false;
+        for (int j = 0; j < (int)b._events.size(); j++) {
+            const TraceEvent& e = b._events[j];
+            out << ",\n{\"name\":";
+            writeJsonString(e._name, out);
+            out << ",\"cat\":";
+            writeJsonString(e._category, out);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << b._tid
+                << fixed << setprecision(3) << ",\"ts\":" << e._start_us << ",\"dur\":" << e._dur_us;
+            if (e._detail.size() > 0) {
+                out << ",\"args\":{\"detail\":";
+                writeJsonString(e._detail, out);
+                out << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}" << endl;
+    if (!out) {
+        if (error)
+            *error = "Error writing trace file '" + path + "'";
+        return false;
+    }
+    return true;
+}
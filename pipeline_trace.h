@@ -0,0 +1,63 @@
+#ifndef PIPELINE_TRACE_H
+#define PIPELINE_TRACE_H
+/*
+ *  pipeline_trace.h
+ *  FaceTracker
+ *
+ *  Records when each thread spends time in each part of the pipeline
+ *  (decode, image preparation, search phases, Haar calls) and writes it in
+ *  Chrome Trace Event JSON for chrome://tracing or ui.perfetto.dev.
+ *
+ *  Each thread appends to its own buffer so recording takes no locks. A
+ *  thread's buffer is registered (under a lock) the first time it records.
+ *  Recording is off until startPipelineTrace() and costs one flag test per
+ *  span while off.
+ *
+ *  startPipelineTrace() and writePipelineTrace() must only be called while no
+ *  other thread is recording, e.g. before and after a batch.
+ */
+
+#include <chrono>
+#include <string>
+#include "config.h"
+
+/*
+ *  Clear any previous recording and start recording
+ */
+void startPipelineTrace();
+bool isPipelineTraceOn();
+
+/*
+ *  Stop recording and write everything recorded to path as a JSON trace.
+ *  Returns false and sets error if path cannot be written
+ */
+bool writePipelineTrace(const std::string path, std::string* error);
+
+/*
+ *  Number of spans recorded since startPipelineTrace()
+ */
+long getNumPipelineTraceSpans();
+
+/*
+ *  Records the time from construction to destruction as a span.
+ *  name and category must be string literals (or otherwise outlive the
+ *  trace). detail is shown as the span's argument, e.g. an image name.
+ */
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* category);
+    TraceSpan(const char* name, const char* category, const std::string& detail);
+    ~TraceSpan();
+private:
+    const char* _name;
+    const char* _category;
+    std::string _detail;
+    bool        _on;
+    std::chrono::steady_clock::time_point _start;
+};
+
+#define TRACE_SPAN_NAME2(line) trace_span_ ## line
+#define TRACE_SPAN_NAME(line) TRACE_SPAN_NAME2(line)
+#define TRACE_SPAN(...) TraceSpan TRACE_SPAN_NAME(__LINE__)(__VA_ARGS__)
+
+#endif // #ifndef PIPELINE_TRACE_H
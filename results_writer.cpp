@@ -0,0 +1,200 @@
+/*
+ *  results_writer.cpp
+ *  FaceTracker
+ *
+ *  Buffered results output written on a background thread
+ */
+
+#include <charconv>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "results_writer.h"
+
+using namespace std;
+
+// Room needed to format any one number
+static const int MAX_NUMBER_CHARS = 32;
+
+/*
+ *  Puts characters straight into the buffer being filled and hands it to 
+ *  the writer when it is full. sync() does nothing so std::endl is cheap
+ */
+class ResultsBuf : public streambuf {
+    ResultsWriter*  _writer;
+public:
+    ResultsBuf(ResultsWriter* writer): _writer(writer) {}
+    void reset(char* begin, char* end) { setp(begin, end); }
+    char* getPos() const { return pptr(); }
+    void  advance(int n) { pbump(n); }
+    size_t getRoom() const { return epptr() - pptr(); }
+protected:
+    int_type overflow(int_type c);
+    int sync() { return 0; }
+};
+
+/*
+ *  _lock guards everything below it.
+ *  _full holds text waiting to be written. _filling is the buffer the
+ *  ResultsBuf puts characters into. The two are swapped on hand off.
+ */
+struct ResultsWriter {
+    ofstream            _file;
+    string              _path;
+    ResultsWriterParams _params;
+    vector<char>        _filling;
+    ResultsBuf          _buf;
+    ostream             _stream;
+    thread              _thread;
+    
+    mutex               _lock;
+    condition_variable  _full_ready;
+    condition_variable  _full_written;
+    vector<char>        _full;
+    bool                _has_full;
+    bool                _shutting_down;
+    bool                _failed;
+    ResultsWriter(): _buf(this), _stream(&_buf), _has_full(false), _shutting_down(false), _failed(false) {}
+};
+
+static void writerThread(ResultsWriter* writer) {
+    unique_lock<mutex> guard(writer->_lock);
+    while (true) {
+        writer->_full_ready.wait(guard, [writer] { return writer->_shutting_down || writer->_has_full; });
+        if (!writer->_has_full)
+            break;
+        // Only this thread touches _full while _has_full is set
+        guard.unlock();
+        bool ok = true;
+        if (writer->_file.is_open()) {
+            writer->_file.write(&writer->_full[0], writer->_full.size());
+            writer->_file.flush();
+            ok = (bool)writer->_file;
+        }
+        if (writer->_params._echo) {
+            cout.write(&writer->_full[0], writer->_full.size());
+            cout.flush();
+            // Console output only matters when it is the only output
+            ok = ok && (writer->_file.is_open() || (bool)cout);
+        }
+        guard.lock();
+        writer->_failed = writer->_failed || !ok;
+        writer->_has_full = false;
+        writer->_full_written.notify_all();
+    }
+}
+
+/*
+ *  Give the formatted part of _filling to the writer thread, waiting for it
+ *  to finish the previous buffer, and start filling an empty buffer
+ */
+static void handOff(ResultsWriter* writer) {
+    size_t n = writer->_buf.getPos() - &writer->_filling[0];
+    if (n > 0) {
+        unique_lock<mutex> guard(writer->_lock);
+        writer->_full_written.wait(guard, [writer] { return !writer->_has_full; });
+        writer->_filling.resize(n);
+        writer->_full.swap(writer->_filling);
+        writer->_has_full = true;
+        writer->_full_ready.notify_one();
+    }
+    writer->_filling.resize(writer->_params._buffer_bytes);
+    writer->_buf.reset(&writer->_filling[0], &writer->_filling[0] + writer->_filling.size());
+}
+
+ResultsBuf::int_type ResultsBuf::overflow(int_type c) {
+    handOff(_writer);
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+ResultsWriter* openResultsWriter(const string path, const ResultsWriterParams& params, string* error) {
+    ResultsWriter* writer = new ResultsWriter;
+    if (path.size() > 0) {
+        writer->_file.open(path.c_str(), ios::out | ios::trunc | ios::binary);
+        if (!writer->_file.is_open()) {
+            if (error)
+                *error = "Could not write '" + path + "'";
+            delete writer;
+            return 0;
+        }
+    }
+    writer->_path = path.size() > 0 ? path : "standard output";
+    writer->_params = params;
+    if (path.size() == 0)
+        writer->_params._echo = true;
+    writer->_params._buffer_bytes = max(writer->_params._buffer_bytes, (size_t)(4*MAX_NUMBER_CHARS));
+    writer->_filling.resize(writer->_params._buffer_bytes);
+    writer->_buf.reset(&writer->_filling[0], &writer->_filling[0] + writer->_filling.size());
+    writer->_thread = thread(writerThread, writer);
+    return writer;
+}
+
+bool closeResultsWriter(ResultsWriter** writer, string* error) {
+    bool ok = true;
+    if (*writer) {
+        handOff(*writer);
+        {
+            lock_guard<mutex> guard((*writer)->_lock);
+            (*writer)->_shutting_down = true;
+        }
+        (*writer)->_full_ready.notify_one();
+        (*writer)->_thread.join();
+        ok = !(*writer)->_failed;
+        if ((*writer)->_file.is_open()) {
+            (*writer)->_file.close();
+            ok = ok && !(*writer)->_file.fail();
+        }
+        if (!ok && error)
+            *error = "Error writing '" + (*writer)->_path + "'";
+        delete *writer;
+        *writer = 0;
+    }
+    return ok;
+}
+
+ostream& getResultsStream(ResultsWriter* writer) {
+    return writer->_stream;
+}
+
+void appendText(ResultsWriter* writer, string_view text) {
+    writer->_buf.sputn(text.data(), text.size());
+}
+
+static void makeRoom(ResultsWriter* writer) {
+    if (writer->_buf.getRoom() < (size_t)MAX_NUMBER_CHARS)
+        handOff(writer);
+}
+
+void appendInt(ResultsWriter* writer, int n) {
+    makeRoom(writer);
+    char* p = writer->_buf.getPos();
+    writer->_buf.advance(to_chars(p, p + MAX_NUMBER_CHARS, n).ptr - p);
+}
+
+void appendDouble(ResultsWriter* writer, double x) {
+    makeRoom(writer);
+    char* p = writer->_buf.getPos();
+    // Same as ostream's default %g with precision 6
+    writer->_buf.advance(to_chars(p, p + MAX_NUMBER_CHARS, x, chars_format::general, 6).ptr - p);
+}
+
+void appendRect(ResultsWriter* writer, PwRect r) {
+    appendInt(writer, r.x);
+    appendText(writer, ", ");
+    appendInt(writer, r.y);
+    appendText(writer, ", ");
+    appendInt(writer, r.width);
+    appendText(writer, ", ");
+    appendInt(writer, r.height);
+}
+
+void flushResultsWriter(ResultsWriter* writer) {
+    handOff(writer);
+}
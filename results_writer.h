@@ -0,0 +1,63 @@
+#ifndef RESULTS_WRITER_H
+#define RESULTS_WRITER_H
+/*
+ *  results_writer.h
+ *  FaceTracker
+ *
+ *  Buffered results output written on a background thread.
+ *
+ *  Results are formatted into a large in-memory buffer, through
+ *  getResultsStream() or the append*() functions, and each full buffer is
+ *  written out by a writer thread while formatting continues into another.
+ *  std::endl on the results stream does not flush, so a run does one write
+ *  per buffer rather than one per line. Console echo of everything written
+ *  is optional and is done by the writer thread a buffer at a time.
+ */
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include "config.h"
+#include "face_common.h"
+
+struct ResultsWriterParams {
+    size_t  _buffer_bytes;      // Size of each of the two buffers
+    bool    _echo;              // Also write everything to cout
+    ResultsWriterParams(): _buffer_bytes(1 << 20), _echo(true) {}
+};
+
+struct ResultsWriter;
+
+/*
+ *  Returns 0 and sets *error if path cannot be written. An empty path 
+ *  writes to cout only
+ */
+ResultsWriter* openResultsWriter(const std::string path, const ResultsWriterParams& params, std::string* error);
+
+/*
+ *  Writes out what is left, stops the writer thread and closes the file.
+ *  Returns false and sets *error if any write failed
+ */
+bool closeResultsWriter(ResultsWriter** writer, std::string* error);
+
+/*
+ *  Formatted output into the buffer. Not thread safe: one thread formats
+ */
+std::ostream& getResultsStream(ResultsWriter* writer);
+
+/*
+ *  Unformatted output into the buffer. Numbers are formatted as an 
+ *  ostream with default flags would format them
+ */
+void appendText(ResultsWriter* writer, std::string_view text);
+void appendInt(ResultsWriter* writer, int n);
+void appendDouble(ResultsWriter* writer, double x);
+void appendRect(ResultsWriter* writer, PwRect r);     // x, y, width, height
+
+/*
+ *  Hand what has been formatted to the writer thread without waiting for
+ *  it to be written
+ */
+void flushResultsWriter(ResultsWriter* writer);
+
+#endif // #ifndef RESULTS_WRITER_H
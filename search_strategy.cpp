@@ -0,0 +1,163 @@
+/*
+ *  search_strategy.cpp
+ *  FaceTracker
+ *
+ *  Run time face search settings
+ */
+
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include "search_strategy.h"
+
+using namespace std;
+
+const char* getSearchAlgorithmName(SearchAlgorithm algorithm) {
+    return algorithm == SEARCH_ADAPTIVE ? "adaptive" : "histogram";
+}
+
+static string trim(const string s) {
+    string::size_type b = s.find_first_not_of(" \t\r\n");
+    if (b == string::npos)
+        return "";
+    string::size_type e = s.find_last_not_of(" \t\r\n");
+    return s.substr(b, e - b + 1);
+}
+
+static bool parseInt(const string value, int min_value, int* result) {
+    char* end = 0;
+    long v = strtol(value.c_str(), &end, 10);
+    if (value.size() == 0 || *end != '\0' || v < min_value)
+        return false;
+    *result = (int)v;
+    return true;
+}
+
+static bool parseDouble(const string value, double min_value, double* result) {
+    char* end = 0;
+    double v = strtod(value.c_str(), &end);
+    if (value.size() == 0 || *end != '\0' || v < min_value)
+        return false;
+    *result = v;
+    return true;
+}
+
+static bool parseBool(const string value, bool* result) {
+    if (value == "1" || value == "true" || value == "yes")
+        *result = true;
+    else if (value == "0" || value == "false" || value == "no")
+        *result = false;
+    else
+        return false;
+    return true;
+}
+
+bool setStrategyOption(SearchStrategy& strategy, const string name, const string value, string* error) {
+    bool ok;
+    if (name == "search") {
+        ok = value == "adaptive" || value == "histogram";
+        if (ok)
+            strategy._algorithm = value == "adaptive" ? SEARCH_ADAPTIVE : SEARCH_HISTOGRAM;
+    }
+    else if (name == "recursive")
+        ok = parseBool(value, &strategy._recursive);
+    else if (name == "steps")
+        ok = parseInt(value, 1, &strategy._adaptive_num_steps);
+    else if (name == "size_steps")
+        ok = parseInt(value, 1, &strategy._size_num_steps);
+    else if (name == "scale_factor")
+        ok = parseDouble(value, 1.0001, &strategy._scale_factor);
+    else if (name == "min_neighbors")
+        ok = parseInt(value, 0, &strategy._min_neighbors);
+    else if (name == "hardwire")
+        ok = parseBool(value, &strategy._hardwire_haar_settings);
+    else if (name == "max_calls")
+        ok = parseInt(value, 0, &strategy._budget._max_detect_calls);
+    else if (name == "max_ms")
+        ok = parseDouble(value, 0.0, &strategy._budget._max_ms);
+    else {
+        if (error)
+            *error = "Unknown search setting '" + name + "'";
+        return false;
+    }
+    if (!ok && error)
+        *error = "Bad value '" + value + "' for search setting '" + name + "'";
+    return ok;
+}
+
+bool readStrategyFile(SearchStrategy& strategy, const string path, string* error) {
+    ifstream in(path.c_str());
+    if (!in) {
+        if (error)
+            *error = "Could not read strategy file '" + path + "'";
+        return false;
+    }
+    string line;
+    for (int line_num = 1; getline(in, line); line_num++) {
+        string::size_type comment = line.find('#');
+        if (comment != string::npos)
+            line.resize(comment);
+        line = trim(line);
+        if (line.size() == 0)
+            continue;
+        string::size_type eq = line.find('=');
+        string err;
+        if (eq == string::npos)
+            err = "Expected 'name = value'";
+        else
+            setStrategyOption(strategy, trim(line.substr(0, eq)), trim(line.substr(eq + 1)), &err);
+        if (err.size() > 0) {
+            if (error) {
+                ostringstream s;
+                s << path << ":" << line_num << ": " << err;
+                *error = s.str();
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+int parseStrategyArg(SearchStrategy& strategy, int argc, char* const argv[], int* arg, string* error) {
+    string option = argv[*arg];
+    if (option.compare(0, 2, "--") != 0)
+        return 0;
+    string name = option.substr(2);
+    for (string::size_type i = 0; i < name.size(); i++)
+        if (name[i] == '-')
+            name[i] = '_';
+    if (name != "strategy") {
+        // Only claim options that are settings so callers can have their own
+        SearchStrategy test;
+        string err;
+        if (!setStrategyOption(test, name, "", &err) && err.compare(0, 7, "Unknown") == 0)
+            return 0;
+    }
+    if (*arg + 1 >= argc) {
+        if (error)
+            *error = "No value given for '" + option + "'";
+        return -1;
+    }
+    string value = argv[*arg + 1];
+    bool ok = name == "strategy" ? readStrategyFile(strategy, value, error) : setStrategyOption(strategy, name, value, error);
+    if (!ok)
+        return -1;
+    *arg += 2;
+    return 1;
+}
+
+string strategyAsString(const SearchStrategy& strategy) {
+    ostringstream s;
+    s << getSearchAlgorithmName(strategy._algorithm);
+    if (strategy._algorithm == SEARCH_ADAPTIVE)
+        s << (strategy._recursive ? "_recursive" : "") << "_" << strategy._adaptive_num_steps << "_" << strategy._size_num_steps;
+    if (strategy._hardwire_haar_settings)
+        s << "_hardwired";
+    else
+        s << "_" << strategy._scale_factor << "_" << strategy._min_neighbors;
+    if (strategy._budget._max_detect_calls > 0)
+        s << "_calls" << strategy._budget._max_detect_calls;
+    if (strategy._budget._max_ms > 0.0)
+        s << "_ms" << strategy._budget._max_ms;
+    return s.str();
+}
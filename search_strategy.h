@@ -0,0 +1,89 @@
+#ifndef SEARCH_STRATEGY_H
+#define SEARCH_STRATEGY_H
+/*
+ *  search_strategy.h
+ *  FaceTracker
+ *
+ *  Face search settings chosen at run time. The config.h macros only give
+ *  the defaults. Settings are read from "name = value" lines in a strategy
+ *  file or from "--name value" command line options with '_' written as '-'
+ *
+ *      # Fast settings for A/B test
+ *      search        = adaptive    # adaptive or histogram
+ *      recursive     = 1
+ *      steps         = 11
+ *      size_steps    = 11
+ *      scale_factor  = 1.2
+ *      min_neighbors = 3
+ *      hardwire      = 0
+ *      max_calls     = 200
+ *      max_ms        = 0
+ *
+ *  "--strategy <file>" on the command line reads a strategy file. Options
+ *  after it override the file.
+ */
+
+#include <string>
+#include "config.h"
+
+enum SearchAlgorithm {
+    SEARCH_HISTOGRAM,
+    SEARCH_ADAPTIVE
+};
+
+/*
+ *  Limit on the work done for one image. When it runs out detectFacesCrop()
+ *  stops detecting and the searches return the best face found so far.
+ *  0 for no limit
+ */
+struct SearchBudget {
+    int     _max_detect_calls;
+    double  _max_ms;
+    SearchBudget(): _max_detect_calls(0), _max_ms(0.0) {}
+    SearchBudget(int max_detect_calls, double max_ms): _max_detect_calls(max_detect_calls), _max_ms(max_ms) {}
+    bool isLimited() const { return _max_detect_calls > 0 || _max_ms > 0.0; }
+};
+
+struct SearchStrategy {
+    SearchAlgorithm _algorithm;
+    bool    _recursive;             // Adaptive face size search starts from the whole frame, not the frame the center was found in
+    int     _adaptive_num_steps;    // Steps in x and y searched for the face center
+    int     _size_num_steps;        // Frame sizes searched for the face size
+    double  _scale_factor;
+    int     _min_neighbors;
+    bool    _hardwire_haar_settings;    // Detect with HAAR_SCALE_FACTOR and 2 neighbors whatever _scale_factor and _min_neighbors are
+    SearchBudget _budget;
+    SearchStrategy(): _algorithm(ADAPTIVE_FACE_SEARCH ? SEARCH_ADAPTIVE : SEARCH_HISTOGRAM),
+        _recursive(ADAPTIVE_RECURSIVE != 0),
+        _adaptive_num_steps(ADAPTIVE_NUM_STEPS), _size_num_steps(ADAPTIVE_SIZE_NUM_STEPS),
+        _scale_factor(HAAR_SCALE_FACTOR), _min_neighbors(2),
+        _hardwire_haar_settings(HARDWIRE_HAAR_SETTINGS != 0) {}
+};
+
+const char* getSearchAlgorithmName(SearchAlgorithm algorithm);
+
+/*
+ *  Set one named setting. Returns false and sets *error if the name or value
+ *  is not valid
+ */
+bool setStrategyOption(SearchStrategy& strategy, const std::string name, const std::string value, std::string* error);
+
+/*
+ *  Read settings from a strategy file into strategy. Settings not in the
+ *  file are left as they are
+ */
+bool readStrategyFile(SearchStrategy& strategy, const std::string path, std::string* error);
+
+/*
+ *  Parse the strategy option at argv[*arg], if it is one.
+ *  Returns 1 and advances *arg past the option's value if it was a strategy
+ *  option, 0 if it was not and -1 with *error set if it was not valid
+ */
+int parseStrategyArg(SearchStrategy& strategy, int argc, char* const argv[], int* arg, std::string* error);
+
+/*
+ *  One line description, e.g. for results file names and logs
+ */
+std::string strategyAsString(const SearchStrategy& strategy);
+
+#endif // #ifndef SEARCH_STRATEGY_H
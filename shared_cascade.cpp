@@ -0,0 +1,41 @@
+/*
+ *  shared_cascade.cpp
+ *  FaceTracker
+ *
+ *  Haar cascade shared read-only between threads
+ */
+
+#include <cassert>
+#include "shared_cascade.h"
+
+using namespace std;
+
+bool loadSharedCascade(SharedCascade& shared, const string cascade_path, const string cascade_name) {
+    shared._cascade_name = cascade_name;
+    shared._cascade = (CvHaarClassifierCascade*) cvLoad (cascade_path.c_str(), 0, 0, 0);
+    return shared._cascade != 0;
+}
+
+void releaseSharedCascade(SharedCascade& shared) {
+    if (shared._cascade)
+        cvReleaseHaarClassifierCascade(&shared._cascade);
+}
+
+CvHaarClassifierCascade* createCascadeContext(const SharedCascade& shared) {
+    assert(shared._cascade);
+    CvHaarClassifierCascade* context = (CvHaarClassifierCascade*) cvAlloc(sizeof(CvHaarClassifierCascade));
+    *context = *shared._cascade;
+    // Built on first cvHaarDetectObjects() call on this context 
+    context->hid_cascade = 0;
+    return context;
+}
+
+void releaseCascadeContext(CvHaarClassifierCascade** context) {
+    if (*context) {
+        // hid_cascade is a single cvAlloc() block. stage_classifier belongs to
+        // the SharedCascade so it must not be released here
+        if ((*context)->hid_cascade)
+            cvFree(&(*context)->hid_cascade);
+        cvFree(context);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef SHARED_CASCADE_H
+#define SHARED_CASCADE_H
+/*
+ *  shared_cascade.h
+ *  FaceTracker
+ *
+ *  A Haar cascade that is loaded once and shared read-only between threads.
+ *
+ *  cvHaarDetectObjects() calls cvSetImagesForHaarClassifierCascade() which
+ *  builds the scaled feature data in cascade->hid_cascade and updates
+ *  cascade->scale and cascade->real_window_size. The trained classifier data
+ *  in cascade->stage_classifier is only ever read. So each thread gets its
+ *  own small CvHaarClassifierCascade header that points at the shared
+ *  stage_classifier array and owns its own hid_cascade.
+ */
+
+#include <string>
+#include "config.h"
+#include "face_common.h"
+
+struct SharedCascade {
+    CvHaarClassifierCascade*  _cascade;        // Never passed to cvHaarDetectObjects()
+    std::string               _cascade_name;
+    SharedCascade(): _cascade(0) {}
+};
+
+/*
+ *  Load cascade from cascade_path. Returns false if it cannot be loaded
+ */
+bool loadSharedCascade(SharedCascade& shared, const std::string cascade_path, const std::string cascade_name);
+void releaseSharedCascade(SharedCascade& shared);
+
+/*
+ *  Per-thread evaluation context for shared. Must be released before shared
+ */
+CvHaarClassifierCascade* createCascadeContext(const SharedCascade& shared);
+void releaseCascadeContext(CvHaarClassifierCascade** context);
+
+#endif // #ifndef SHARED_CASCADE_H
@@ -0,0 +1,105 @@
+/*
+ *  stage_timer.cpp
+ *  FaceTracker
+ *
+ *  Per stage timing of the framing pipeline
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include "stage_timer.h"
+
+using namespace std;
+
+static const char* stage_names[NUM_TIMING_STAGES] = {
+    "LOAD", "SCALE", "ROTATE", "CROP", "GRAY", "RESIZE", "HAAR", "SMALLEST_RECT", "CENTER", "SIZE"
+};
+
+const char* getTimingStageName(int stage) {
+    return stage >= 0 && stage < NUM_TIMING_STAGES ? stage_names[stage] : "?";
+}
+
+void showStageTimesHeader(ostream& out) {
+    out << "IMAGE";
+    for (int i = 0; i < NUM_TIMING_STAGES; i++)
+        out << ", " << stage_names[i] << "_MS";
+    out << ", HAAR_CALLS" << endl;
+}
+
+/*
+ *  The formatting set here is undone before returning so out, often cout, 
+ *  prints as before for the caller
+ */
+void showStageTimes(const string image_name, const StageTimes& times, ostream& out) {
+    ios_base::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << image_name;
+    for (int i = 0; i < NUM_TIMING_STAGES; i++)
+        out << ", " << fixed << setprecision(3) << times._ms[i];
+    out << ", " << times._calls[STAGE_HAAR] << endl;
+    out.flags(flags);
+    out.precision(precision);
+}
+
+StageTimeSummary::StageTimeSummary(): _num_images(0) {
+    for (int i = 0; i < NUM_TIMING_STAGES; i++) {
+        _total_ms[i] = 0.0;
+        _max_ms[i] = 0.0;
+        _counts[i].resize(NUM_STAGE_BUCKETS, 0);
+    }
+}
+
+static int getStageBucket(double ms) {
+    if (ms < STAGE_BUCKET_MIN_MS)
+        return 0;
+    int b = 1 + (int)(log(ms/STAGE_BUCKET_MIN_MS)/log(STAGE_BUCKET_RATIO));
+    return min(b, NUM_STAGE_BUCKETS - 1);
+}
+
+void StageTimeSummary::add(const StageTimes& times) {
+    _num_images++;
+    for (int i = 0; i < NUM_TIMING_STAGES; i++) {
+        _total_ms[i] += times._ms[i];
+        _max_ms[i] = max(_max_ms[i], times._ms[i]);
+        _counts[i][getStageBucket(times._ms[i])]++;
+    }
+}
+
+/*
+ *  The geometric middle of the bucket holding the nearest rank value
+ */
+double StageTimeSummary::getPercentile(int stage, double p) const {
+    if (_num_images == 0)
+        return 0.0;
+    long rank = (long)(p * (double)(_num_images - 1) + 0.5);
+    long n = 0;
+    int b = 0;
+    for (; b < NUM_STAGE_BUCKETS - 1; b++) {
+        n += _counts[stage][b];
+        if (n > rank)
+            break;
+    }
+    if (b == 0)
+        return 0.0;
+    double ms = STAGE_BUCKET_MIN_MS * pow(STAGE_BUCKET_RATIO, b - 0.5);
+    return min(ms, _max_ms[stage]);
+}
+
+void showStageTimePercentiles(const StageTimeSummary& summary, ostream& out) {
+    ios_base::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << "STAGE, IMAGES, TOTAL_MS, P50_MS, P90_MS, P99_MS, MAX_MS" << endl;
+    for (int stage = 0; stage < NUM_TIMING_STAGES; stage++) {
+        out << setw(13) << stage_names[stage] << ", "
+            << setw(6) << summary._num_images << ", "
+            << fixed << setprecision(3)
+            << setw(10) << summary._total_ms[stage] << ", "
+            << setw(8) << summary.getPercentile(stage, 0.50) << ", "
+            << setw(8) << summary.getPercentile(stage, 0.90) << ", "
+            << setw(8) << summary.getPercentile(stage, 0.99) << ", "
+            << setw(8) << summary._max_ms[stage] << endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
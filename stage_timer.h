@@ -0,0 +1,115 @@
+#ifndef STAGE_TIMER_H
+#define STAGE_TIMER_H
+/*
+ *  stage_timer.h
+ *  FaceTracker
+ *
+ *  Time spent in each stage of framing one image.
+ *
+ *  Stages are timed with STAGE_TIMER(stage_times, stage) which times the
+ *  rest of the enclosing block. With STAGE_TIMING 0 (the default) it
+ *  compiles to nothing. Build with -DSTAGE_TIMING=1 to enable it.
+ *
+ *  The adaptive search phases include the Haar calls they make, so the
+ *  stage times do not add up to the image time.
+ */
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "config.h"
+
+enum TimingStage {
+    STAGE_LOAD,             // cvLoadImage
+    STAGE_SCALE,            // scaleImage640x480
+    STAGE_ROTATE,           // rotateImage
+    STAGE_CROP,             // cropImage
+    STAGE_GRAY,             // BGR to gray
+    STAGE_RESIZE,           // Gray image downscale before detection
+    STAGE_HAAR,             // cvHaarDetectObjects
+    STAGE_SMALLEST_RECT,    // Adaptive phases
+    STAGE_CENTER,
+    STAGE_SIZE,
+    NUM_TIMING_STAGES
+};
+
+const char* getTimingStageName(int stage);
+
+/*
+ *  Total time and number of calls of each stage
+ */
+struct StageTimes {
+    double  _ms[NUM_TIMING_STAGES];
+    int     _calls[NUM_TIMING_STAGES];
+    StageTimes() { clear(); }
+    void clear() {
+        for (int i = 0; i < NUM_TIMING_STAGES; i++) {
+            _ms[i] = 0.0;
+            _calls[i] = 0;
+        }
+    }
+    void add(const StageTimes& t) {
+        for (int i = 0; i < NUM_TIMING_STAGES; i++) {
+            _ms[i] += t._ms[i];
+            _calls[i] += t._calls[i];
+        }
+    }
+};
+
+/*
+ *  Adds the time from construction to destruction to times
+ */
+class StageTimer {
+public:
+    StageTimer(StageTimes& times, TimingStage stage): _times(times), _stage(stage), _start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() {
+        _times._ms[_stage] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+        _times._calls[_stage]++;
+    }
+private:
+    StageTimes& _times;
+    TimingStage _stage;
+    std::chrono::steady_clock::time_point _start;
+};
+
+#if STAGE_TIMING
+ #define STAGE_TIMER_NAME2(line) stage_timer_ ## line
+ #define STAGE_TIMER_NAME(line) STAGE_TIMER_NAME2(line)
+ #define STAGE_TIMER(times, stage) StageTimer STAGE_TIMER_NAME(__LINE__)(times, stage)
+#else
+ #define STAGE_TIMER(times, stage)
+#endif
+
+/*
+ *  Per image stage totals, one line per image
+ */
+void showStageTimesHeader(std::ostream& out);
+void showStageTimes(const std::string image_name, const StageTimes& times, std::ostream& out);
+
+/*
+ *  Distribution of each stage's per image total, built up an image at a 
+ *  time in fixed memory. Times are counted in buckets STAGE_BUCKET_RATIO 
+ *  apart, so percentiles are within about 1% of the exact nearest rank 
+ *  value. Totals and maxima are exact.
+ */
+static const double STAGE_BUCKET_MIN_MS = 0.001;   // Smaller times are counted as 0
+static const double STAGE_BUCKET_RATIO  = 1.02;
+static const int    NUM_STAGE_BUCKETS   = 1100;    // Up to about 45 minutes
+
+struct StageTimeSummary {
+    long    _num_images;
+    double  _total_ms[NUM_TIMING_STAGES];
+    double  _max_ms[NUM_TIMING_STAGES];
+    std::vector<long> _counts[NUM_TIMING_STAGES];   // Images in each bucket
+    StageTimeSummary();
+    void add(const StageTimes& times);
+    double getPercentile(int stage, double p) const;
+};
+
+/*
+ *  p50, p90, p99 and max of each stage's per image total over all images
+ */
+void showStageTimePercentiles(const StageTimeSummary& summary, std::ostream& out);
+
+#endif // #ifndef STAGE_TIMER_H
@@ -0,0 +1,319 @@
+/*
+ *  sweep_results.cpp
+ *  FaceTracker
+ *
+ *  Binary columnar results for TEST_MANY_SETTINGS parameter sweeps
+ */
+
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include "file_mapping.h"
+#include "sweep_results.h"
+
+using namespace std;
+
+static const char   SWEEP_MAGIC[8] = { 'F', 'T', 'S', 'W', 'E', 'E', 'P', '1' };
+static const int    NUM_INT_COLUMNS = 7;
+static const size_t TRAILER_BYTES = sizeof(uint64_t) + sizeof(SWEEP_MAGIC);
+
+/*
+ *  Bytes of a row group with n rows, and the offset of its scale_factor
+ *  column. Every column starts 8 byte aligned
+ */
+static size_t alignTo8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static size_t getScaleFactorOffset(size_t n) {
+    return alignTo8(NUM_INT_COLUMNS*alignTo8(n*sizeof(int32_t)));
+}
+
+static size_t getGroupBytes(size_t n) {
+    return getScaleFactorOffset(n) + n*sizeof(double);
+}
+
+struct SweepWriter {
+    ofstream                _file;
+    string                  _path;
+    uint64_t                _offset;
+    vector<SweepRow>        _rows;          // Current group
+    vector<char>            _group;         // Current group laid out for writing
+    vector<pair<uint64_t, uint32_t> > _group_index;
+    vector<string>          _cascades;
+    map<string, int>        _cascade_index;
+    vector<SweepImage>      _images;
+    map<string, int>        _image_index;
+};
+
+static void writeBytes(SweepWriter* writer, const void* data, size_t n) {
+    writer->_file.write((const char*)data, n);
+    writer->_offset += n;
+}
+
+static void writeU32(SweepWriter* writer, uint32_t n) {
+    writeBytes(writer, &n, sizeof(n));
+}
+
+static void writeI32(SweepWriter* writer, int32_t n) {
+    writeBytes(writer, &n, sizeof(n));
+}
+
+static void writeName(SweepWriter* writer, const string name) {
+    writeU32(writer, name.size());
+    writeBytes(writer, name.data(), name.size());
+}
+
+static void writeGroup(SweepWriter* writer) {
+    int n = writer->_rows.size();
+    if (n == 0)
+        return;
+    writer->_group.assign(getGroupBytes(n), 0);
+    size_t col_bytes = alignTo8(n*sizeof(int32_t));
+    int32_t* cols[NUM_INT_COLUMNS];
+    for (int c = 0; c < NUM_INT_COLUMNS; c++)
+        cols[c] = (int32_t*)&writer->_group[c*col_bytes];
+    double* scale_factor = (double*)&writer->_group[getScaleFactorOffset(n)];
+    for (int i = 0; i < n; i++) {
+        const SweepRow& r = writer->_rows[i];
+        cols[0][i] = r._image;
+        cols[1][i] = r._cascade;
+        cols[2][i] = r._min_neighbors;
+        cols[3][i] = r._face.x;
+        cols[4][i] = r._face.y;
+        cols[5][i] = r._face.width;
+        cols[6][i] = r._face.height;
+        scale_factor[i] = r._scale_factor;
+    }
+    writer->_group_index.push_back(make_pair(writer->_offset, (uint32_t)n));
+    writeBytes(writer, &writer->_group[0], writer->_group.size());
+    writer->_rows.clear();
+}
+
+SweepWriter* openSweepWriter(const string path, string* error) {
+    SweepWriter* writer = new SweepWriter;
+    writer->_file.open(path.c_str(), ios::out | ios::trunc | ios::binary);
+    if (!writer->_file.is_open()) {
+        if (error)
+            *error = "Could not write '" + path + "'";
+        delete writer;
+        return 0;
+    }
+    writer->_path = path;
+    writer->_offset = 0;
+    writeBytes(writer, SWEEP_MAGIC, sizeof(SWEEP_MAGIC));
+    writer->_rows.reserve(SWEEP_ROWS_PER_GROUP);
+    return writer;
+}
+
+int addSweepImage(SweepWriter* writer, const SweepImage& image) {
+    map<string, int>::const_iterator it = writer->_image_index.find(image._name);
+    if (it != writer->_image_index.end())
+        return it->second;
+    int i = writer->_images.size();
+    writer->_images.push_back(image);
+    writer->_image_index[image._name] = i;
+    return i;
+}
+
+int addSweepCascade(SweepWriter* writer, const string cascade_name) {
+    map<string, int>::const_iterator it = writer->_cascade_index.find(cascade_name);
+    if (it != writer->_cascade_index.end())
+        return it->second;
+    int i = writer->_cascades.size();
+    writer->_cascades.push_back(cascade_name);
+    writer->_cascade_index[cascade_name] = i;
+    return i;
+}
+
+void writeSweepRow(SweepWriter* writer, const SweepRow& row) {
+    writer->_rows.push_back(row);
+    if ((int)writer->_rows.size() >= SWEEP_ROWS_PER_GROUP)
+        writeGroup(writer);
+}
+
+bool closeSweepWriter(SweepWriter** writer, string* error) {
+    bool ok = true;
+    if (*writer) {
+        SweepWriter* w = *writer;
+        writeGroup(w);
+        uint64_t footer_offset = w->_offset;
+        writeU32(w, w->_cascades.size());
+        for (int i = 0; i < (int)w->_cascades.size(); i++)
+            writeName(w, w->_cascades[i]);
+        writeU32(w, w->_images.size());
+        for (int i = 0; i < (int)w->_images.size(); i++) {
+            writeName(w, w->_images[i]._name);
+            writeI32(w, w->_images[i]._face_center.x);
+            writeI32(w, w->_images[i]._face_center.y);
+            writeI32(w, w->_images[i]._face_radius);
+        }
+        writeU32(w, w->_group_index.size());
+        for (int i = 0; i < (int)w->_group_index.size(); i++) {
+            writeBytes(w, &w->_group_index[i].first, sizeof(uint64_t));
+            writeU32(w, w->_group_index[i].second);
+        }
+        writeBytes(w, &footer_offset, sizeof(footer_offset));
+        writeBytes(w, SWEEP_MAGIC, sizeof(SWEEP_MAGIC));
+        w->_file.close();
+        ok = !w->_file.fail();
+        if (!ok && error)
+            *error = "Error writing '" + w->_path + "'";
+        delete w;
+        *writer = 0;
+    }
+    return ok;
+}
+
+SweepRow SweepGroup::getRow(int i) const {
+    SweepRow r;
+    r._image = _image[i];
+    r._cascade = _cascade[i];
+    r._min_neighbors = _min_neighbors[i];
+    r._scale_factor = _scale_factor[i];
+    r._face = PwRect(_face_x[i], _face_y[i], _face_width[i], _face_height[i]);
+    return r;
+}
+
+long SweepTable::getNumRows() const {
+    long n = 0;
+    for (int i = 0; i < (int)_groups.size(); i++)
+        n += _groups[i]._num_rows;
+    return n;
+}
+
+/*
+ *  Bounds checked reads from the footer
+ */
+struct FooterReader {
+    const char* _p;
+    const char* _end;
+    bool        _ok;
+    FooterReader(const char* p, const char* end): _p(p), _end(end), _ok(true) {}
+    void read(void* out, size_t n) {
+        _ok = _ok && (size_t)(_end - _p) >= n;
+        if (_ok) {
+            memcpy(out, _p, n);
+            _p += n;
+        }
+        else
+            memset(out, 0, n);
+    }
+    uint32_t readU32() { uint32_t n; read(&n, sizeof(n)); return n; }
+    int32_t  readI32() { int32_t n;  read(&n, sizeof(n)); return n; }
+    uint64_t readU64() { uint64_t n; read(&n, sizeof(n)); return n; }
+    string readName() {
+        uint32_t n = readU32();
+        _ok = _ok && (size_t)(_end - _p) >= n;
+        string name = _ok ? string(_p, n) : string();
+        if (_ok)
+            _p += n;
+        return name;
+    }
+};
+
+bool readSweepTable(const string path, SweepTable* table, string* error) {
+    *table = SweepTable();
+    shared_ptr<FileMapping> mapping(new FileMapping());
+    if (!mapping->open(path)) {
+        if (error)
+            *error = "Could not read '" + path + "'";
+        return false;
+    }
+    const char* data = mapping->_data;
+    size_t size = mapping->_size;
+    bool ok = size >= sizeof(SWEEP_MAGIC) + TRAILER_BYTES
+           && memcmp(data, SWEEP_MAGIC, sizeof(SWEEP_MAGIC)) == 0
+           && memcmp(data + size - sizeof(SWEEP_MAGIC), SWEEP_MAGIC, sizeof(SWEEP_MAGIC)) == 0;
+    uint64_t footer_offset = 0;
+    if (ok) {
+        memcpy(&footer_offset, data + size - TRAILER_BYTES, sizeof(footer_offset));
+        ok = footer_offset >= sizeof(SWEEP_MAGIC) && footer_offset <= size - TRAILER_BYTES;
+    }
+    if (ok) {
+        FooterReader footer(data + footer_offset, data + size - TRAILER_BYTES);
+        uint32_t num_cascades = footer.readU32();
+        for (uint32_t i = 0; footer._ok && i < num_cascades; i++)
+            table->_cascades.push_back(footer.readName());
+        uint32_t num_images = footer.readU32();
+        for (uint32_t i = 0; footer._ok && i < num_images; i++) {
+            SweepImage image;
+            image._name = footer.readName();
+            image._face_center.x = footer.readI32();
+            image._face_center.y = footer.readI32();
+            image._face_radius = footer.readI32();
+            table->_images.push_back(image);
+        }
+        uint32_t num_groups = footer.readU32();
+        for (uint32_t i = 0; footer._ok && i < num_groups; i++) {
+            uint64_t offset = footer.readU64();
+            size_t n = footer.readU32();
+            // Groups lie between the magic and the footer and are 8 byte aligned 
+            // relative to the start of the mapping, which is page aligned. A row
+            // takes more than 8 bytes, so bounding n by that first keeps the
+            // group size from overflowing
+            footer._ok = footer._ok && offset % 8 == 0 && offset >= sizeof(SWEEP_MAGIC) && offset <= footer_offset
+                      && n <= (footer_offset - offset)/8 && n <= (size_t)INT_MAX
+                      && offset + getGroupBytes(n) <= footer_offset;
+            if (!footer._ok)
+                break;
+            const char* p = data + offset;
+            size_t col_bytes = alignTo8(n*sizeof(int32_t));
+            SweepGroup g;
+            g._num_rows = (int)n;
+            g._image         = (const int32_t*)(p);
+            g._cascade       = (const int32_t*)(p + col_bytes);
+            g._min_neighbors = (const int32_t*)(p + 2*col_bytes);
+            g._face_x        = (const int32_t*)(p + 3*col_bytes);
+            g._face_y        = (const int32_t*)(p + 4*col_bytes);
+            g._face_width    = (const int32_t*)(p + 5*col_bytes);
+            g._face_height   = (const int32_t*)(p + 6*col_bytes);
+            g._scale_factor  = (const double*)(p + getScaleFactorOffset(n));
+            table->_groups.push_back(g);
+        }
+        ok = footer._ok;
+    }
+    if (!ok) {
+        *table = SweepTable();
+        if (error)
+            *error = "'" + path + "' is not a sweep results file";
+        return false;
+    }
+    table->_mapping = mapping;
+    return true;
+}
+
+void writeSweepCsvHeader(ResultsWriter* out) {
+    appendText(out, "IMAGE_NAME, FACE_CENTER_X, FACE_CENTER_Y, FACE_RADIUS, CASCADE, MIN_NEIGHBORS, SCALE_FACTOR, "
+                    "FOUND_X, FOUND_Y, FOUND_WIDTH, FOUND_HEIGHT\n");
+}
+
+void writeSweepCsv(const SweepTable& table, ResultsWriter* out) {
+    const SweepImage no_image;
+    const string no_cascade;
+    for (int g = 0; g < (int)table._groups.size(); g++) {
+        const SweepGroup& group = table._groups[g];
+        for (int i = 0; i < group._num_rows; i++) {
+            SweepRow r = group.getRow(i);
+            const SweepImage& image = (r._image >= 0 && r._image < (int)table._images.size()) ? table._images[r._image] : no_image;
+            const string& cascade = (r._cascade >= 0 && r._cascade < (int)table._cascades.size()) ? table._cascades[r._cascade] : no_cascade;
+            appendText(out, image._name);
+            appendText(out, ", ");
+            appendInt(out, image._face_center.x);
+            appendText(out, ", ");
+            appendInt(out, image._face_center.y);
+            appendText(out, ", ");
+            appendInt(out, image._face_radius);
+            appendText(out, ", ");
+            appendText(out, cascade);
+            appendText(out, ", ");
+            appendInt(out, r._min_neighbors);
+            appendText(out, ", ");
+            appendDouble(out, r._scale_factor);
+            appendText(out, ", ");
+            appendRect(out, r._face);
+            appendText(out, "\n");
+        }
+    }
+}
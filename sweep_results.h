@@ -0,0 +1,114 @@
+#ifndef SWEEP_RESULTS_H
+#define SWEEP_RESULTS_H
+/*
+ *  sweep_results.h
+ *  FaceTracker
+ *
+ *  Binary columnar results for TEST_MANY_SETTINGS parameter sweeps.
+ *
+ *  A sweep has one row per (image, cascade, min_neighbors, scale_factor).
+ *  Rows are written in groups of up to SWEEP_ROWS_PER_GROUP. Each group
+ *  stores each column contiguously as fixed width numbers, 8 byte aligned,
+ *  so a reader can memory map the file and aggregate over plain arrays.
+ *  Image and cascade names are dictionary encoded: rows hold indexes into
+ *  name tables kept in the footer, with each image's ground truth.
+ *
+ *  Layout. Numbers are in the byte order of the machine that wrote them
+ *      "FTSWEEP1"
+ *      row groups:  int32 image[n] cascade[n] min_neighbors[n] 
+ *                   face_x[n] face_y[n] face_width[n] face_height[n]
+ *                   padding to 8 bytes, double scale_factor[n]
+ *      footer:      uint32 number of cascades, then per cascade uint32 length, name
+ *                   uint32 number of images, then per image uint32 length, name, 
+ *                          int32 face_center_x, face_center_y, face_radius
+ *                   uint32 number of groups, then per group uint64 offset, uint32 n
+ *      trailer:     uint64 footer offset, "FTSWEEP1"
+ */
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "face_common.h"
+#include "results_writer.h"
+
+static const int SWEEP_ROWS_PER_GROUP = 65536;
+
+struct SweepRow {
+    int     _image;             // Index into the image table
+    int     _cascade;           // Index into the cascade table
+    int     _min_neighbors;
+    double  _scale_factor;
+    PwRect  _face;              // Best face, in the coordinates of the ground truth. Zero size if none was found
+    SweepRow(): _image(0), _cascade(0), _min_neighbors(0), _scale_factor(0.0) {}
+};
+
+struct SweepImage {
+    std::string _name;
+    PwPoint     _face_center;   // Ground truth from the file list
+    int         _face_radius;   // 0 if there is no ground truth
+    SweepImage(): _face_radius(0) {}
+};
+
+struct SweepWriter;
+
+/*
+ *  Returns 0 and sets *error if path cannot be written
+ */
+SweepWriter* openSweepWriter(const std::string path, std::string* error);
+
+/*
+ *  Index of the image or cascade, added to its table if it is not already there
+ */
+int  addSweepImage(SweepWriter* writer, const SweepImage& image);
+int  addSweepCascade(SweepWriter* writer, const std::string cascade_name);
+
+void writeSweepRow(SweepWriter* writer, const SweepRow& row);
+
+/*
+ *  Writes the last row group and the footer. Returns false and sets *error 
+ *  if any write failed
+ */
+bool closeSweepWriter(SweepWriter** writer, std::string* error);
+
+/*
+ *  Columns of one row group. The pointers are into the mapped file
+ */
+struct SweepGroup {
+    int             _num_rows;
+    const int32_t*  _image;
+    const int32_t*  _cascade;
+    const int32_t*  _min_neighbors;
+    const int32_t*  _face_x;
+    const int32_t*  _face_y;
+    const int32_t*  _face_width;
+    const int32_t*  _face_height;
+    const double*   _scale_factor;
+    SweepRow getRow(int i) const;
+};
+
+struct FileMapping;
+
+/*
+ *  A memory mapped sweep file. Groups are valid while the table is
+ */
+struct SweepTable {
+    std::shared_ptr<const FileMapping>  _mapping;
+    std::vector<std::string>            _cascades;
+    std::vector<SweepImage>             _images;
+    std::vector<SweepGroup>             _groups;
+    long getNumRows() const;
+};
+
+bool readSweepTable(const std::string path, SweepTable* table, std::string* error);
+
+/*
+ *  One line per row with names in place of indexes. Numbers are formatted
+ *  straight into out's buffer
+ */
+void writeSweepCsvHeader(ResultsWriter* out);
+void writeSweepCsv(const SweepTable& table, ResultsWriter* out);
+
+#endif // #ifndef SWEEP_RESULTS_H
@@ -0,0 +1,272 @@
+/*
+ *  work_pool.cpp
+ *  FaceTracker
+ *
+ *  Work-stealing thread pool for a fixed list of items or a stream of them
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "work_pool.h"
+
+using namespace std;
+
+int getNumCores() {
+    int n = (int)thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+int WorkStats::getNumSteals() const {
+    int n = 0;
+    for (int i = 0; i < (int)_steals_per_worker.size(); i++)
+        n += _steals_per_worker[i];
+    return n;
+}
+
+/*
+ *  Each worker's queue has its own lock. Owners and thieves only contend
+ *  on a queue when it is being stolen from.
+ */
+struct WorkerQueue {
+    mutex       _lock;
+    deque<int>  _items;
+};
+
+struct WorkPool {
+    vector<WorkerQueue> _queues;
+    WorkFunc            _func;
+    void*               _context;
+    WorkStats           _stats;
+    WorkPool(int num_workers): _queues(num_workers) {}
+};
+
+static bool popOwn(WorkerQueue& q, int* item) {
+    lock_guard<mutex> guard(q._lock);
+    if (q._items.empty())
+        return false;
+    *item = q._items.front();
+    q._items.pop_front();
+    return true;
+}
+
+static bool steal(WorkerQueue& q, int* item) {
+    lock_guard<mutex> guard(q._lock);
+    if (q._items.empty())
+        return false;
+    *item = q._items.back();
+    q._items.pop_back();
+    return true;
+}
+
+/*
+ *  No items are added once the pool starts, so a worker can stop as soon as
+ *  one pass over all the other queues finds nothing to steal
+ */
+static void workerLoop(WorkPool* pool, int worker) {
+    int num_workers = (int)pool->_queues.size();
+    int item;
+    while (true) {
+        bool got_item = popOwn(pool->_queues[worker], &item);
+        for (int i = 1; i < num_workers && !got_item; i++) {
+            got_item = steal(pool->_queues[(worker + i) % num_workers], &item);
+            if (got_item)
+                pool->_stats._steals_per_worker[worker]++;
+        }
+        if (!got_item)
+            break;
+        pool->_func(pool->_context, worker, item);
+        pool->_stats._items_per_worker[worker]++;
+    }
+}
+
+WorkStats runWorkStealing(int num_items, int num_workers, WorkFunc func, void* context) {
+    if (num_workers < 1)
+        num_workers = 1;
+    if (num_workers > num_items && num_items > 0)
+        num_workers = num_items;
+    
+    WorkPool pool(num_workers);
+    pool._func = func;
+    pool._context = context;
+    pool._stats._items_per_worker.resize(num_workers, 0);
+    pool._stats._steals_per_worker.resize(num_workers, 0);
+    for (int w = 0; w < num_workers; w++) {
+        int begin = (int)((long)num_items * w / num_workers);
+        int end   = (int)((long)num_items * (w + 1) / num_workers);
+        for (int i = begin; i < end; i++)
+            pool._queues[w]._items.push_back(i);
+    }
+    
+    vector<thread> threads;
+    for (int w = 1; w < num_workers; w++)
+        threads.push_back(thread(workerLoop, &pool, w));
+    workerLoop(&pool, 0);
+    for (int i = 0; i < (int)threads.size(); i++)
+        threads[i].join();
+    return pool._stats;
+}
+
+/*
+ *  The streaming pool hands out items through the same per-worker queues 
+ *  as runWorkStealing(). Each fetched range of items is split into one 
+ *  contiguous block per worker and workers steal from the back of other 
+ *  workers' blocks.
+ *      Items [_num_done, _num_fetched) are in the window. _finished[slot] is
+ *      set when an item's WorkFunc returns and cleared when its DoneFunc is
+ *      called. _fetching and _finishing let one thread at a time call the
+ *      FetchFunc and the DoneFunc.
+ *      _lock and _changed are only used to sleep when there is nothing to 
+ *      do. _version counts the changes that can give a sleeping worker 
+ *      something to do.
+ */
+struct StreamPool {
+    int                 _window;
+    FetchFunc           _fetch;
+    WorkFunc            _func;
+    DoneFunc            _done;
+    void*               _context;
+    WorkStats           _stats;
+    vector<WorkerQueue> _queues;
+    vector<atomic<char> > _finished;
+    atomic<int>         _num_fetched;
+    atomic<int>         _num_claimed;
+    atomic<int>         _num_done;
+    atomic<bool>        _end;
+    atomic<bool>        _fetching;
+    atomic<bool>        _finishing;
+    
+    mutex               _lock;
+    condition_variable  _changed;
+    atomic<int>         _version;
+    StreamPool(int window, int num_workers): _queues(num_workers), _finished(window) {}
+};
+
+static void notifyChange(StreamPool* pool) {
+    {
+        lock_guard<mutex> guard(pool->_lock);
+        pool->_version++;
+    }
+    pool->_changed.notify_all();
+}
+
+/*
+ *  Call the DoneFunc of finished items in order. Re-checks after letting go
+ *  of _finishing in case an item finished just before
+ */
+static void finishItems(StreamPool* pool) {
+    bool finished_any = false;
+    while (pool->_finished[pool->_num_done % pool->_window] && !pool->_finishing.exchange(true)) {
+        while (pool->_finished[pool->_num_done % pool->_window]) {
+            int item = pool->_num_done;
+            pool->_finished[item % pool->_window] = 0;
+            pool->_done(pool->_context, item);
+            pool->_num_done++;
+            finished_any = true;
+        }
+        pool->_finishing = false;
+    }
+    if (finished_any)
+        notifyChange(pool);
+}
+
+/*
+ *  Fetch in large steps unless the workers have run out of items.
+ *  Returns true if items were fetched
+ */
+static bool fetchItems(StreamPool* pool) {
+    if (pool->_end || pool->_fetching.exchange(true))
+        return false;
+    int first = pool->_num_fetched;
+    int room = pool->_window - (first - pool->_num_done);
+    bool queued = pool->_num_claimed < first;
+    if (pool->_end || room <= 0 || (queued && room < pool->_window/2)) {
+        pool->_fetching = false;
+        return false;
+    }
+    int n = min(pool->_fetch(pool->_context, first, room), room);
+    if (n > 0) {
+        int num_workers = (int)pool->_queues.size();
+        for (int w = 0; w < num_workers; w++) {
+            int begin = first + (int)((long)n * w / num_workers);
+            int end   = first + (int)((long)n * (w + 1) / num_workers);
+            if (begin == end)
+                continue;
+            lock_guard<mutex> guard(pool->_queues[w]._lock);
+            for (int i = begin; i < end; i++)
+                pool->_queues[w]._items.push_back(i);
+        }
+        pool->_num_fetched += n;
+    } else {
+        pool->_end = true;
+    }
+    pool->_fetching = false;
+    notifyChange(pool);
+    return n > 0;
+}
+
+static void streamWorkerLoop(StreamPool* pool, int worker) {
+    int num_workers = (int)pool->_queues.size();
+    while (true) {
+        int seen = pool->_version;
+        finishItems(pool);
+        fetchItems(pool);
+        
+        int item;
+        bool got_item = popOwn(pool->_queues[worker], &item);
+        for (int i = 1; i < num_workers && !got_item; i++) {
+            got_item = steal(pool->_queues[(worker + i) % num_workers], &item);
+            if (got_item)
+                pool->_stats._steals_per_worker[worker]++;
+        }
+        if (got_item) {
+            pool->_num_claimed++;
+            pool->_func(pool->_context, worker, item);
+            pool->_stats._items_per_worker[worker]++;
+            pool->_finished[item % pool->_window] = 1;
+            continue;
+        }
+        if (fetchItems(pool))
+            continue;
+        
+        unique_lock<mutex> guard(pool->_lock);
+        if (pool->_end && pool->_num_done == pool->_num_fetched)
+            break;
+        pool->_changed.wait(guard, [pool, seen] { return pool->_version != seen; });
+    }
+}
+
+WorkStats runWorkStream(int window, int num_workers, FetchFunc fetch, WorkFunc func, DoneFunc done, void* context) {
+    if (window < 1)
+        window = 1;
+    if (num_workers < 1)
+        num_workers = 1;
+    
+    StreamPool pool(window, num_workers);
+    pool._window = window;
+    pool._fetch = fetch;
+    pool._func = func;
+    pool._done = done;
+    pool._context = context;
+    pool._stats._items_per_worker.resize(num_workers, 0);
+    pool._stats._steals_per_worker.resize(num_workers, 0);
+    for (int i = 0; i < window; i++)
+        pool._finished[i] = 0;
+    pool._num_fetched = 0;
+    pool._num_claimed = 0;
+    pool._num_done = 0;
+    pool._end = false;
+    pool._fetching = false;
+    pool._finishing = false;
+    pool._version = 0;
+    
+    vector<thread> threads;
+    for (int w = 1; w < num_workers; w++)
+        threads.push_back(thread(streamWorkerLoop, &pool, w));
+    streamWorkerLoop(&pool, 0);
+    for (int i = 0; i < (int)threads.size(); i++)
+        threads[i].join();
+    return pool._stats;
+}
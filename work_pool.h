@@ -0,0 +1,60 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+/*
+ *  work_pool.h
+ *  FaceTracker
+ *
+ *  Work-stealing thread pool for a fixed list of items.
+ *  Items are split into contiguous blocks, one per worker. A worker takes
+ *  items from the front of its own block and, when that runs out, steals
+ *  from the back of another worker's block. This keeps workers busy when
+ *  per-item cost varies a lot, as it does for the adaptive face search.
+ *
+ *  runWorkStream() does the same for a stream of items of unknown length.
+ *  Each range of items it fetches is split into blocks on the workers' 
+ *  queues, and finished items are handed back in order through a bounded 
+ *  window of items in flight.
+ */
+
+#include <vector>
+#include "config.h"
+
+/*
+ *  Process one item. worker is in [0, num_workers) and is only ever used by
+ *  one thread at a time, so it can index per-thread state in context.
+ *  Worker 0 runs on the calling thread.
+ */
+typedef void (*WorkFunc)(void* context, int worker, int item);
+
+struct WorkStats {
+    std::vector<int> _items_per_worker;
+    std::vector<int> _steals_per_worker;
+    int getNumSteals() const;
+};
+
+int getNumCores();
+
+WorkStats runWorkStealing(int num_items, int num_workers, WorkFunc func, void* context);
+
+/*
+ *  Get up to max_items more items, numbered from first_item. Return the 
+ *  number got, 0 at the end of the stream. Called on one thread at a time.
+ */
+typedef int (*FetchFunc)(void* context, int first_item, int max_items);
+
+/*
+ *  An item whose WorkFunc has finished. Called in item order on one thread 
+ *  at a time.
+ */
+typedef void (*DoneFunc)(void* context, int item);
+
+/*
+ *  Process items from fetch until it runs out. At most window items are
+ *  fetched but not yet done, so per item state in context can be kept in
+ *  window slots indexed by item % window. A slot is free again once its
+ *  item's DoneFunc has returned.
+ *  Worker 0 runs on the calling thread.
+ */
+WorkStats runWorkStream(int window, int num_workers, FetchFunc fetch, WorkFunc func, DoneFunc done, void* context);
+
+#endif // #ifndef WORK_POOL_H